@@ -0,0 +1,41 @@
+#include <thread>
+#include "headers/segmentstore.hpp"
+
+// Tail the memory-mapped segments of a historical store as CSV on stdout, concurrently with the server
+// usage: histtail <store> [productId] [-f]
+//   store: path of the store without the segment suffix (e.g. ../res/streaming)
+//   productId: product to print, "" or "all" for every product
+//   -f: keep following the store as records are committed
+int main(int argc, char** argv){
+  if (argc < 2) {
+    cerr << "usage: " << argv[0] << " <store> [productId] [-f]" << endl;
+    return 1;
+  }
+  string store = argv[1];
+  string productId = (argc > 2) ? argv[2] : "";
+  if (productId == "all" || productId == "-f") productId = "";
+  bool follow = string(argv[argc - 1]) == "-f";
+
+  try {
+    SegmentReader reader(store);
+    const RecordSchema& schema = reader.GetSchema();
+    int productColumn = schema.FindColumn("product");
+    auto print = [&](const char* row) {
+      if (!productId.empty() && productColumn >= 0 && readSymbol(row + schema.columns[productColumn].offset, schema.columns[productColumn].GetSize()) != productId) return;
+      writeCsvRow(cout, schema, row);
+    };
+    writeCsvHeader(cout, schema);
+    reader.Poll(print);
+    while (follow) {
+      if (reader.Poll(print) == 0) {
+        cout.flush();
+        this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+    }
+  }
+  catch (const std::exception& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
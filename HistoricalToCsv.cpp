@@ -0,0 +1,35 @@
+#include "headers/historicalstore.hpp"
+
+// Export a columnar historical store to CSV on stdout
+// usage: histcsv <store> [productId] [from] [to]
+//   store: path of the store without extension (e.g. ../res/positions)
+//   productId: product to export, "" or "all" for every product
+//   from, to: local time (e.g. "2023-12-23 22:42:44.260") or nanoseconds since epoch
+int main(int argc, char** argv){
+  if (argc < 2) {
+    cerr << "usage: " << argv[0] << " <store> [productId] [from] [to]" << endl;
+    return 1;
+  }
+  string store = argv[1];
+  if (store.size() > 4 && store.substr(store.size() - 4) == ".col") {
+    store = store.substr(0, store.size() - 4);
+  }
+  string productId = (argc > 2) ? argv[2] : "";
+  if (productId == "all") productId = "";
+
+  try {
+    int64_t from = (argc > 3) ? parseTime(argv[3]) : numeric_limits<int64_t>::min();
+    int64_t to = (argc > 4) ? parseTime(argv[4]) : numeric_limits<int64_t>::max();
+    ColumnarReader reader(store);
+    const RecordSchema& schema = reader.GetSchema();
+    writeCsvHeader(cout, schema);
+    reader.Query(productId, from, to, [&schema](const char* row) {
+      writeCsvRow(cout, schema, row);
+    });
+  }
+  catch (const std::exception& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
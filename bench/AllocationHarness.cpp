@@ -0,0 +1,226 @@
+#include "../headers/allocationcounter.hpp"
+#include "../headers/servercontext.hpp"
+#include "../headers/timerwheel.hpp"
+#include "../headers/products.hpp"
+#include "../headers/productregistry.hpp"
+#include "../headers/pricingservice.hpp"
+#include "../headers/algostreamingservice.hpp"
+#include "../headers/streamingservice.hpp"
+#include "../headers/marketdataservice.hpp"
+#include "../headers/algoexecutionservice.hpp"
+#include "../headers/pretraderiskservice.hpp"
+#include "../headers/executionservice.hpp"
+#include "../headers/tradebookingservice.hpp"
+#include "../headers/positionservice.hpp"
+#include "../headers/riskservice.hpp"
+
+#include <cstdio>
+#include <climits>
+
+// Ticks run before the counting starts, so that stores, registries and arenas reach their steady state
+const long HARNESS_WARMUP_TICKS = 2000;
+
+// Ticks counted by default
+const long HARNESS_TICKS = 20000;
+
+// Products the ticks rotate through
+const vector<string> HARNESS_BONDS = {"9128283H1", "9128283L2", "912828M80", "9128283J7", "9128283F5", "912810TW8", "912810RZ3"};
+
+// a stage of a pipeline and its budget of allocations per message
+struct StageBudget
+{
+  string name;
+  double budget;
+};
+
+// Stages of the price pipeline, in pipeline order, and their default budgets
+// the streaming stage ends at the outbound socket: its connector formats the line into a stack buffer,
+// but still allocates the queued line and the handler posted to the connector strand
+vector<StageBudget> priceStages = {
+  {"pricing", 0.0},
+  {"algostreaming", 0.0},
+  {"streaming", 2.0},
+};
+
+// Stages of the market data pipeline, in pipeline order, and their default budgets
+// the execution stage ends at the outbound socket as the streaming stage does, and its order store grows
+// by one pooled node per order, a chunk of nodes every NODE_POOL_CHUNK_NODES orders
+vector<StageBudget> marketStages = {
+  {"marketdata", 0.0},
+  {"algoexecution", 0.0},
+  {"pretraderisk", 0.0},
+  {"execution", 2.1},
+  {"tradebooking", 0.0},
+  {"position", 0.0},
+  {"risk", 0.0},
+};
+
+// allocations of the counted ticks of a pipeline
+struct StageCount
+{
+  double allocations; // per message
+  double bytes; // per message
+};
+
+// run the ticks of a pipeline, the warmup ticks first, and count the allocations of the others
+template<typename F>
+StageCount countTicks(F& tick, long ticks)
+{
+  for (long i = 0; i < HARNESS_WARMUP_TICKS; ++i) {
+    tick(i);
+  }
+  AllocationScope scope;
+  for (long i = 0; i < ticks; ++i) {
+    tick(HARNESS_WARMUP_TICKS + i);
+  }
+  AllocationStats stats = scope.GetStats();
+  return StageCount{static_cast<double>(stats.allocations) / ticks, static_cast<double>(stats.bytes) / ticks};
+}
+
+/**
+ * Drive the price pipeline wired up to a depth: pricing -> algo streaming -> streaming.
+ * The prices are built before the counting, so only the services are counted.
+ */
+StageCount runPricePipeline(size_t depth, long ticks)
+{
+  ServerContext serverContext(1);
+  Strand priceStrand = serverContext.MakeStrand();
+  TimerService timerService(serverContext);
+  PricingService<Bond> pricingService(priceStrand, "localhost", "3000");
+  AlgoStreamingService<Bond> algoStreamingService(&timerService, priceStrand);
+  StreamingService<Bond> streamingService(serverContext.MakeStrand(), "localhost", "3004", &timerService);
+  if (depth > 1) pricingService.AddListener(algoStreamingService.GetAlgoStreamingListener());
+  if (depth > 2) algoStreamingService.AddListener(streamingService.GetStreamingServiceListener());
+
+  // 64 mids per product, 1/256 apart, with the spread between 1/128 and 1/64 as in the generated prices
+  vector<Price<Bond>> prices;
+  for (size_t k = 0; k < 64; ++k) {
+    for (auto& cusip : HARNESS_BONDS) {
+      prices.push_back(Price<Bond>(lookupProduct<Bond>(cusip), 99.0 + k / 256.0, (k % 2 == 0) ? 1.0 / 128.0 : 1.0 / 64.0));
+    }
+  }
+  auto tick = [&](long i) { pricingService.OnMessage(prices[i % prices.size()]); };
+  return countTicks(tick, ticks);
+}
+
+/**
+ * Drive the market data pipeline wired up to a depth:
+ * market data -> algo execution -> pre-trade risk -> execution -> trade booking -> position -> risk.
+ * A tick does what the market data connector does with a parsed line: it pushes the levels into the
+ * stored book, aggregates it and publishes it. The book is at its tightest spread, so every tick is an order.
+ */
+StageCount runMarketPipeline(size_t depth, long ticks)
+{
+  ServerContext serverContext(1);
+  Strand bookingStrand = serverContext.MakeStrand();
+  TimerService timerService(serverContext);
+  MarketDataService<Bond> marketDataService(bookingStrand, "localhost", "3001");
+  AlgoExecutionService<Bond> algoExecutionService(&timerService, bookingStrand);
+  PreTradeRiskService<Bond> preTradeRiskService(1.0e300);
+  ExecutionService<Bond> executionService(serverContext.MakeStrand(), "localhost", "3005", &timerService);
+  TradeBookingService<Bond> tradeBookingService(bookingStrand, "localhost", "3002");
+  PositionService<Bond> positionService;
+  RiskService<Bond> riskService;
+
+  // limits no order reaches, so every order flows to the execution service
+  RiskLimits limits = {LONG_MAX / 4, LONG_MAX / 4, LONG_MAX / 4, 1.0e300, 1.0e12, 1.0e12};
+  for (auto& cusip : HARNESS_BONDS) {
+    preTradeRiskService.SetLimits(cusip, limits);
+  }
+
+  if (depth > 1) marketDataService.AddListener(algoExecutionService.GetAlgoExecutionServiceListener());
+  if (depth > 2) algoExecutionService.AddListener(preTradeRiskService.GetPreTradeRiskServiceListener());
+  if (depth > 3) preTradeRiskService.AddListener(executionService.GetExecutionServiceListener());
+  if (depth > 4) executionService.AddListener(tradeBookingService.GetTradeBookingServiceListener());
+  if (depth > 5) {
+    tradeBookingService.AddListener(positionService.GetPositionListener());
+    positionService.AddListener(preTradeRiskService.GetPreTradePositionListener());
+  }
+  if (depth > 6) {
+    positionService.AddListener(riskService.GetRiskServiceListener());
+    riskService.AddListener(preTradeRiskService.GetPreTradePV01Listener());
+  }
+
+  vector<ProductId> productIds;
+  for (auto& cusip : HARNESS_BONDS) {
+    productIds.push_back(lookupProduct<Bond>(cusip).GetProductId());
+  }
+  auto tick = [&](long i) {
+    const ProductId& productId = productIds[i % productIds.size()];
+    OrderBook<Bond>& orderBook = marketDataService.GetData(productId);
+    for (int k = 0; k < marketDataService.GetBookDepth(); k++) {
+      orderBook.GetBidStack().push_back(Order(99.0 - k / 128.0, 1000000 * (k + 1), BID));
+      orderBook.GetOfferStack().push_back(Order(99.0 + (k + 1) / 128.0, 1000000 * (k + 1), OFFER));
+    }
+    OrderBook<Bond>& aggOrderBook = marketDataService.AggregateDepth(productId);
+    marketDataService.OnMessage(aggOrderBook);
+  };
+  return countTicks(tick, ticks);
+}
+
+// count each stage of a pipeline as the difference between the pipeline cut after it and cut before it,
+// print it against its budget, returns the number of stages over budget
+template<typename F>
+int checkPipeline(const string& pipeline, const vector<StageBudget>& stages, F run, long ticks)
+{
+  int failures = 0;
+  StageCount previous = {0.0, 0.0};
+  for (size_t depth = 1; depth <= stages.size(); ++depth) {
+    StageCount count = run(depth, ticks);
+    double allocations = max(0.0, count.allocations - previous.allocations);
+    double bytes = max(0.0, count.bytes - previous.bytes);
+    bool passed = allocations <= stages[depth - 1].budget;
+    if (!passed) failures++;
+    printf("%-8s %-16s %10.3f allocs/msg %10.1f bytes/msg %8.3f budget  %s\n", pipeline.c_str(), stages[depth - 1].name.c_str(), allocations, bytes, stages[depth - 1].budget, passed ? "ok" : "OVER BUDGET");
+    previous = count;
+  }
+  return failures;
+}
+
+// set the budget of a stage from a stage=budget argument
+bool setBudget(const string& argument)
+{
+  size_t pos = argument.find('=');
+  if (pos == string::npos) return false;
+  string name = argument.substr(0, pos);
+  double budget = parseDecimal(string_view(argument).substr(pos + 1));
+  for (auto* stages : {&priceStages, &marketStages}) {
+    for (auto& stage : *stages) {
+      if (stage.name == name) {
+        stage.budget = budget;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Count the steady-state allocations per message of each stage of the price and market data pipelines,
+// usage: bench_alloc [ticks] [stage=budget ...], returns 1 if a stage is over its budget
+int main(int argc, char** argv){
+  long ticks = HARNESS_TICKS;
+  for (int i = 1; i < argc; ++i) {
+    string argument = argv[i];
+    if (argument.find('=') == string::npos) {
+      ticks = parseInteger(argument);
+    } else if (!setBudget(argument)) {
+      fprintf(stderr, "Unknown stage budget: %s\n", argument.c_str());
+      return 2;
+    }
+  }
+  if (ticks <= 0) {
+    fprintf(stderr, "The number of ticks must be positive\n");
+    return 2;
+  }
+
+  printf("%ld ticks per stage after %ld warmup ticks\n", ticks, HARNESS_WARMUP_TICKS);
+  int failures = 0;
+  failures += checkPipeline("price", priceStages, runPricePipeline, ticks);
+  failures += checkPipeline("market", marketStages, runMarketPipeline, ticks);
+  if (failures > 0) {
+    printf("%d stages over budget\n", failures);
+    return 1;
+  }
+  printf("all stages within budget\n");
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include "../headers/utils.hpp"
+#include "../headers/products.hpp"
+#include "../headers/productregistry.hpp"
+#include "../headers/servercontext.hpp"
+#include "../headers/pricingservice.hpp"
+#include "../headers/marketdataservice.hpp"
+#include "../headers/algostreamingservice.hpp"
+#include "../headers/algoexecutionservice.hpp"
+#include "../headers/pretraderiskservice.hpp"
+#include "../headers/inquiryservice.hpp"
+#include "../headers/positionservice.hpp"
+#include "../headers/riskservice.hpp"
+#include "../headers/pnlservice.hpp"
+#include "benchmark.hpp"
+
+#include <sstream>
+
+// one line of each wire format, as written by the data generators
+const string PRICE_LINE = "2024-01-02 16:51:30.627,9128283H1,98-316,99-001,0.0148089";
+const string MARKET_DATA_LINE = "2024-01-02 16:51:30.627,9128283H1,98-317,1000000,99-001,1000000,98-316,2000000,99-002,2000000,98-315,3000000,99-003,3000000,98-31+,4000000,99-00+,4000000,98-313,5000000,99-005,5000000";
+const string TRADE_LINE = "9128283H1,JY9757ACX1EV,99-285,TRSY1,1000000,BUY";
+const string INQUIRY_LINE = "OM595MUHI7N7,9128283H1,BUY,1000000,99-285,RECEIVED";
+
+// benchmark writing a record into a reused stream, so the stream buffer is not reallocated
+template<typename R>
+BenchmarkResult benchmarkOutput(const string& name, const R& record)
+{
+  ostringstream stream;
+  stream << record;
+  return runBenchmark(name, [&]() { stream.seekp(0); stream << record; doNotOptimize(stream); });
+}
+
+// Microbenchmarks of the core primitives of the trading system,
+// usage: bench [results.json], the results are written as JSON (bench.json by default)
+int main(int argc, char** argv){
+  string jsonPath = (argc > 1) ? argv[1] : "bench.json";
+  vector<BenchmarkResult> results;
+
+  // prices
+  results.push_back(runBenchmark("convertPrice fractional to decimal", []() { doNotOptimize(convertPrice(string_view("99-25+"))); }));
+  results.push_back(runBenchmark("convertPrice decimal to fractional", []() { doNotOptimize(convertPrice(99.80859375)); }));
+
+  // tokenizing the input lines as the connectors do
+  vector<string_view> fields;
+  fields.reserve(32);
+  results.push_back(runBenchmark("splitFields price line", [&]() { splitFields(PRICE_LINE, fields); doNotOptimize(fields.data()); }));
+  results.push_back(runBenchmark("splitFields market data line", [&]() { splitFields(MARKET_DATA_LINE, fields); doNotOptimize(fields.data()); }));
+  results.push_back(runBenchmark("splitFields trade line", [&]() { splitFields(TRADE_LINE, fields); doNotOptimize(fields.data()); }));
+  results.push_back(runBenchmark("splitFields inquiry line", [&]() { splitFields(INQUIRY_LINE, fields); doNotOptimize(fields.data()); }));
+
+  // order books: five levels per side, as in the generated market data
+  const Bond& bond = lookupProduct<Bond>("9128283H1");
+  vector<Order> bidStack, offerStack;
+  for (int k = 0; k < 5; k++) {
+    bidStack.push_back(Order(99.0 - k / 128.0, 1000000 * (k + 1), BID));
+    offerStack.push_back(Order(99.0 + (k + 1) / 128.0, 1000000 * (k + 1), OFFER));
+  }
+  OrderBook<Bond> orderBook(bond, bidStack, offerStack);
+  results.push_back(runBenchmark("OrderBook::GetBestBidOffer", [&]() { doNotOptimize(orderBook.GetBestBidOffer()); }));
+
+  // the stored book is refilled with the levels of a line and aggregated in place, as the connector does
+  ServerContext serverContext(1);
+  MarketDataService<Bond> marketDataService(serverContext.MakeStrand(), "localhost", "3001");
+  const ProductId& productId = bond.GetProductId();
+  results.push_back(runBenchmark("MarketDataService::AggregateDepth", [&]() {
+    OrderBook<Bond>& book = marketDataService.GetData(productId);
+    for (int k = 0; k < 5; k++) {
+      book.GetBidStack().push_back(bidStack[k]);
+      book.GetOfferStack().push_back(offerStack[k]);
+    }
+    doNotOptimize(marketDataService.AggregateDepth(productId));
+  }));
+
+  // products and identifiers
+  string cusip = "912828M80";
+  results.push_back(runBenchmark("getProductObject", [&]() { doNotOptimize(getProductObject<Bond>(cusip)); }));
+  results.push_back(runBenchmark("lookupProduct", [&]() { doNotOptimize(lookupProduct<Bond>(cusip)); }));
+  results.push_back(runBenchmark("GenerateRandomId 12", []() { doNotOptimize(GenerateRandomId(12)); }));
+  results.push_back(runBenchmark("GenerateId", []() { doNotOptimize(GenerateId("Algo")); }));
+
+  // risk and positions
+  results.push_back(runBenchmark("calculate_pv01 30Y", []() { doNotOptimize(calculate_pv01(1000, 0.02750, 0.0443, 30, 2)); }));
+  Position<Bond> position(bond);
+  string books[] = {"TRSY1", "TRSY2", "TRSY3"};
+  for (int i = 0; i < 3; ++i) {
+    position.AddPosition(books[i], 1000000 * (i + 1));
+  }
+  results.push_back(runBenchmark("Position::GetAggregatePosition", [&]() { doNotOptimize(position.GetAggregatePosition()); }));
+
+  // operator<< of each record of the system
+  Price<Bond> price(bond, 99.5, 1.0 / 128.0);
+  PriceStreamOrder bidOrder(99.49609375, 1000000, 2000000, BID);
+  PriceStreamOrder offerOrder(99.50390625, 1000000, 2000000, OFFER);
+  PriceStream<Bond> priceStream(bond, bidOrder, offerOrder);
+  ExecutionOrder<Bond> executionOrder(bond, BID, GenerateId("Algo").View(), MARKET, 99.5, 1000000, 0, GenerateId("AlgoParent").View(), false);
+  OrderReject<Bond> orderReject(executionOrder, ORDER_RATE);
+  Inquiry<Bond> inquiry("OM595MUHI7N7", bond, BUY, 1000000, 99.89453125, RECEIVED);
+  PV01<Bond> pv01(bond, calculate_pv01(1000, 0.01750, 0.0464, 2, 2), 6000000);
+  PnL<Bond> pnl(bond);
+  pnl.AddTrade(0, 1000000, 99.5);
+  results.push_back(benchmarkOutput("operator<< Bond", bond));
+  results.push_back(benchmarkOutput("operator<< Price", price));
+  results.push_back(benchmarkOutput("operator<< PriceStreamOrder", bidOrder));
+  results.push_back(benchmarkOutput("operator<< PriceStream", priceStream));
+  results.push_back(benchmarkOutput("operator<< ExecutionOrder", executionOrder));
+  results.push_back(benchmarkOutput("operator<< OrderReject", orderReject));
+  results.push_back(benchmarkOutput("operator<< Inquiry", inquiry));
+  results.push_back(benchmarkOutput("operator<< Position", position));
+  results.push_back(benchmarkOutput("operator<< PV01", pv01));
+  results.push_back(benchmarkOutput("operator<< PnL", pnl));
+
+  if (!writeBenchmarkJson(jsonPath, argv[0], getTime(), results)) {
+    fprintf(stderr, "Cannot write %s\n", jsonPath.c_str());
+    return 1;
+  }
+  printf("Results written to %s\n", jsonPath.c_str());
+  return 0;
+}
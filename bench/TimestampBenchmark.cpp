@@ -0,0 +1,34 @@
+#include "../headers/utils.hpp"
+#include "benchmark.hpp"
+
+// the timestamp of getTime() before the cached formatter: localtime, put_time and a stringstream per call
+string getTimeStringstream() {
+    auto now = std::chrono::system_clock::now();
+    std::time_t now_c = std::chrono::system_clock::to_time_t(now);
+    std::tm now_tm = *std::localtime(&now_c);
+    stringstream ss;
+    ss << std::put_time(&now_tm, "%Y-%m-%d %H:%M:%S");
+    auto milli = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
+    ss << '.' << std::setfill('0') << std::setw(3) << milli.count();
+    return ss.str();
+}
+
+// Compare the clocks and the timestamp formatting against the stringstream getTime()
+int main(){
+  printf("TSC clock: %s, %.3f ticks/ns\n", tscClock.IsTsc() ? "invariant TSC" : "system clock fallback", tscClock.GetTicksPerNano());
+
+  runBenchmark("system_clock::now", []() { doNotOptimize(getWallNanos()); });
+  runBenchmark("TscClock::Now", []() { doNotOptimize(tscClock.Now()); });
+  runBenchmark("getTime (stringstream)", []() { doNotOptimize(getTimeStringstream()); });
+  runBenchmark("getTime (cached prefix)", []() { doNotOptimize(getTime()); });
+
+  TimestampFormatter formatter;
+  char buffer[TIMESTAMP_LENGTH];
+  runBenchmark("TimestampFormatter wall clock", [&]() { doNotOptimize(formatter.Format(getWallNanos(), buffer)); doNotOptimize(buffer); });
+  runBenchmark("TimestampFormatter TSC clock", [&]() { doNotOptimize(formatter.Format(tscClock.Now(), buffer)); doNotOptimize(buffer); });
+
+  // the TSC clock stays close to the wall clock after the calibration
+  int64_t drift = tscClock.Now() - getWallNanos();
+  printf("TSC clock - wall clock: %lld ns\n", static_cast<long long>(drift));
+  return 0;
+}
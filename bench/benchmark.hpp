@@ -0,0 +1,103 @@
+/**
+ * benchmark.hpp
+ * A small harness for the microbenchmarks of the system.
+ *
+ * A benchmark body runs in batches whose size doubles until a batch lasts long enough to time it,
+ * then a few batches of that size are timed and the fastest one is reported in nanoseconds per call.
+ * The results of a run can be written as JSON in the layout of Google Benchmark, to track them over time.
+ *
+ * @author Boyu Yang
+ */
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+
+using namespace std;
+
+// Shortest timed batch
+const long BENCHMARK_MIN_BATCH_NS = 20000000;
+
+// Number of timed batches of a benchmark
+const int BENCHMARK_REPETITIONS = 5;
+
+// keep a value alive so the compiler cannot drop the computation of it
+template<typename T>
+inline void doNotOptimize(const T& value)
+{
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// result of a benchmark
+struct BenchmarkResult
+{
+  string name;
+  long iterations; // calls per timed batch
+  double nanosPerOp; // fastest batch
+};
+
+// run a body in a batch of iterations, returns the elapsed nanoseconds
+template<typename F>
+long runBatch(F& body, long iterations)
+{
+  auto start = chrono::steady_clock::now();
+  for (long i = 0; i < iterations; ++i) {
+    body();
+  }
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// benchmark a body and print its result
+template<typename F>
+BenchmarkResult runBenchmark(const string& name, F body)
+{
+  long iterations = 1;
+  while (runBatch(body, iterations) < BENCHMARK_MIN_BATCH_NS && iterations < (1L << 40)) {
+    iterations *= 2;
+  }
+  double best = 1e300;
+  for (int r = 0; r < BENCHMARK_REPETITIONS; ++r) {
+    best = min(best, static_cast<double>(runBatch(body, iterations)) / iterations);
+  }
+  BenchmarkResult result = {name, iterations, best};
+  printf("%-40s %12.2f ns/op %14ld iterations\n", name.c_str(), best, iterations);
+  return result;
+}
+
+// write a text as a JSON string
+inline void writeJsonString(FILE* file, const string& text)
+{
+  fputc('"', file);
+  for (char c : text) {
+    if (c == '"' || c == '\\') fputc('\\', file);
+    fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+// write the results of a run as JSON, returns false if the file cannot be opened
+inline bool writeBenchmarkJson(const string& path, const string& executable, const string& date, const vector<BenchmarkResult>& results)
+{
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) return false;
+  fprintf(file, "{\n  \"context\": {\n    \"date\": ");
+  writeJsonString(file, date);
+  fprintf(file, ",\n    \"executable\": ");
+  writeJsonString(file, executable);
+  fprintf(file, ",\n    \"num_cpus\": %u,\n    \"repetitions\": %d\n  },\n  \"benchmarks\": [", thread::hardware_concurrency(), BENCHMARK_REPETITIONS);
+  for (size_t i = 0; i < results.size(); ++i) {
+    fprintf(file, "%s\n    {\"name\": ", i == 0 ? "" : ",");
+    writeJsonString(file, results[i].name);
+    fprintf(file, ", \"iterations\": %ld, \"real_time\": %.3f, \"time_unit\": \"ns\"}", results[i].iterations, results[i].nanosPerOp);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  fclose(file);
+  return true;
+}
+
+#endif
@@ -8,14 +8,56 @@
 #define ALGOEXECUTION_SERVICE_HPP
 
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
 #include "soa.hpp"  
+#include "arena.hpp"
 #include "marketdataservice.hpp"
+#include "timerwheel.hpp"
 #include "utils.hpp"
+#include "recordformat.hpp"
+#include "idgenerator.hpp"
 
 enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
 
 enum Market { BROKERTEC, ESPEED, CME };
 
+// Slicing strategies of a parent order
+// TWAP: child orders on a fixed interval, sized to keep up with a linear schedule, capped by the opposite top of book
+// VWAP: child orders on a fixed interval, sized as a participation of the displayed opposite depth
+// ICEBERG: one passive clip of the display quantity at a time, the next clip is sent once the previous one filled
+enum SliceStrategy { TWAP, VWAP, ICEBERG };
+
+// Lifecycle of a parent order
+enum ParentState { WORKING, COMPLETED, EXPIRED, CANCELLED };
+
+// Lot size of child orders, US Treasuries trade in millions of face value
+const long SLICE_LOT_SIZE = 1000000;
+
+/**
+ * Parameters of a slicing strategy.
+ */
+struct SliceParameters
+{
+  SliceStrategy strategy;
+  long durationMs; // time to work the parent order, the remainder is sent at the end (TWAP, VWAP) or expired (ICEBERG)
+  long intervalMs; // time between two child orders
+  double participation; // VWAP: fraction of the displayed opposite depth taken by a child
+  long displayQuantity; // ICEBERG: quantity of a clip
+};
+
+// Snapshot of the top of book and the displayed depth of a product, as used to size child orders
+struct BookSnapshot
+{
+  double bidPrice = 0.0;
+  double offerPrice = 0.0;
+  long bidQuantity = 0; // quantity at the best bid
+  long offerQuantity = 0; // quantity at the best offer
+  long bidDepth = 0; // quantity of all bid levels
+  long offerDepth = 0; // quantity of all offer levels
+};
+
 /**
  * An execution order that can be placed on an exchange.
  * Type T is the product type.
@@ -28,7 +70,7 @@ public:
 
   // ctor for an order
   ExecutionOrder() = default; // needed for map data structure later
-  ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
+  ExecutionOrder(const T &_product, PricingSide _side, string_view _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string_view _parentOrderId, bool _isChildOrder);
 
   // Get the product
   const T& GetProduct() const;
@@ -37,7 +79,7 @@ public:
   PricingSide GetSide() const;
 
   // Get the order ID
-  const string& GetOrderId() const;
+  const OrderId& GetOrderId() const;
 
   // Get the order type on this order
   OrderType GetOrderType() const;
@@ -52,7 +94,7 @@ public:
   long GetHiddenQuantity() const;
 
   // Get the parent order ID
-  const string& GetParentOrderId() const;
+  const OrderId& GetParentOrderId() const;
 
   // Is child order?
   bool IsChildOrder() const;
@@ -64,27 +106,25 @@ public:
 private:
   T product;
   PricingSide side;
-  string orderId;
+  OrderId orderId;
   OrderType orderType;
   double price;
   long visibleQuantity;
   long hiddenQuantity;
-  string parentOrderId;
+  OrderId parentOrderId;
   bool isChildOrder;
 
 };
 
 template<typename T>
-ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
-  product(_product)
+ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string_view _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string_view _parentOrderId, bool _isChildOrder) :
+  product(_product), orderId(_orderId), parentOrderId(_parentOrderId)
 {
   side = _side;
-  orderId = _orderId;
   orderType = _orderType;
   price = _price;
   visibleQuantity = _visibleQuantity;
   hiddenQuantity = _hiddenQuantity;
-  parentOrderId = _parentOrderId;
   isChildOrder = _isChildOrder;
 }
 
@@ -102,7 +142,7 @@ PricingSide ExecutionOrder<T>::GetSide() const
 
 
 template<typename T>
-const string& ExecutionOrder<T>::GetOrderId() const
+const OrderId& ExecutionOrder<T>::GetOrderId() const
 {
   return orderId;
 }
@@ -132,7 +172,7 @@ long ExecutionOrder<T>::GetHiddenQuantity() const
 }
 
 template<typename T>
-const string& ExecutionOrder<T>::GetParentOrderId() const
+const OrderId& ExecutionOrder<T>::GetParentOrderId() const
 {
   return parentOrderId;
 }
@@ -143,40 +183,32 @@ bool ExecutionOrder<T>::IsChildOrder() const
   return isChildOrder;
 }
 
+// name of an order type
+const char* orderTypeName(OrderType orderType)
+{
+  switch (orderType) {
+    case FOK: return "FOK";
+    case MARKET: return "MARKET";
+    case LIMIT: return "LIMIT";
+    case STOP: return "STOP";
+    case IOC: return "IOC";
+  }
+  return "";
+}
+
+// format the fields of an execution order
+template<typename T>
+void formatRecord(TextWriter& writer, const ExecutionOrder<T>& order)
+{
+  writeFields(writer, order.GetProduct().GetProductId(), order.GetOrderId(), order.GetSide() == BID ? "Bid" : "Ask",
+    orderTypeName(order.GetOrderType()), PriceField{order.GetPrice()}, order.GetVisibleQuantity(), order.GetHiddenQuantity(),
+    order.GetParentOrderId(), order.IsChildOrder() ? "True" : "False");
+}
+
 template<typename T>
 ostream& operator<<(ostream& os, const ExecutionOrder<T>& order)
 {
-  T product = order.GetProduct();
-  string _product = product.GetProductId();
-  string _orderId = order.GetOrderId();
-  string _side = (order.GetSide()==BID? "Bid":"Ask");
-  string _orderType;
-  switch(order.GetOrderType()) {
-      case FOK: _orderType = "FOK"; break;
-      case MARKET: _orderType = "MARKET"; break;
-      case LIMIT: _orderType = "LIMIT"; break;
-      case STOP: _orderType = "STOP"; break;
-      case IOC: _orderType = "IOC"; break;
-  }
-  string _price = convertPrice(order.GetPrice());
-  string _visibleQuantity = to_string(order.GetVisibleQuantity());
-  string _hiddenQuantity = to_string(order.GetHiddenQuantity());
-  string _parentOrderId = order.GetParentOrderId();
-  string _isChildOrder = (order.IsChildOrder()?"True":"False");
-
-  vector<string> _strings;
-  _strings.push_back(_product);
-  _strings.push_back(_orderId);
-  _strings.push_back(_side);
-  _strings.push_back(_orderType);
-  _strings.push_back(_price);
-  _strings.push_back(_visibleQuantity);
-  _strings.push_back(_hiddenQuantity);
-  _strings.push_back(_parentOrderId);
-  _strings.push_back(_isChildOrder);
-  string _str = join(_strings, ",");
-  os << _str;
-  return os;
+  return writeRecord(os, order);
 }
 
 /**
@@ -222,10 +254,47 @@ Market AlgoExecution<T>::GetMarket() const
   return market;
 }
 
+/**
+ * A parent order worked by the slicing engine.
+ * Quantities: sent counts the child quantity not rejected, filled the child quantity booked.
+ * Type T is the product type.
+ */
+template<typename T>
+struct ParentOrder
+{
+  T product;
+  OrderId parentOrderId;
+  size_t productIndex; // index of the book snapshot of the product
+  PricingSide side;
+  long quantity;
+  long sent;
+  long filled;
+  SliceParameters parameters;
+  int64_t startMs;
+  int64_t endMs;
+  ParentState state;
+  TimerId timer; // next slice
+  uint32_t generation; // incremented each time the slot is released, so late fills of a previous parent are ignored
+};
+
+// A child order in flight: slot and generation of its parent, and its quantity
+struct ChildOrderRef
+{
+  size_t slot;
+  uint32_t generation;
+  long quantity;
+};
+
 // forward declaration of AlgoExecutionServiceListener
 template<typename T>
 class AlgoExecutionServiceListener;
 
+// forward declaration of the data types of the fill and reject feeds of the child orders
+template<typename T>
+class Trade;
+template<typename T>
+class OrderReject;
+
 
 /**
  * Algo Execution Service to execute orders on market.
@@ -236,15 +305,41 @@ template<typename T>
 class AlgoExecutionService : public Service<string, AlgoExecution<T>>
 {
 private:
-  map<string, AlgoExecution<T>> algoExecutionMap; // store algo execution data keyed by product identifier
+  PooledMap<ProductId, AlgoExecution<T>> algoExecutionMap; // store algo execution data keyed by product identifier
   vector<ServiceListener<AlgoExecution<T>>*> listeners; // list of listeners to this service
   AlgoExecutionServiceListener<T>* algoexecservicelistener;
   double spread;
   long count;
 
+  // slicing engine: parents live in a pool of slots, their slices are scheduled on a timer wheel
+  vector<SliceParameters> sliceParameters; // strategies of the parents created from the market data, in rotation
+  vector<ParentOrder<T>> parents;
+  vector<size_t> freeParents; // released slots
+  unordered_map<OrderId, size_t> parentIndex; // working parent identifier -> slot
+  unordered_map<OrderId, ChildOrderRef> childOrders; // child order identifier -> parent
+  unordered_map<ProductId, size_t> bookIndex; // product identifier -> book snapshot
+  vector<BookSnapshot> books;
+  TimerService* timerService; // shared timer wheel scheduling the slices
+  Strand strand; // strand of the market data, fills and slices
+  long parentCounts[4] = {}; // finished parents by final state
+  long submittedCount = 0; // parents submitted so far
+  long childCount = 0;
+
+  // update the book snapshot of a product, returns its index
+  size_t UpdateBook(const ProductId& productId, const BidOffer& bidOffer, OrderBook<T>& orderBook);
+
+  // size the next child of a parent, 0 if nothing is due
+  long SliceQuantity(const ParentOrder<T>& parent, int64_t now) const;
+
+  // send the next child of a parent and schedule the following one
+  void Slice(size_t slot);
+
+  // release the slot of a parent in a final state
+  void FinishParent(size_t slot, ParentState state);
+
 public:
     // ctor
-    AlgoExecutionService();
+    AlgoExecutionService(TimerService* _timerService, const Strand& _strand);
     // dtor
     ~AlgoExecutionService() = default;
     
@@ -265,11 +360,39 @@ public:
 
     // Execute an algo order on a market, called by AlgoExecutionServiceListener to subscribe data from Algo Market Data Service to Algo Execution Service
     void AlgoExecuteOrder(OrderBook<T>& _orderBook);
+
+    // Work the orders of the market data signal as parent orders, rotating through the given strategies
+    // (an empty list sends them as single market orders)
+    void SetSliceParameters(const vector<SliceParameters>& _sliceParameters);
+
+    // Submit a parent order to the slicing engine, returns its identifier
+    OrderId SubmitParentOrder(const T& product, PricingSide side, long quantity, const SliceParameters& parameters);
+
+    // Cancel a working parent order, its children in flight are not recalled
+    bool CancelParentOrder(const OrderId& parentOrderId);
+
+    // Get the filled quantity of a working parent order, -1 if it is not working
+    long GetParentFilledQuantity(const OrderId& parentOrderId) const;
+
+    // Book the fill of a child order
+    void OnChildFill(const OrderId& orderId, long quantity);
+
+    // Release the quantity of a rejected child order back to its parent
+    void OnChildReject(const OrderId& orderId);
+
+    // Get the number of parent orders in a state, of parent orders submitted and of child orders sent
+    long GetParentCount(ParentState state) const;
+    long GetSubmittedCount() const;
+    long GetChildCount() const;
+
+    // Get the number of parent orders being worked
+    size_t GetWorkingParentCount() const;
     
 };
 
 template<typename T>
-AlgoExecutionService<T>::AlgoExecutionService()
+AlgoExecutionService<T>::AlgoExecutionService(TimerService* _timerService, const Strand& _strand)
+: timerService(_timerService), strand(_strand)
 {
   count = 0;
   algoexecservicelistener = new AlgoExecutionServiceListener<T>(this); // listener related to this server
@@ -278,7 +401,7 @@ AlgoExecutionService<T>::AlgoExecutionService()
 template<typename T>
 AlgoExecution<T>& AlgoExecutionService<T>::GetData(string key)
 {
-  return algoExecutionMap[key];
+  return algoExecutionMap[ProductId(key)];
 }
 
 /**
@@ -319,12 +442,27 @@ void AlgoExecutionService<T>::AlgoExecuteOrder(OrderBook<T>& _orderBook)
 {
   // get the order book data
   T product = _orderBook.GetProduct();
-  string key = product.GetProductId();
-  string orderId = "Algo" + GenerateRandomId(11);
-  string parentOrderId = "AlgoParent" + GenerateRandomId(5);
+  const ProductId& key = product.GetProductId();
 
   // get the best bid and offer order and their corresponding price and quantity
   BidOffer bidOffer = _orderBook.GetBestBidOffer();
+
+  // refresh the book used to size the child orders
+  UpdateBook(product.GetProductId(), bidOffer, _orderBook);
+
+  // with slicing, the signal below starts a parent order worked by the slicing engine
+  if (!sliceParameters.empty()) {
+    if (bidOffer.GetOfferOrder().GetPrice() - bidOffer.GetBidOrder().GetPrice() <= 1.0/128.0) {
+      PricingSide parentSide = (count % 2 == 0) ? BID : OFFER;
+      long parentQuantity = (count % 2 == 0) ? bidOffer.GetBidOrder().GetQuantity() : bidOffer.GetOfferOrder().GetQuantity();
+      SubmitParentOrder(product, parentSide, parentQuantity, sliceParameters[count % sliceParameters.size()]);
+      count++;
+    }
+    return;
+  }
+
+  IdText orderId = GenerateId("Algo");
+  IdText parentOrderId = GenerateId("AlgoParent");
   Order bid = bidOffer.GetBidOrder();
   Order offer = bidOffer.GetOfferOrder();
   double bidPrice = bid.GetPrice();
@@ -358,7 +496,7 @@ void AlgoExecutionService<T>::AlgoExecuteOrder(OrderBook<T>& _orderBook)
   long hiddenQuantity = 0;
   bool isChildOrder = false;
   OrderType orderType = MARKET; // market order
-  ExecutionOrder<T> executionOrder(product, side, orderId, orderType, price, visibleQuantity, hiddenQuantity, parentOrderId, isChildOrder);
+  ExecutionOrder<T> executionOrder(product, side, orderId.View(), orderType, price, visibleQuantity, hiddenQuantity, parentOrderId.View(), isChildOrder);
 
   // Create the algo execution
   Market market = BROKERTEC;
@@ -366,7 +504,7 @@ void AlgoExecutionService<T>::AlgoExecuteOrder(OrderBook<T>& _orderBook)
 
   // update the algo execution map
   if (algoExecutionMap.find(key) != algoExecutionMap.end()) {algoExecutionMap.erase(key);}
-  algoExecutionMap.insert(pair<string, AlgoExecution<T>> (key, algoExecution));
+  algoExecutionMap.insert(pair<ProductId, AlgoExecution<T>> (key, algoExecution));
 
   // flow the data to listeners
   for (auto& l : listeners) {
@@ -375,6 +513,249 @@ void AlgoExecutionService<T>::AlgoExecuteOrder(OrderBook<T>& _orderBook)
 }
 
 
+template<typename T>
+size_t AlgoExecutionService<T>::UpdateBook(const ProductId& productId, const BidOffer& bidOffer, OrderBook<T>& orderBook)
+{
+  auto it = bookIndex.find(productId);
+  if (it == bookIndex.end()) {
+    it = bookIndex.insert(pair<ProductId, size_t>(productId, books.size())).first;
+    books.push_back(BookSnapshot());
+  }
+  BookSnapshot& book = books[it->second];
+  book.bidPrice = bidOffer.GetBidOrder().GetPrice();
+  book.offerPrice = bidOffer.GetOfferOrder().GetPrice();
+  book.bidQuantity = bidOffer.GetBidOrder().GetQuantity();
+  book.offerQuantity = bidOffer.GetOfferOrder().GetQuantity();
+  book.bidDepth = 0;
+  for (auto& order : orderBook.GetBidStack()) book.bidDepth += order.GetQuantity();
+  book.offerDepth = 0;
+  for (auto& order : orderBook.GetOfferStack()) book.offerDepth += order.GetQuantity();
+  return it->second;
+}
+
+template<typename T>
+void AlgoExecutionService<T>::SetSliceParameters(const vector<SliceParameters>& _sliceParameters)
+{
+  sliceParameters = _sliceParameters;
+}
+
+template<typename T>
+OrderId AlgoExecutionService<T>::SubmitParentOrder(const T& product, PricingSide side, long quantity, const SliceParameters& parameters)
+{
+  const ProductId& productId = product.GetProductId();
+  auto book = bookIndex.find(productId);
+  if (book == bookIndex.end()) {
+    throw std::invalid_argument("No market data to slice a parent order of " + productId);
+  }
+  if (quantity <= 0 || parameters.intervalMs <= 0) {
+    throw std::invalid_argument("Invalid parent order of " + productId);
+  }
+
+  size_t slot;
+  if (freeParents.empty()) {
+    slot = parents.size();
+    parents.push_back(ParentOrder<T>{product, OrderId(), 0, side, 0, 0, 0, parameters, 0, 0, COMPLETED, INVALID_TIMER, 0});
+  }
+  else {
+    slot = freeParents.back();
+    freeParents.pop_back();
+  }
+  int64_t now = TimerService::NowMs();
+  ParentOrder<T>& parent = parents[slot];
+  parent.product = product;
+  parent.parentOrderId.assign(GenerateId("AlgoParent").View());
+  parent.productIndex = book->second;
+  parent.side = side;
+  parent.quantity = quantity;
+  parent.sent = 0;
+  parent.filled = 0;
+  parent.parameters = parameters;
+  parent.startMs = now;
+  parent.endMs = now + parameters.durationMs;
+  parent.state = WORKING;
+  parent.timer = INVALID_TIMER;
+  parentIndex[parent.parentOrderId] = slot;
+  submittedCount++;
+
+  // the first slice goes out right away
+  OrderId parentOrderId = parent.parentOrderId;
+  Slice(slot);
+  return parentOrderId;
+}
+
+template<typename T>
+long AlgoExecutionService<T>::SliceQuantity(const ParentOrder<T>& parent, int64_t now) const
+{
+  long leaves = parent.quantity - parent.sent;
+  if (leaves <= 0) return 0;
+  const BookSnapshot& book = books[parent.productIndex];
+  const SliceParameters& parameters = parent.parameters;
+  bool last = now + parameters.intervalMs > parent.endMs;
+
+  long quantity = 0;
+  switch (parameters.strategy)
+  {
+    case TWAP:
+    {
+      // keep up with a linear schedule ending at the last slice
+      if (last) return leaves;
+      double elapsed = static_cast<double>(now - parent.startMs + parameters.intervalMs) / max<long>(parameters.durationMs, 1);
+      long due = static_cast<long>(parent.quantity * min(elapsed, 1.0)) - parent.sent;
+      quantity = min(due, parent.side == BID ? book.offerQuantity : book.bidQuantity);
+      break;
+    }
+    case VWAP:
+      if (last) return leaves;
+      quantity = static_cast<long>(parameters.participation * (parent.side == BID ? book.offerDepth : book.bidDepth));
+      break;
+    case ICEBERG:
+      // one clip at a time
+      if (parent.sent > parent.filled) return 0;
+      quantity = parameters.displayQuantity;
+      break;
+  }
+  // round down to lots, an odd remainder goes out whole
+  quantity = min(quantity - quantity % SLICE_LOT_SIZE, leaves);
+  if (quantity <= 0 && leaves < SLICE_LOT_SIZE) quantity = leaves;
+  return max<long>(quantity, 0);
+}
+
+/**
+ * Slice() runs on the timer of a parent: it sends the child that is due, then schedules the next slice.
+ * Fills and rejects of the child may come back before the child is returned from the listeners,
+ * they only update the quantities, the parent is released here or on its next timer.
+ */
+template<typename T>
+void AlgoExecutionService<T>::Slice(size_t slot)
+{
+  int64_t now = TimerService::NowMs();
+  parents[slot].timer = INVALID_TIMER;
+  if (parents[slot].filled >= parents[slot].quantity) {
+    FinishParent(slot, COMPLETED);
+    return;
+  }
+  // the parent had its last interval to get the last child filled
+  if (now >= parents[slot].endMs + parents[slot].parameters.intervalMs) {
+    FinishParent(slot, EXPIRED);
+    return;
+  }
+
+  long quantity = SliceQuantity(parents[slot], now);
+  if (quantity > 0) {
+    ParentOrder<T>& parent = parents[slot];
+    const BookSnapshot& book = books[parent.productIndex];
+    OrderId orderId(GenerateId("Algo").View());
+    OrderType orderType = MARKET;
+    // TWAP and VWAP children cross the spread, iceberg clips rest on the own side of the book
+    double price = (parent.side == BID) ? book.offerPrice : book.bidPrice;
+    if (parent.parameters.strategy == ICEBERG) {
+      orderType = LIMIT;
+      price = (parent.side == BID) ? book.bidPrice : book.offerPrice;
+    }
+    ExecutionOrder<T> executionOrder(parent.product, parent.side, orderId, orderType, price, quantity, 0, parent.parentOrderId, true);
+    AlgoExecution<T> algoExecution(executionOrder, BROKERTEC);
+    childOrders[orderId] = ChildOrderRef{slot, parent.generation, quantity};
+    parent.sent += quantity;
+    childCount++;
+
+    const ProductId& key = parent.product.GetProductId();
+    if (algoExecutionMap.find(key) != algoExecutionMap.end()) {algoExecutionMap.erase(key);}
+    algoExecutionMap.insert(pair<ProductId, AlgoExecution<T>> (key, algoExecution));
+    for (auto& l : listeners) {
+      l -> ProcessAdd(algoExecution);
+    }
+  }
+
+  ParentOrder<T>& parent = parents[slot];
+  if (parent.filled >= parent.quantity) {
+    FinishParent(slot, COMPLETED);
+    return;
+  }
+  uint32_t generation = parent.generation;
+  // the slice runs on the strand of the service, a parent released in the meantime is skipped
+  parent.timer = timerService->Schedule(parent.parameters.intervalMs, strand, [this, slot, generation]() {
+    if (parents[slot].generation == generation && parents[slot].state == WORKING) Slice(slot);
+  });
+}
+
+template<typename T>
+void AlgoExecutionService<T>::FinishParent(size_t slot, ParentState state)
+{
+  ParentOrder<T>& parent = parents[slot];
+  if (parent.timer != INVALID_TIMER) timerService->Cancel(parent.timer);
+  parent.timer = INVALID_TIMER;
+  parent.state = state;
+  parent.generation++;
+  parentIndex.erase(parent.parentOrderId);
+  parentCounts[state]++;
+  freeParents.push_back(slot);
+}
+
+template<typename T>
+bool AlgoExecutionService<T>::CancelParentOrder(const OrderId& parentOrderId)
+{
+  auto it = parentIndex.find(parentOrderId);
+  if (it == parentIndex.end()) return false;
+  FinishParent(it->second, CANCELLED);
+  return true;
+}
+
+template<typename T>
+long AlgoExecutionService<T>::GetParentFilledQuantity(const OrderId& parentOrderId) const
+{
+  auto it = parentIndex.find(parentOrderId);
+  return it == parentIndex.end() ? -1 : parents[it->second].filled;
+}
+
+template<typename T>
+void AlgoExecutionService<T>::OnChildFill(const OrderId& orderId, long quantity)
+{
+  auto it = childOrders.find(orderId);
+  if (it == childOrders.end()) return;
+  ParentOrder<T>& parent = parents[it->second.slot];
+  if (parent.generation == it->second.generation && parent.state == WORKING) {
+    parent.filled += quantity;
+  }
+  childOrders.erase(it);
+}
+
+template<typename T>
+void AlgoExecutionService<T>::OnChildReject(const OrderId& orderId)
+{
+  auto it = childOrders.find(orderId);
+  if (it == childOrders.end()) return;
+  ParentOrder<T>& parent = parents[it->second.slot];
+  if (parent.generation == it->second.generation && parent.state == WORKING) {
+    parent.sent -= it->second.quantity;
+  }
+  childOrders.erase(it);
+}
+
+template<typename T>
+long AlgoExecutionService<T>::GetParentCount(ParentState state) const
+{
+  if (state == WORKING) return static_cast<long>(parentIndex.size());
+  return parentCounts[state];
+}
+
+template<typename T>
+long AlgoExecutionService<T>::GetSubmittedCount() const
+{
+  return submittedCount;
+}
+
+template<typename T>
+long AlgoExecutionService<T>::GetChildCount() const
+{
+  return childCount;
+}
+
+template<typename T>
+size_t AlgoExecutionService<T>::GetWorkingParentCount() const
+{
+  return parentIndex.size();
+}
+
 /**
 * Algo Execution Service Listener subscribing data from Market Data Service to Algo Execution Service.
 * Type T is the product type.
@@ -428,5 +809,100 @@ void AlgoExecutionServiceListener<T>::ProcessUpdate(OrderBook<T> &data)
 {
 }
 
+/**
+ * Algo Fill Listener subscribing trades from Trade Booking Service to the slicing engine of Algo Execution Service.
+ * Child orders are booked with their order identifier as trade identifier, other trades are ignored.
+ * Type T is the product type.
+ */
+template<typename T>
+class AlgoFillListener : public ServiceListener<Trade<T>>
+{
+private:
+  AlgoExecutionService<T>* service;
+
+public:
+  // ctor
+  AlgoFillListener(AlgoExecutionService<T>* _service);
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(Trade<T> &data) override;
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(Trade<T> &data) override;
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(Trade<T> &data) override;
+
+};
+
+template<typename T>
+AlgoFillListener<T>::AlgoFillListener(AlgoExecutionService<T>* _service)
+{
+  service = _service;
+}
+
+template<typename T>
+void AlgoFillListener<T>::ProcessAdd(Trade<T> &data)
+{
+  service->OnChildFill(data.GetTradeId(), data.GetQuantity());
+}
+
+template<typename T>
+void AlgoFillListener<T>::ProcessRemove(Trade<T> &data)
+{
+}
+
+template<typename T>
+void AlgoFillListener<T>::ProcessUpdate(Trade<T> &data)
+{
+}
+
+/**
+ * Algo Reject Listener subscribing pre-trade rejects to the slicing engine of Algo Execution Service,
+ * the quantity of a rejected child goes back to its parent.
+ * Type T is the product type.
+ */
+template<typename T>
+class AlgoRejectListener : public ServiceListener<OrderReject<T>>
+{
+private:
+  AlgoExecutionService<T>* service;
+
+public:
+  // ctor
+  AlgoRejectListener(AlgoExecutionService<T>* _service);
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(OrderReject<T> &data) override;
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(OrderReject<T> &data) override;
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(OrderReject<T> &data) override;
+
+};
+
+template<typename T>
+AlgoRejectListener<T>::AlgoRejectListener(AlgoExecutionService<T>* _service)
+{
+  service = _service;
+}
+
+template<typename T>
+void AlgoRejectListener<T>::ProcessAdd(OrderReject<T> &data)
+{
+  service->OnChildReject(data.GetOrder().GetOrderId());
+}
+
+template<typename T>
+void AlgoRejectListener<T>::ProcessRemove(OrderReject<T> &data)
+{
+}
+
+template<typename T>
+void AlgoRejectListener<T>::ProcessUpdate(OrderReject<T> &data)
+{
+}
 
-#endif
\ No newline at end of file
+#endif
@@ -9,9 +9,12 @@
 #define ALGOSTREAMING_SERVICE_HPP
 
 #include "soa.hpp"
+#include "arena.hpp"
 #include "utils.hpp"
 #include "pricingservice.hpp"
 #include "marketdataservice.hpp" // for PricingSide definition
+#include "timerwheel.hpp"
+#include "recordformat.hpp"
 
 /**
  * A price stream order with price and quantity (visible and hidden)
@@ -76,31 +79,15 @@ PricingSide PriceStreamOrder::GetSide() const
   return side;
 }
 
+// format the fields of a price stream order: price, visible and hidden quantities, side
+void formatRecord(TextWriter& writer, const PriceStreamOrder& order)
+{
+  writeFields(writer, PriceField{order.GetPrice()}, order.GetVisibleQuantity(), order.GetHiddenQuantity(), order.GetSide() == BID ? "BID" : "OFFER");
+}
+
 ostream& operator<<(ostream& os, const PriceStreamOrder& order)
 {
-	string _price = convertPrice(order.GetPrice());
-	string _visibleQuantity = to_string(order.GetVisibleQuantity());
-	string _hiddenQuantity = to_string(order.GetHiddenQuantity());
-  PricingSide side = order.GetSide();
-	string _side;
-	switch (side)
-	{
-	case BID:
-		_side = "BID";
-		break;
-	case OFFER:
-		_side = "OFFER";
-		break;
-	}
-
-	vector<string> _strings;
-	_strings.push_back(_price);
-	_strings.push_back(_visibleQuantity);
-	_strings.push_back(_hiddenQuantity);
-	_strings.push_back(_side);
-  string _str = join(_strings, ",");
-  os << _str;
-  return os;
+  return writeRecord(os, order);
 }
 
 /**
@@ -161,15 +148,21 @@ const PriceStreamOrder& PriceStream<T>::GetOfferOrder() const
   return offerOrder;
 }
 
+// format the fields of a price stream: product, bid order, offer order
+template<typename T>
+void formatRecord(TextWriter& writer, const PriceStream<T>& priceStream)
+{
+  writeFields(writer, priceStream.GetProduct().GetProductId());
+  writer.Append(',');
+  formatRecord(writer, priceStream.GetBidOrder());
+  writer.Append(',');
+  formatRecord(writer, priceStream.GetOfferOrder());
+}
+
 template<typename T>
 ostream& operator<<(ostream& os, const PriceStream<T>& priceStream)
 {
-  T product = priceStream.GetProduct();
-  string productId = product.GetProductId();
-  PriceStreamOrder bidOrder = priceStream.GetBidOrder();
-  PriceStreamOrder offerOrder = priceStream.GetOfferOrder();
-  os << productId << "," << bidOrder << "," << offerOrder;
-  return os;
+  return writeRecord(os, priceStream);
 }
 
 /**
@@ -218,14 +211,24 @@ template<typename T>
 class AlgoStreamingService : public Service<string,AlgoStream <T> >
 {
 private:
-  map<string, AlgoStream<T>> algoStreamMap; // store algo stream data keyed by product identifier
+  PooledMap<ProductId, AlgoStream<T>> algoStreamMap; // store algo stream data keyed by product identifier
   vector<ServiceListener<AlgoStream<T>>*> listeners; // list of listeners to this service
   AlgoStreamingServiceListener<T>* algostreamlistener;
   long count;
 
+  // stale quote expiry: a quote without a new price for quoteTtlMs is pulled
+  TimerService* timerService; // shared timer wheel
+  Strand strand; // strand of the price feed
+  long quoteTtlMs;
+  map<ProductId, int64_t> quoteUpdates; // time of the last quote of each product
+  map<ProductId, bool> expiryPending; // whether the expiry timer of a product is scheduled
+
+  // check the age of a quote on its expiry timer and pull it if it is stale
+  void ExpireQuote(const ProductId& key);
+
 public:
     // ctor and dtor
-    AlgoStreamingService();
+    AlgoStreamingService(TimerService* _timerService, const Strand& _strand, long _quoteTtlMs = 1000);
     ~AlgoStreamingService()=default;
     
     // Get data on our service given a key
@@ -249,7 +252,8 @@ public:
 };
 
 template<typename T>
-AlgoStreamingService<T>::AlgoStreamingService()
+AlgoStreamingService<T>::AlgoStreamingService(TimerService* _timerService, const Strand& _strand, long _quoteTtlMs)
+: timerService(_timerService), strand(_strand), quoteTtlMs(_quoteTtlMs)
 {
   algostreamlistener = new AlgoStreamingServiceListener<T>(this);
 }
@@ -257,7 +261,7 @@ AlgoStreamingService<T>::AlgoStreamingService()
 template<typename T>
 AlgoStream<T>& AlgoStreamingService<T>::GetData(string key)
 {
-  return algoStreamMap[key];
+  return algoStreamMap[ProductId(key)];
 }
 
 /**
@@ -295,7 +299,7 @@ template<typename T>
 void AlgoStreamingService<T>::PublishAlgoStream(const Price<T>& price)
 {
   T product = price.GetProduct();
-  string key = product.GetProductId();
+  const ProductId& key = product.GetProductId();
   double mid = price.GetMid();
   double spread = price.GetBidOfferSpread();
   double bidPrice = mid - spread/2;
@@ -317,13 +321,47 @@ void AlgoStreamingService<T>::PublishAlgoStream(const Price<T>& price)
 
   // update the algo stream map
   if (algoStreamMap.find(key) != algoStreamMap.end()) {algoStreamMap.erase(key);}
-  algoStreamMap.insert(pair<string, AlgoStream<T>> (key, algoStream));
+  algoStreamMap.insert(pair<ProductId, AlgoStream<T>> (key, algoStream));
 
   // notify the listeners
   for (auto& listener : listeners)
   {
     listener->ProcessAdd(algoStream);
   }
+
+  // one expiry timer per product, re-armed from the age of the quote when it fires
+  quoteUpdates[key] = TimerService::NowMs();
+  if (!expiryPending[key]) {
+    expiryPending[key] = true;
+    timerService->Schedule(quoteTtlMs, strand, [this, key]() { ExpireQuote(key); });
+  }
+}
+
+/**
+ * ExpireQuote() runs on the expiry timer of a product.
+ * A quote that was refreshed in the meantime gets a new timer for the rest of its life, a stale quote is
+ * pulled by publishing the same prices with no size.
+ */
+template<typename T>
+void AlgoStreamingService<T>::ExpireQuote(const ProductId& key)
+{
+  int64_t age = TimerService::NowMs() - quoteUpdates[key];
+  if (age < quoteTtlMs) {
+    timerService->Schedule(quoteTtlMs - age, strand, [this, key]() { ExpireQuote(key); });
+    return;
+  }
+  expiryPending[key] = false;
+
+  const PriceStream<T>& stale = algoStreamMap[key].GetPriceStream();
+  PriceStreamOrder bidOrder(stale.GetBidOrder().GetPrice(), 0, 0, BID);
+  PriceStreamOrder offerOrder(stale.GetOfferOrder().GetPrice(), 0, 0, OFFER);
+  AlgoStream<T> algoStream(PriceStream<T>(stale.GetProduct(), bidOrder, offerOrder));
+  algoStreamMap.erase(key);
+  algoStreamMap.insert(pair<ProductId, AlgoStream<T>> (key, algoStream));
+  for (auto& listener : listeners)
+  {
+    listener->ProcessAdd(algoStream);
+  }
 }
 
 /**
@@ -0,0 +1,161 @@
+/**
+ * allocationcounter.hpp
+ * Defines the allocation-counting hook of the test and benchmark executables.
+ *
+ * Including this header replaces the global operator new and delete of the executable with versions that
+ * count the allocations of each thread before calling malloc and free, so a harness can check that a hot
+ * path does not allocate. Only executables that measure allocations include it, never the server.
+ *
+ * @author Boyu Yang
+ */
+#ifndef ALLOCATION_COUNTER_HPP
+#define ALLOCATION_COUNTER_HPP
+
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+/**
+ * Allocation counts of a thread or of the process.
+ */
+struct AllocationStats
+{
+  uint64_t allocations;
+  uint64_t deallocations;
+  uint64_t bytes;
+};
+
+// counts of the calling thread, plain thread locals so reading them never allocates
+thread_local uint64_t threadAllocationCount = 0;
+thread_local uint64_t threadDeallocationCount = 0;
+thread_local uint64_t threadAllocatedBytes = 0;
+
+// counts of the process
+atomic<uint64_t> processAllocationCount(0);
+atomic<uint64_t> processDeallocationCount(0);
+atomic<uint64_t> processAllocatedBytes(0);
+
+// Get the allocation counts of the calling thread
+AllocationStats threadAllocations()
+{
+  return AllocationStats{threadAllocationCount, threadDeallocationCount, threadAllocatedBytes};
+}
+
+// Get the allocation counts of the process
+AllocationStats processAllocations()
+{
+  return AllocationStats{processAllocationCount.load(memory_order_relaxed), processDeallocationCount.load(memory_order_relaxed), processAllocatedBytes.load(memory_order_relaxed)};
+}
+
+/**
+ * Allocation Scope: counts the allocations of the calling thread since the scope was opened.
+ */
+class AllocationScope
+{
+private:
+  AllocationStats start;
+
+public:
+  // ctor
+  AllocationScope() : start(threadAllocations()) {}
+
+  // Get the counts since the scope was opened
+  AllocationStats GetStats() const
+  {
+    AllocationStats now = threadAllocations();
+    return AllocationStats{now.allocations - start.allocations, now.deallocations - start.deallocations, now.bytes - start.bytes};
+  }
+
+  // Get the number of allocations since the scope was opened
+  uint64_t GetAllocations() const { return threadAllocationCount - start.allocations; }
+};
+
+// count an allocation and get the memory from malloc
+inline void* countedAllocate(size_t size, size_t alignment = 0)
+{
+  threadAllocationCount++;
+  threadAllocatedBytes += size;
+  processAllocationCount.fetch_add(1, memory_order_relaxed);
+  processAllocatedBytes.fetch_add(size, memory_order_relaxed);
+  if (size == 0) size = 1;
+  void* p = nullptr;
+  if (alignment > alignof(max_align_t)) {
+    if (posix_memalign(&p, alignment, size) != 0) p = nullptr;
+  }
+  else {
+    p = malloc(size);
+  }
+  return p;
+}
+
+// count a deallocation and give the memory back to free
+inline void countedDeallocate(void* p)
+{
+  if (!p) return;
+  threadDeallocationCount++;
+  processDeallocationCount.fetch_add(1, memory_order_relaxed);
+  // the replaced operator new allocates with malloc, GCC only sees a new paired with free once inlined
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+  free(p);
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+}
+
+void* operator new(size_t size)
+{
+  void* p = countedAllocate(size);
+  if (!p) throw bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size)
+{
+  void* p = countedAllocate(size);
+  if (!p) throw bad_alloc();
+  return p;
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+  void* p = countedAllocate(size, static_cast<size_t>(alignment));
+  if (!p) throw bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+  void* p = countedAllocate(size, static_cast<size_t>(alignment));
+  if (!p) throw bad_alloc();
+  return p;
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+  return countedAllocate(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+  return countedAllocate(size);
+}
+
+void operator delete(void* p) noexcept { countedDeallocate(p); }
+void operator delete[](void* p) noexcept { countedDeallocate(p); }
+void operator delete(void* p, size_t) noexcept { countedDeallocate(p); }
+void operator delete[](void* p, size_t) noexcept { countedDeallocate(p); }
+void operator delete(void* p, align_val_t) noexcept { countedDeallocate(p); }
+void operator delete[](void* p, align_val_t) noexcept { countedDeallocate(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { countedDeallocate(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { countedDeallocate(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { countedDeallocate(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { countedDeallocate(p); }
+
+#endif
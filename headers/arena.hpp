@@ -0,0 +1,343 @@
+/**
+ * arena.hpp
+ * Defines the arena and the node pools that keep the hot path free of heap allocations.
+ *
+ * The arena is a per-thread bump allocator for message-scoped data: a connector opens an ArenaScope for a
+ * batch of lines, its token vectors and other scratch data are carved from the arena, and the scope rewinds
+ * the arena when the batch is done. Scopes nest, so a handler run inline by another one can use the same
+ * arena. The chunks of the arena are kept across batches, so in steady state nothing is allocated.
+ *
+ * The node pool keeps the freed nodes of a node-based container on a free list and carves new nodes from
+ * chunks, so erasing and inserting an entry of a service store reuses the node instead of calling malloc.
+ * A PooledMap owns its pool through its allocator, and like every service store it is only touched on the
+ * strand of its service.
+ *
+ * @author Boyu Yang
+ */
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+using namespace std;
+
+// Size of a chunk of an arena
+const size_t ARENA_CHUNK_SIZE = 64 * 1024;
+
+// Nodes carved from each chunk of a node pool
+const size_t NODE_POOL_CHUNK_NODES = 64;
+
+/**
+ * Arena: bump allocator over a list of chunks.
+ * Memory is released by rewinding to a mark or resetting, never one allocation at a time.
+ */
+class Arena
+{
+public:
+  // position of the arena, to rewind to
+  struct Mark
+  {
+    size_t chunk;
+    size_t offset;
+  };
+
+private:
+  struct Chunk
+  {
+    char* data;
+    size_t size;
+  };
+
+  vector<Chunk> chunks; // chunks in allocation order, kept when the arena is rewound
+  size_t chunkSize; // size of a regular chunk
+  size_t current; // chunk being carved
+  size_t offset; // bytes used in the current chunk
+
+public:
+  // ctor
+  Arena(size_t _chunkSize = ARENA_CHUNK_SIZE);
+  // dtor: free the chunks
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Allocate memory, valid until the arena is rewound past it
+  void* Allocate(size_t size, size_t alignment = alignof(max_align_t));
+
+  // Get the current position
+  Mark GetMark() const;
+
+  // Release everything allocated after a mark
+  void Rewind(const Mark& mark);
+
+  // Release everything
+  void Reset();
+
+  // Get the total size of the chunks
+  size_t GetCapacity() const;
+
+};
+
+Arena::Arena(size_t _chunkSize)
+: chunkSize(_chunkSize), current(0), offset(0)
+{
+}
+
+Arena::~Arena()
+{
+  for (auto& chunk : chunks) {
+    ::operator delete(chunk.data);
+  }
+}
+
+void* Arena::Allocate(size_t size, size_t alignment)
+{
+  while (true) {
+    if (current < chunks.size()) {
+      Chunk& chunk = chunks[current];
+      uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data);
+      size_t start = ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+      if (start + size <= chunk.size) {
+        offset = start + size;
+        return chunk.data + start;
+      }
+      // the rest of the chunk is left unused, the next chunk is tried
+      if (current + 1 < chunks.size()) {
+        current++;
+        offset = 0;
+        continue;
+      }
+    }
+    // out of chunks: a new chunk, larger than a regular one for a large allocation
+    size_t chunkBytes = max(size + alignment, chunkSize);
+    chunks.push_back(Chunk{static_cast<char*>(::operator new(chunkBytes)), chunkBytes});
+    current = chunks.size() - 1;
+    offset = 0;
+  }
+}
+
+Arena::Mark Arena::GetMark() const
+{
+  return Mark{current, offset};
+}
+
+void Arena::Rewind(const Mark& mark)
+{
+  current = mark.chunk;
+  offset = mark.offset;
+}
+
+void Arena::Reset()
+{
+  current = 0;
+  offset = 0;
+}
+
+size_t Arena::GetCapacity() const
+{
+  size_t capacity = 0;
+  for (auto& chunk : chunks) capacity += chunk.size;
+  return capacity;
+}
+
+// Get the arena of the calling thread
+Arena& threadArena()
+{
+  thread_local Arena arena;
+  return arena;
+}
+
+/**
+ * Arena Scope: rewinds an arena to where it was when the scope was opened.
+ */
+class ArenaScope
+{
+private:
+  Arena& arena;
+  Arena::Mark mark;
+
+public:
+  // ctor: remember the position of the arena
+  ArenaScope(Arena& _arena) : arena(_arena), mark(_arena.GetMark()) {}
+  // dtor: release what the scope allocated
+  ~ArenaScope() { arena.Rewind(mark); }
+
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
+};
+
+/**
+ * Allocator of standard containers drawing from an arena, deallocation is a no-op.
+ * Type T is the value type.
+ */
+template<typename T>
+class ArenaAllocator
+{
+public:
+  typedef T value_type;
+
+  Arena* arena;
+
+  // ctor
+  ArenaAllocator(Arena& _arena) : arena(&_arena) {}
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+  // Allocate n values
+  T* allocate(size_t n) { return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T))); }
+
+  // Deallocate n values, the memory returns to the arena when it is rewound
+  void deallocate(T*, size_t) {}
+
+  template<typename U>
+  bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+  template<typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+// Vector in an arena
+template<typename T>
+using ArenaVector = vector<T, ArenaAllocator<T>>;
+
+/**
+ * Node Pool: free list of equally sized nodes carved from chunks.
+ * The node size is fixed by the first allocation, other sizes go to the heap.
+ * Not thread-safe: a pool belongs to one container.
+ */
+class NodePool
+{
+private:
+  struct FreeNode
+  {
+    FreeNode* next;
+  };
+
+  size_t nodeSize; // size of a node, 0 before the first allocation
+  size_t chunkNodes; // nodes per chunk
+  FreeNode* freeList; // nodes available for reuse
+  vector<void*> chunks; // chunks carved so far
+
+public:
+  // ctor
+  NodePool(size_t _chunkNodes = NODE_POOL_CHUNK_NODES);
+  // dtor: free the chunks
+  ~NodePool();
+
+  NodePool(const NodePool&) = delete;
+  NodePool& operator=(const NodePool&) = delete;
+
+  // Allocate a node
+  void* Allocate(size_t size);
+
+  // Return a node to the pool
+  void Deallocate(void* node, size_t size);
+
+  // Get the number of chunks carved so far
+  size_t GetChunkCount() const;
+
+};
+
+NodePool::NodePool(size_t _chunkNodes)
+: nodeSize(0), chunkNodes(_chunkNodes), freeList(nullptr)
+{
+}
+
+NodePool::~NodePool()
+{
+  for (void* chunk : chunks) {
+    ::operator delete(chunk);
+  }
+}
+
+void* NodePool::Allocate(size_t size)
+{
+  if (nodeSize == 0) {
+    // nodes are aligned for any type, and large enough to hold the free list link
+    size_t alignment = alignof(max_align_t);
+    nodeSize = (max(size, sizeof(FreeNode)) + alignment - 1) & ~(alignment - 1);
+  }
+  if (size > nodeSize) return ::operator new(size);
+  if (!freeList) {
+    char* chunk = static_cast<char*>(::operator new(nodeSize * chunkNodes));
+    chunks.push_back(chunk);
+    for (size_t i = chunkNodes; i > 0; --i) {
+      FreeNode* node = reinterpret_cast<FreeNode*>(chunk + (i - 1) * nodeSize);
+      node->next = freeList;
+      freeList = node;
+    }
+  }
+  FreeNode* node = freeList;
+  freeList = node->next;
+  return node;
+}
+
+void NodePool::Deallocate(void* node, size_t size)
+{
+  if (size > nodeSize) {
+    ::operator delete(node);
+    return;
+  }
+  FreeNode* freeNode = static_cast<FreeNode*>(node);
+  freeNode->next = freeList;
+  freeList = freeNode;
+}
+
+size_t NodePool::GetChunkCount() const
+{
+  return chunks.size();
+}
+
+/**
+ * Allocator of node-based containers drawing single nodes from a node pool.
+ * A default-constructed allocator creates its own pool, shared by its copies and rebinds, so a container
+ * and its nodes share one pool. Arrays (e.g. the buckets of a hash table) go to the heap.
+ * Type T is the value type.
+ */
+template<typename T>
+class PoolAllocator
+{
+public:
+  typedef T value_type;
+  typedef true_type propagate_on_container_move_assignment;
+  typedef true_type propagate_on_container_swap;
+
+  shared_ptr<NodePool> pool;
+
+  // ctor
+  PoolAllocator() : pool(make_shared<NodePool>()) {}
+  template<typename U>
+  PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {}
+
+  // Allocate n values, a single value comes from the pool
+  T* allocate(size_t n)
+  {
+    if (n == 1) return static_cast<T*>(pool->Allocate(sizeof(T)));
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  // Deallocate n values
+  void deallocate(T* p, size_t n)
+  {
+    if (n == 1) pool->Deallocate(p, sizeof(T));
+    else ::operator delete(p);
+  }
+
+  template<typename U>
+  bool operator==(const PoolAllocator<U>& other) const { return pool == other.pool; }
+  template<typename U>
+  bool operator!=(const PoolAllocator<U>& other) const { return pool != other.pool; }
+};
+
+// Ordered map whose nodes come from a pool
+template<typename K, typename V, typename Compare = less<K>>
+using PooledMap = map<K, V, Compare, PoolAllocator<pair<const K, V>>>;
+
+#endif
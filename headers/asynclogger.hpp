@@ -0,0 +1,411 @@
+/**
+ * asynclogger.hpp
+ * Defines the asynchronous binary logger used on the hot paths of the services.
+ *
+ * A log statement registers its format once per call site and then only copies the format id, a
+ * timestamp and the raw arguments into a ring buffer owned by the calling thread: no formatting, no
+ * allocation, no lock and no system call. A background thread drains the rings, formats the records
+ * with the "{}" placeholders of their format and writes them in batches to the standard output, in
+ * the same layout as log(). A record that does not fit into a full ring is dropped and counted.
+ * Statements below LOG_THRESHOLD compile out, e.g. -DLOG_THRESHOLD=2 keeps only warnings and errors.
+ *
+ * @author Boyu Yang
+ */
+#ifndef ASYNC_LOGGER_HPP
+#define ASYNC_LOGGER_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+#include "utils.hpp"
+
+using namespace std;
+
+// Lowest level compiled in, levels are ordered INFO < NOTE < WARNING < ERROR
+#ifndef LOG_THRESHOLD
+#define LOG_THRESHOLD 0
+#endif
+
+// Size of the ring of a thread in bytes, a power of two
+const size_t LOG_RING_SIZE = 1 << 16;
+
+// Longest string argument kept in a record, longer strings are truncated
+const size_t LOG_MAX_STRING = 256;
+
+// Interval of the background thread when the rings are empty
+const int LOG_IDLE_MS = 1;
+
+// Type tag of an argument in a record
+enum LogArgType : uint8_t { LOG_INT, LOG_UINT, LOG_DOUBLE, LOG_STRING };
+
+// header of a record in a ring, followed by the tagged arguments
+struct LogRecordHeader
+{
+  uint32_t size; // bytes of the record including the header
+  uint32_t formatId; // registered format of the call site
+  int64_t timestamp; // nanoseconds since the epoch
+};
+
+/**
+ * Single-producer single-consumer byte ring of one thread.
+ * Positions grow monotonically, a record may wrap around the end of the buffer.
+ */
+class LogRing
+{
+private:
+  vector<char> buffer;
+  atomic<uint64_t> head; // read position, advanced by the background thread
+  atomic<uint64_t> tail; // write position, advanced by the owning thread
+  atomic<uint64_t> dropped; // records dropped because the ring was full
+
+  // copy bytes in or out at a position, across the end of the buffer
+  void CopyIn(uint64_t position, const void* data, size_t size);
+  void CopyOut(uint64_t position, void* data, size_t size) const;
+
+  friend class AsyncLogger;
+
+public:
+  // ctor
+  LogRing(size_t size);
+
+};
+
+LogRing::LogRing(size_t size)
+: buffer(size), head(0), tail(0), dropped(0)
+{
+}
+
+void LogRing::CopyIn(uint64_t position, const void* data, size_t size)
+{
+  size_t offset = position & (buffer.size() - 1);
+  size_t first = min(size, buffer.size() - offset);
+  memcpy(buffer.data() + offset, data, first);
+  memcpy(buffer.data(), static_cast<const char*>(data) + first, size - first);
+}
+
+void LogRing::CopyOut(uint64_t position, void* data, size_t size) const
+{
+  size_t offset = position & (buffer.size() - 1);
+  size_t first = min(size, buffer.size() - offset);
+  memcpy(data, buffer.data() + offset, first);
+  memcpy(static_cast<char*>(data) + first, buffer.data(), size - first);
+}
+
+// format of a call site
+struct LogFormat
+{
+  LogLevel level;
+  const char* format;
+};
+
+/**
+ * Asynchronous Logger: one ring per logging thread and one background thread writing the records.
+ */
+class AsyncLogger
+{
+private:
+  vector<LogFormat> formats; // registered formats, indexed by format id
+  vector<unique_ptr<LogRing>> rings; // rings of the threads that logged
+  mutex registryMutex; // guards the formats and the rings
+  atomic<bool> running;
+  thread writer; // background thread
+  string output; // formatted batch, reused
+  TimestampFormatter formatter; // timestamps of the records
+  uint64_t reportedDrops; // drops already reported
+
+  // ctor: start the background thread
+  AsyncLogger();
+
+  // get the ring of the calling thread, created on its first record
+  LogRing& GetRing();
+
+  // size of an encoded argument
+  template<typename A>
+  static size_t ArgSize(const A& arg);
+
+  // encode an argument at a position of a ring, returns the next position
+  template<typename A>
+  static uint64_t Encode(LogRing& ring, uint64_t position, const A& arg);
+
+  // format one record into the output
+  void Format(const LogRing& ring, uint64_t position, const LogRecordHeader& header);
+
+  // drain all rings, returns false if they were empty
+  bool Drain();
+
+  // loop of the background thread
+  void Run();
+
+public:
+  // dtor: write the remaining records and stop the background thread
+  ~AsyncLogger();
+
+  // Get the logger of the process
+  static AsyncLogger& Instance();
+
+  // Register the format of a call site, returns its format id
+  static uint32_t RegisterFormat(LogLevel level, const char* format);
+
+  // Write a record into the ring of the calling thread
+  template<typename... Args>
+  void Write(uint32_t formatId, const Args&... args);
+
+  // Write all pending records now
+  void Flush();
+
+  // Get the number of records dropped on full rings
+  uint64_t GetDroppedCount();
+
+};
+
+AsyncLogger::AsyncLogger()
+: running(true), reportedDrops(0)
+{
+  output.reserve(LOG_RING_SIZE);
+  writer = thread([this]() { Run(); });
+}
+
+AsyncLogger::~AsyncLogger()
+{
+  running = false;
+  writer.join();
+  Drain();
+}
+
+AsyncLogger& AsyncLogger::Instance()
+{
+  static AsyncLogger logger;
+  return logger;
+}
+
+uint32_t AsyncLogger::RegisterFormat(LogLevel level, const char* format)
+{
+  AsyncLogger& logger = Instance();
+  lock_guard<mutex> lock(logger.registryMutex);
+  logger.formats.push_back(LogFormat{level, format});
+  return logger.formats.size() - 1;
+}
+
+LogRing& AsyncLogger::GetRing()
+{
+  thread_local LogRing* ring = nullptr;
+  if (!ring) {
+    lock_guard<mutex> lock(registryMutex);
+    rings.push_back(make_unique<LogRing>(LOG_RING_SIZE));
+    ring = rings.back().get();
+  }
+  return *ring;
+}
+
+template<typename A>
+size_t AsyncLogger::ArgSize(const A& arg)
+{
+  if constexpr (is_arithmetic_v<A>) {
+    return 1 + 8;
+  }
+  else {
+    return 1 + 4 + min(string_view(arg).size(), LOG_MAX_STRING);
+  }
+}
+
+template<typename A>
+uint64_t AsyncLogger::Encode(LogRing& ring, uint64_t position, const A& arg)
+{
+  if constexpr (is_floating_point_v<A>) {
+    uint8_t type = LOG_DOUBLE;
+    double value = arg;
+    ring.CopyIn(position, &type, 1);
+    ring.CopyIn(position + 1, &value, 8);
+    return position + 9;
+  }
+  else if constexpr (is_integral_v<A> && is_signed_v<A>) {
+    uint8_t type = LOG_INT;
+    int64_t value = arg;
+    ring.CopyIn(position, &type, 1);
+    ring.CopyIn(position + 1, &value, 8);
+    return position + 9;
+  }
+  else if constexpr (is_integral_v<A>) {
+    uint8_t type = LOG_UINT;
+    uint64_t value = arg;
+    ring.CopyIn(position, &type, 1);
+    ring.CopyIn(position + 1, &value, 8);
+    return position + 9;
+  }
+  else {
+    string_view text(arg);
+    uint8_t type = LOG_STRING;
+    uint32_t length = min(text.size(), LOG_MAX_STRING);
+    ring.CopyIn(position, &type, 1);
+    ring.CopyIn(position + 1, &length, 4);
+    ring.CopyIn(position + 5, text.data(), length);
+    return position + 5 + length;
+  }
+}
+
+template<typename... Args>
+void AsyncLogger::Write(uint32_t formatId, const Args&... args)
+{
+  LogRing& ring = GetRing();
+  size_t size = sizeof(LogRecordHeader) + (0 + ... + ArgSize(args));
+  uint64_t tail = ring.tail.load(memory_order_relaxed);
+  if (size > ring.buffer.size() || tail + size - ring.head.load(memory_order_acquire) > ring.buffer.size()) {
+    ring.dropped.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+  LogRecordHeader header;
+  header.size = size;
+  header.formatId = formatId;
+  header.timestamp = tscClock.Now();
+  ring.CopyIn(tail, &header, sizeof(header));
+  uint64_t position = tail + sizeof(header);
+  ((position = Encode(ring, position, args)), ...);
+  // the record becomes visible to the background thread with this single store
+  ring.tail.store(tail + size, memory_order_release);
+}
+
+void AsyncLogger::Format(const LogRing& ring, uint64_t position, const LogRecordHeader& header)
+{
+  const LogFormat& format = formats[header.formatId];
+  // defaults for a level the switch does not know
+  const char* levelStr = "UNKNOWN";
+  const char* color = RESET;
+  switch (format.level) {
+    case LogLevel::INFO:
+      levelStr = "INFO";
+      color = GREEN;
+      break;
+    case LogLevel::NOTE:
+      levelStr = "NOTE";
+      color = CYAN;
+      break;
+    case LogLevel::WARNING:
+      levelStr = "WARNING";
+      color = YELLOW;
+      break;
+    case LogLevel::ERROR:
+      levelStr = "ERROR";
+      color = RED;
+      break;
+  }
+
+  char timestamp[TIMESTAMP_LENGTH];
+  output.append(color).append(timestamp, formatter.Format(header.timestamp, timestamp)).append(" [").append(levelStr).append("] ");
+
+  // replace each placeholder by the next argument
+  uint64_t end = position + header.size - sizeof(header);
+  for (const char* p = format.format; *p; ++p) {
+    if (p[0] != '{' || p[1] != '}' || position >= end) {
+      output.push_back(*p);
+      continue;
+    }
+    ++p;
+    uint8_t type;
+    ring.CopyOut(position, &type, 1);
+    char number[32];
+    if (type == LOG_STRING) {
+      uint32_t length;
+      ring.CopyOut(position + 1, &length, 4);
+      size_t offset = output.size();
+      output.resize(offset + length);
+      ring.CopyOut(position + 5, &output[offset], length);
+      position += 5 + length;
+      continue;
+    }
+    if (type == LOG_DOUBLE) {
+      double value;
+      ring.CopyOut(position + 1, &value, 8);
+      snprintf(number, sizeof(number), "%f", value);
+    }
+    else if (type == LOG_INT) {
+      int64_t value;
+      ring.CopyOut(position + 1, &value, 8);
+      snprintf(number, sizeof(number), "%lld", static_cast<long long>(value));
+    }
+    else {
+      uint64_t value;
+      ring.CopyOut(position + 1, &value, 8);
+      snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(value));
+    }
+    output.append(number);
+    position += 9;
+  }
+  output.append(RESET).append("\n");
+}
+
+bool AsyncLogger::Drain()
+{
+  lock_guard<mutex> lock(registryMutex);
+  bool found = false;
+  uint64_t drops = 0;
+  for (auto& ring : rings) {
+    uint64_t head = ring->head.load(memory_order_relaxed);
+    uint64_t tail = ring->tail.load(memory_order_acquire);
+    while (head < tail) {
+      LogRecordHeader header;
+      ring->CopyOut(head, &header, sizeof(header));
+      Format(*ring, head + sizeof(header), header);
+      head += header.size;
+    }
+    if (head != ring->head.load(memory_order_relaxed)) {
+      // release the space to the owning thread only once the batch is formatted
+      ring->head.store(head, memory_order_release);
+      found = true;
+    }
+    drops += ring->dropped.load(memory_order_relaxed);
+  }
+  if (drops > reportedDrops) {
+    output.append(YELLOW).append("[WARNING] ").append(to_string(drops - reportedDrops)).append(" log records dropped on full rings").append(RESET).append("\n");
+    reportedDrops = drops;
+  }
+  if (!output.empty()) {
+    fwrite(output.data(), 1, output.size(), stdout);
+    fflush(stdout);
+    output.clear();
+  }
+  return found;
+}
+
+void AsyncLogger::Run()
+{
+  while (running.load(memory_order_relaxed)) {
+    if (!Drain()) {
+      this_thread::sleep_for(chrono::milliseconds(LOG_IDLE_MS));
+    }
+  }
+}
+
+void AsyncLogger::Flush()
+{
+  Drain();
+}
+
+uint64_t AsyncLogger::GetDroppedCount()
+{
+  lock_guard<mutex> lock(registryMutex);
+  uint64_t drops = 0;
+  for (auto& ring : rings) {
+    drops += ring->dropped.load(memory_order_relaxed);
+  }
+  return drops;
+}
+
+// Log a format with "{}" placeholders and its arguments (numbers and strings) asynchronously
+// the format must be a string literal, it is registered once per call site
+#define LOG_ASYNC(level, format, ...) \
+  do { \
+    if constexpr (static_cast<int>(level) >= LOG_THRESHOLD) { \
+      static const uint32_t logFormatId = AsyncLogger::RegisterFormat(level, format); \
+      AsyncLogger::Instance().Write(logFormatId, ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#endif
@@ -0,0 +1,221 @@
+/**
+ * blockcodec.hpp
+ * Defines the encoding of the compressed blocks of the historical archive.
+ *
+ * A block is encoded column by column, then compressed as a whole with zlib:
+ *   timestamp, integer and enum columns: delta to the previous row, zigzag, varint
+ *   price and double columns: delta of 1/256 ticks, zigzag, varint (flag 1), or the raw values (flag 0)
+ *   when a value is not an exact tick
+ *   symbol columns: raw, the repeated CUSIPs are left to the compressor
+ *
+ * @author Boyu Yang
+ */
+#ifndef BLOCK_CODEC_HPP
+#define BLOCK_CODEC_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <stdexcept>
+#include <zlib.h>
+
+#include "historicalrecord.hpp"
+
+using namespace std;
+
+// Number of ticks per unit of a price, US Treasuries trade in 1/256ths
+const double TICKS_PER_UNIT = 256.0;
+
+// append an unsigned varint
+void putVarint(vector<char>& out, uint64_t value)
+{
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+// read an unsigned varint, advances the cursor
+uint64_t getVarint(const char*& in, const char* end)
+{
+  uint64_t value = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*in++);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return value;
+  }
+  throw std::invalid_argument("Truncated varint in block");
+}
+
+// map signed deltas to small unsigned values (0, -1, 1, -2, ... -> 0, 1, 2, 3, ...)
+uint64_t zigzag(int64_t value)
+{
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value)
+{
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// append a column of 8-byte integers as zigzag varint deltas
+void encodeIntegers(vector<char>& out, const int64_t* values, size_t count)
+{
+  int64_t previous = 0;
+  for (size_t i = 0; i < count; ++i) {
+    putVarint(out, zigzag(static_cast<int64_t>(static_cast<uint64_t>(values[i]) - static_cast<uint64_t>(previous))));
+    previous = values[i];
+  }
+}
+
+void decodeIntegers(const char*& in, const char* end, int64_t* values, size_t count)
+{
+  int64_t previous = 0;
+  for (size_t i = 0; i < count; ++i) {
+    previous = static_cast<int64_t>(static_cast<uint64_t>(previous) + static_cast<uint64_t>(unzigzag(getVarint(in, end))));
+    values[i] = previous;
+  }
+}
+
+// append a column of doubles, as tick deltas when every value is an exact tick
+void encodeDoubles(vector<char>& out, const double* values, size_t count, vector<int64_t>& ticks)
+{
+  ticks.resize(count);
+  bool exact = true;
+  for (size_t i = 0; i < count && exact; ++i) {
+    double scaled = values[i] * TICKS_PER_UNIT;
+    exact = std::fabs(scaled) < 9.0e15 && std::nearbyint(scaled) == scaled;
+    if (!exact) break;
+    ticks[i] = static_cast<int64_t>(scaled);
+    // the tick value must give back the very same bits (rules out -0.0)
+    double decoded = ticks[i] / TICKS_PER_UNIT;
+    exact = memcmp(&decoded, &values[i], sizeof(double)) == 0;
+  }
+  out.push_back(exact ? 1 : 0);
+  if (exact) {
+    encodeIntegers(out, ticks.data(), count);
+  }
+  else {
+    const char* raw = reinterpret_cast<const char*>(values);
+    out.insert(out.end(), raw, raw + count * sizeof(double));
+  }
+}
+
+void decodeDoubles(const char*& in, const char* end, double* values, size_t count, vector<int64_t>& ticks)
+{
+  if (in >= end) throw std::invalid_argument("Truncated double column in block");
+  bool exact = *in++ == 1;
+  if (exact) {
+    ticks.resize(count);
+    decodeIntegers(in, end, ticks.data(), count);
+    for (size_t i = 0; i < count; ++i) {
+      values[i] = ticks[i] / TICKS_PER_UNIT;
+    }
+  }
+  else {
+    if (static_cast<size_t>(end - in) < count * sizeof(double)) throw std::invalid_argument("Truncated double column in block");
+    memcpy(values, in, count * sizeof(double));
+    in += count * sizeof(double);
+  }
+}
+
+/**
+ * Archive Codec encoding the column arrays of a block and compressing them.
+ * Buffers are kept between blocks, so a long-lived codec does not allocate in the steady state.
+ */
+class ArchiveCodec
+{
+private:
+  vector<char> encoded; // column encoded payload before compression
+  vector<int64_t> ticks; // scratch for double columns
+  int level; // zlib compression level
+
+public:
+  // ctor
+  ArchiveCodec(int _level = Z_DEFAULT_COMPRESSION);
+
+  // Encode and compress the column arrays of a block, returns the encoded size before compression
+  size_t Encode(const RecordSchema& schema, const char* columns, size_t rowCount, vector<char>& out);
+
+  // Decompress and decode a block back into column arrays
+  void Decode(const RecordSchema& schema, const char* payload, size_t payloadSize, size_t encodedSize, size_t rowCount, vector<char>& columns);
+
+};
+
+ArchiveCodec::ArchiveCodec(int _level)
+: level(_level)
+{
+}
+
+size_t ArchiveCodec::Encode(const RecordSchema& schema, const char* columns, size_t rowCount, vector<char>& out)
+{
+  encoded.clear();
+  for (auto& column : schema.columns) {
+    size_t size = column.GetSize();
+    switch (column.type)
+    {
+      case TIMESTAMP_COLUMN:
+      case INT64_COLUMN:
+      case ENUM_COLUMN:
+        encodeIntegers(encoded, reinterpret_cast<const int64_t*>(columns), rowCount);
+        break;
+      case PRICE_COLUMN:
+      case DOUBLE_COLUMN:
+        encodeDoubles(encoded, reinterpret_cast<const double*>(columns), rowCount, ticks);
+        break;
+      case SYMBOL_COLUMN:
+        encoded.insert(encoded.end(), columns, columns + rowCount * size);
+        break;
+    }
+    columns += rowCount * size;
+  }
+
+  uLongf compressedSize = compressBound(encoded.size());
+  size_t start = out.size();
+  out.resize(start + compressedSize);
+  if (compress2(reinterpret_cast<Bytef*>(out.data() + start), &compressedSize, reinterpret_cast<const Bytef*>(encoded.data()), encoded.size(), level) != Z_OK) {
+    throw std::runtime_error("Cannot compress block of " + schema.name);
+  }
+  out.resize(start + compressedSize);
+  return encoded.size();
+}
+
+void ArchiveCodec::Decode(const RecordSchema& schema, const char* payload, size_t payloadSize, size_t encodedSize, size_t rowCount, vector<char>& columns)
+{
+  encoded.resize(encodedSize);
+  uLongf size = encodedSize;
+  if (uncompress(reinterpret_cast<Bytef*>(encoded.data()), &size, reinterpret_cast<const Bytef*>(payload), payloadSize) != Z_OK || size != encodedSize) {
+    throw std::invalid_argument("Cannot decompress block of " + schema.name);
+  }
+
+  columns.resize(rowCount * schema.rowSize);
+  char* out = columns.data();
+  const char* in = encoded.data();
+  const char* end = in + encoded.size();
+  for (auto& column : schema.columns) {
+    size_t size = column.GetSize();
+    switch (column.type)
+    {
+      case TIMESTAMP_COLUMN:
+      case INT64_COLUMN:
+      case ENUM_COLUMN:
+        decodeIntegers(in, end, reinterpret_cast<int64_t*>(out), rowCount);
+        break;
+      case PRICE_COLUMN:
+      case DOUBLE_COLUMN:
+        decodeDoubles(in, end, reinterpret_cast<double*>(out), rowCount, ticks);
+        break;
+      case SYMBOL_COLUMN:
+        if (static_cast<size_t>(end - in) < rowCount * size) throw std::invalid_argument("Truncated symbol column in block");
+        memcpy(out, in, rowCount * size);
+        in += rowCount * size;
+        break;
+    }
+    out += rowCount * size;
+  }
+}
+
+#endif
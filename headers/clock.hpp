@@ -0,0 +1,248 @@
+/**
+ * clock.hpp
+ * Defines the clocks and the timestamp formatter of the system.
+ *
+ * The formatter caches the "YYYY-MM-DD HH:MM:SS." prefix of the current second and only writes the
+ * milliseconds for the timestamps within that second, so localtime (which takes a global lock in glibc)
+ * runs once a second instead of once per timestamp. The TSC clock reads the time stamp counter of the
+ * CPU and scales it to nanoseconds since the epoch with a calibration against the wall clock, which costs
+ * a few nanoseconds instead of a clock call. The calibration is taken at startup and recalibrated
+ * periodically, so the clock does not drift away from the wall clock. It falls back to the system clock
+ * on CPUs without an invariant TSC.
+ *
+ * @author Boyu Yang
+ */
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+
+using namespace std;
+
+// Length of a formatted timestamp (e.g. 2023-12-23 22:42:44.260)
+const size_t TIMESTAMP_LENGTH = 23;
+
+// Duration of the TSC calibration against the wall clock
+const int TSC_CALIBRATION_MS = 5;
+
+// Interval between recalibrations of the TSC clock against the wall clock
+const int TSC_RECALIBRATION_MS = 1000;
+
+// Largest offset from the wall clock slewed away by a recalibration, larger offsets are stepped
+const int64_t TSC_MAX_SLEW_NANOS = 100000000;
+
+// get the system time in nanoseconds since epoch
+int64_t getWallNanos()
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Timestamp Formatter writing local times with millisecond precision.
+ * Not thread-safe: each thread keeps its own formatter.
+ */
+class TimestampFormatter
+{
+private:
+  int64_t cachedSecond; // second of the cached prefix
+  char prefix[20]; // "YYYY-MM-DD HH:MM:SS" of the cached second
+
+public:
+  // ctor
+  TimestampFormatter();
+
+  // Write the timestamp of nanoseconds since epoch to a buffer of at least TIMESTAMP_LENGTH characters
+  // returns the number of characters written, the buffer is not null-terminated
+  size_t Format(int64_t epochNanos, char* buffer);
+
+  // Format the timestamp of nanoseconds since epoch
+  string Format(int64_t epochNanos);
+
+};
+
+TimestampFormatter::TimestampFormatter()
+: cachedSecond(-1)
+{
+  prefix[0] = '\0';
+}
+
+size_t TimestampFormatter::Format(int64_t epochNanos, char* buffer)
+{
+  int64_t second = epochNanos / 1000000000;
+  if (second != cachedSecond) {
+    time_t seconds = static_cast<time_t>(second);
+    tm local;
+    localtime_r(&seconds, &local);
+    strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &local);
+    cachedSecond = second;
+  }
+  int millis = static_cast<int>(epochNanos / 1000000 % 1000);
+  for (size_t i = 0; i < 19; ++i) {
+    buffer[i] = prefix[i];
+  }
+  buffer[19] = '.';
+  buffer[20] = '0' + millis / 100;
+  buffer[21] = '0' + millis / 10 % 10;
+  buffer[22] = '0' + millis % 10;
+  return TIMESTAMP_LENGTH;
+}
+
+string TimestampFormatter::Format(int64_t epochNanos)
+{
+  char buffer[TIMESTAMP_LENGTH];
+  return string(buffer, Format(epochNanos, buffer));
+}
+
+/**
+ * TSC Clock: nanoseconds since epoch from the time stamp counter, calibrated against the wall clock.
+ * Recalibrate() measures the rate over the time since the previous recalibration and slews the offset
+ * from the wall clock away over the next interval, so the clock stays monotonic and within a few
+ * microseconds of the wall clock. Offsets above TSC_MAX_SLEW_NANOS (wall clock steps) are stepped.
+ * The calibration is published with a sequence lock: any thread reads the clock, one recalibrates it.
+ */
+class TscClock
+{
+private:
+  bool useTsc; // whether the CPU has an invariant TSC
+  atomic<uint32_t> sequence; // odd while the calibration is being updated
+  atomic<uint64_t> baseTicks; // counter at the calibration
+  atomic<int64_t> baseNanos; // clock time at the calibration
+  atomic<double> nanosPerTick; // calibrated rate
+  uint64_t sampleTicks; // counter at the last wall clock sample (recalibrating thread only)
+  int64_t sampleNanos; // wall clock at the last sample (recalibrating thread only)
+  double sampleRate; // rate measured between the last samples, before slewing (recalibrating thread only)
+
+  // read the time stamp counter
+  static uint64_t Ticks();
+
+  // publish a new calibration
+  void Publish(uint64_t ticks, int64_t nanos, double rate);
+
+public:
+  // ctor: calibrate over a short interval
+  TscClock(int calibrationMs = TSC_CALIBRATION_MS);
+
+  // Get the time in nanoseconds since epoch
+  int64_t Now() const;
+
+  // Recalibrate against the wall clock, called every TSC_RECALIBRATION_MS from a single thread at a time
+  void Recalibrate();
+
+  // Whether the clock reads the time stamp counter
+  bool IsTsc() const;
+
+  // Get the calibrated rate in ticks per nanosecond
+  double GetTicksPerNano() const;
+
+};
+
+uint64_t TscClock::Ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+void TscClock::Publish(uint64_t ticks, int64_t nanos, double rate)
+{
+  uint32_t current = sequence.load(memory_order_relaxed);
+  sequence.store(current + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  baseTicks.store(ticks, memory_order_relaxed);
+  baseNanos.store(nanos, memory_order_relaxed);
+  nanosPerTick.store(rate, memory_order_relaxed);
+  sequence.store(current + 2, memory_order_release);
+}
+
+TscClock::TscClock(int calibrationMs)
+: useTsc(false), sequence(0), baseTicks(0), baseNanos(0), nanosPerTick(1.0), sampleTicks(0), sampleNanos(0), sampleRate(1.0)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  // invariant TSC: constant rate across power states and cores (CPUID 0x80000007, EDX bit 8)
+  unsigned int eax, ebx, ecx, edx;
+  useTsc = __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+#endif
+  if (!useTsc) return;
+  int64_t startNanos = getWallNanos();
+  uint64_t startTicks = Ticks();
+  int64_t endNanos;
+  do {
+    endNanos = getWallNanos();
+  } while (endNanos - startNanos < calibrationMs * 1000000LL);
+  uint64_t endTicks = Ticks();
+  if (endTicks <= startTicks) {
+    useTsc = false;
+    return;
+  }
+  sampleTicks = endTicks;
+  sampleNanos = endNanos;
+  sampleRate = static_cast<double>(endNanos - startNanos) / static_cast<double>(endTicks - startTicks);
+  Publish(endTicks, endNanos, sampleRate);
+}
+
+int64_t TscClock::Now() const
+{
+  if (!useTsc) return getWallNanos();
+  uint32_t before, after;
+  uint64_t ticks;
+  int64_t nanos;
+  double rate;
+  do {
+    before = sequence.load(memory_order_acquire);
+    ticks = baseTicks.load(memory_order_relaxed);
+    nanos = baseNanos.load(memory_order_relaxed);
+    rate = nanosPerTick.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    after = sequence.load(memory_order_relaxed);
+  } while (before != after || (before & 1));
+  return nanos + static_cast<int64_t>(static_cast<double>(Ticks() - ticks) * rate);
+}
+
+void TscClock::Recalibrate()
+{
+  if (!useTsc) return;
+  uint64_t ticks = Ticks();
+  int64_t wallNanos = getWallNanos();
+  if (ticks <= sampleTicks) return;
+  // the clock at the sampled counter, the calibration only changes on this thread
+  int64_t clockNanos = baseNanos.load(memory_order_relaxed) + static_cast<int64_t>(static_cast<double>(ticks - baseTicks.load(memory_order_relaxed)) * nanosPerTick.load(memory_order_relaxed));
+  // the rate measured since the last sample, unless the wall clock was stepped in between
+  double measured = static_cast<double>(wallNanos - sampleNanos) / static_cast<double>(ticks - sampleTicks);
+  if (measured > 0.99 * sampleRate && measured < 1.01 * sampleRate) sampleRate = measured;
+  sampleTicks = ticks;
+  sampleNanos = wallNanos;
+  int64_t offset = wallNanos - clockNanos;
+  if (llabs(offset) > TSC_MAX_SLEW_NANOS) {
+    Publish(ticks, wallNanos, sampleRate);
+    return;
+  }
+  // run slightly faster or slower until the next recalibration to absorb the offset
+  double intervalTicks = TSC_RECALIBRATION_MS * 1000000.0 / sampleRate;
+  Publish(ticks, clockNanos, sampleRate + static_cast<double>(offset) / intervalTicks);
+}
+
+bool TscClock::IsTsc() const
+{
+  return useTsc;
+}
+
+double TscClock::GetTicksPerNano() const
+{
+  return 1.0 / nanosPerTick.load(memory_order_relaxed);
+}
+
+// the TSC clock of the process, calibrated at startup and recalibrated by the server
+TscClock tscClock;
+
+#endif
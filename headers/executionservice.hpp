@@ -9,8 +9,13 @@
 #define EXECUTION_SERVICE_HPP
 
 #include <string>
+#include <deque>
 #include "soa.hpp"
+#include "arena.hpp"
+#include "servercontext.hpp"
+#include "timerwheel.hpp"
 #include "algoexecutionservice.hpp"
+#include "asynclogger.hpp"
 
 /**
  * Forward declaration of ExecutionOutputConnector and ExecutionServiceListener.
@@ -32,7 +37,7 @@ template<typename T>
 class ExecutionService : public Service<string,ExecutionOrder <T> >
 {
 private:
-  map<string, ExecutionOrder<T>> executionOrderMap; // store execution order data keyed by product identifier
+  PooledMap<OrderId, ExecutionOrder<T>> executionOrderMap; // store execution order data keyed by order identifier
   vector<ServiceListener<ExecutionOrder<T>>*> listeners; // list of listeners to this service
   string host; // host name for inbound connector
   string port; // port number for inbound connector
@@ -41,7 +46,7 @@ private:
 
 public:
   // ctor and dtor
-  ExecutionService(const string& _host, const string& _port);
+  ExecutionService(const Strand& _strand, const string& _host, const string& _port, TimerService* _timerService);
   ~ExecutionService()=default;
 
   // Get data on our service given a key
@@ -71,17 +76,17 @@ public:
 };
 
 template<typename T>
-ExecutionService<T>::ExecutionService(const string& _host, const string& _port)
+ExecutionService<T>::ExecutionService(const Strand& _strand, const string& _host, const string& _port, TimerService* _timerService)
 : host(_host), port(_port)
 {
-  connector = new ExecutionOutputConnector<T>(this, host, port); // connector related to this server
+  connector = new ExecutionOutputConnector<T>(this, _strand, host, port, _timerService); // connector related to this server
   executionservicelistener = new ExecutionServiceListener<T>(this); // listener related to this server
 }
 
 template<typename T>
 ExecutionOrder<T>& ExecutionService<T>::GetData(string key)
 {
-  return executionOrderMap[key];
+  return executionOrderMap[OrderId(key)];
 }
 
 /**
@@ -135,9 +140,9 @@ template<typename T>
 void ExecutionService<T>::AddExecutionOrder(const AlgoExecution<T>& algoExecution)
 {
   ExecutionOrder<T> executionOrder = algoExecution.GetExecutionOrder();
-  string orderId = executionOrder.GetOrderId();
+  const OrderId& orderId = executionOrder.GetOrderId();
   if (executionOrderMap.find(orderId) != executionOrderMap.end()) {executionOrderMap.erase(orderId);}
-  executionOrderMap.insert(pair<string, ExecutionOrder<T>> (orderId, executionOrder));
+  executionOrderMap.insert(pair<OrderId, ExecutionOrder<T>> (orderId, executionOrder));
   
   // notify the listener
   for (auto& l : listeners) {
@@ -147,6 +152,8 @@ void ExecutionService<T>::AddExecutionOrder(const AlgoExecution<T>& algoExecutio
 
 /**
  * ExecutionOutputConnector: publish data to execution service.
+ * The connector keeps one outbound connection open and queues data lines on its strand,
+ * so publishing never blocks the calling service and writes are never interleaved.
  * Type T is the product type.
  */
 template<typename T>
@@ -156,16 +163,25 @@ private:
   ExecutionService<T>* service; // execution service related to this connector
   string host; // host name
   string port; // port number
-  boost::asio::io_service io_service; // io service
-  boost::asio::ip::tcp::socket socket; // socket
+  Strand strand; // strand serializing the handlers of this connector
+  boost::asio::ip::tcp::acceptor acceptor; // acceptor listening on host:port
+  boost::asio::ip::tcp::socket socket; // outbound socket the executions are published to
+  deque<string> writeQueue; // data lines waiting to be written, only touched on the strand
+  bool connected; // whether the outbound socket is connected
+  bool connecting; // whether a connect is in flight or waiting for its retry
+  TimerService* timerService; // shared timer wheel scheduling the reconnects
+  long reconnectDelayMs; // backoff of the next reconnect
 
   void handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request);
-  void start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service);
+  void start_accept();
+  void start_connect();
+  void start_write();
+  void schedule_reconnect();
 
 public:
   // ctor
-  ExecutionOutputConnector(ExecutionService<T>* _service, const string& _host, const string& _port);
-  // dtor: close the socket
+  ExecutionOutputConnector(ExecutionService<T>* _service, const Strand& _strand, const string& _host, const string& _port, TimerService* _timerService);
+  // dtor: close the sockets
   ~ExecutionOutputConnector();
 
   // Publish data to the Connector
@@ -173,29 +189,37 @@ public:
 
   // Here the subscribe is used to open a process and listen to the socket
   void Subscribe();
+
 };
 
 template<typename T>
-ExecutionOutputConnector<T>::ExecutionOutputConnector(ExecutionService<T>* _service, const string& _host, const string& _port)
-: service(_service), host(_host), port(_port), socket(io_service)
+ExecutionOutputConnector<T>::ExecutionOutputConnector(ExecutionService<T>* _service, const Strand& _strand, const string& _host, const string& _port, TimerService* _timerService)
+: service(_service), host(_host), port(_port), strand(_strand), acceptor(_strand), socket(_strand), connected(false), connecting(false), timerService(_timerService), reconnectDelayMs(RECONNECT_MIN_MS)
 {
 }
 
 template<typename T>
 ExecutionOutputConnector<T>::~ExecutionOutputConnector()
 {
+  acceptor.close();
   socket.close();
 }
 
 template<typename T>
-void ExecutionOutputConnector<T>::start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service) {
-  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(*io_service);
-  acceptor->async_accept(*socket, [this, socket, acceptor, io_service](const boost::system::error_code& ec) {
+void ExecutionOutputConnector<T>::start_accept() {
+  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(strand);
+  acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      delete socket; // acceptor closed, stop accepting
+      return;
+    }
     if (!ec) {
       boost::asio::streambuf* request = new boost::asio::streambuf;
       boost::asio::async_read_until(*socket, *request, "\r", std::bind(&ExecutionOutputConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
+    } else {
+      delete socket;
     }
-    start_accept(acceptor, io_service); // accept the next connection
+    start_accept(); // accept the next connection
   });
 }
 
@@ -218,69 +242,141 @@ void ExecutionOutputConnector<T>::handle_read(const boost::system::error_code& e
     // server receives and prints data
     cout << data << endl;
 
-    boost::asio::async_read_until(*socket, *request, "\n", std::bind(&ExecutionOutputConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
+    boost::asio::async_read_until(*socket, *request, "\r", std::bind(&ExecutionOutputConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
   } else {
     delete request; // delete the streambuf when we're done with it
     delete socket; // delete the socket when we're done with it
   }
 }
 
+// connect the outbound socket, queued data lines are flushed when the connection is up
+// a failed connect is retried with exponential backoff, the queued lines are kept meanwhile
+template<typename T>
+void ExecutionOutputConnector<T>::start_connect()
+{
+  if (connecting) return;
+  connecting = true;
+  try {
+    boost::asio::ip::tcp::resolver resolver(strand);
+    auto endpoints = resolver.resolve(host, port);
+    boost::asio::async_connect(socket, endpoints, [this](const boost::system::error_code& ec, const boost::asio::ip::tcp::endpoint& /*endpoint*/) {
+      connecting = false;
+      if (ec) {
+        LOG_ASYNC(LogLevel::ERROR, "Execution output connect failed: {}, retrying in {} ms", ec.message(), reconnectDelayMs);
+        socket.close();
+        schedule_reconnect();
+        return;
+      }
+      connected = true;
+      reconnectDelayMs = RECONNECT_MIN_MS;
+      if (!writeQueue.empty()) start_write();
+    });
+  }
+  catch (std::exception& e){
+    connecting = false;
+    log(LogLevel::ERROR, e.what());
+    schedule_reconnect();
+  }
+}
+
+// retry the connect after the current backoff on the connector's strand, the backoff doubles up to a maximum
+template<typename T>
+void ExecutionOutputConnector<T>::schedule_reconnect()
+{
+  long delay = reconnectDelayMs;
+  reconnectDelayMs = min(reconnectDelayMs * 2, RECONNECT_MAX_MS);
+  connecting = true;
+  timerService->Schedule(delay, strand, [this]() {
+    connecting = false;
+    start_connect();
+  });
+}
+
+// write the head of the queue, the completion handler chains the next write
+template<typename T>
+void ExecutionOutputConnector<T>::start_write()
+{
+  boost::asio::async_write(socket, boost::asio::buffer(writeQueue.front()), [this](const boost::system::error_code& ec, std::size_t /*length*/) {
+    if (ec) {
+      LOG_ASYNC(LogLevel::ERROR, "Execution output write failed: {}, reconnecting", ec.message());
+      connected = false;
+      socket.close();
+      // the line that failed stays at the head of the queue and is written again after the reconnect
+      schedule_reconnect();
+      return;
+    }
+    writeQueue.pop_front();
+    if (!writeQueue.empty()) start_write();
+  });
+}
+
 /**
  * Publish() method is used by publish-only connector to publish executions.
+ * The data line is handed over to the connector's strand, the calling service does not wait for the socket.
  */
 template<typename T>
 void ExecutionOutputConnector<T>::Publish(const ExecutionOrder<T>& order, Market& market)
 {
-  // connect to the socket
-  boost::asio::ip::tcp::resolver resolver(io_service);
-  boost::asio::ip::tcp::resolver::query query(host, port);
-  boost::asio::ip::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
-  boost::asio::connect(socket, endpoint_iterator);
-
-  // publish the execution order data to socket
-  auto product = order.GetProduct();
-  string order_type;
-  switch(order.GetOrderType()) {
-      case FOK: order_type = "FOK"; break;
-      case MARKET: order_type = "MARKET"; break;
-      case LIMIT: order_type = "LIMIT"; break;
-      case STOP: order_type = "STOP"; break;
-      case IOC: order_type = "IOC"; break;
-  }
-  string tradeMarket;
+  // publish the execution order data to socket, formatted into one line
+  const char* tradeMarket = "";
   switch(market) {
       case BROKERTEC: tradeMarket = "BROKERTEC"; break;
       case ESPEED: tradeMarket = "ESPEED"; break;
       case CME: tradeMarket = "CME"; break;
   }
-  std::string dataLine = string("ExecutionOrder: \n")
-    + "\tProduct: " + product.GetProductId() + "\tOrderId: " + order.GetOrderId() + "\tTrade Market: " + tradeMarket + "\n"
-    + "\tPricingSide: " + (order.GetSide()==BID? "Bid":"Offer")
-    + "\tOrderType: " + order_type + "\t\tIsChildOrder: " + (order.IsChildOrder()?"True":"False") + "\n"
-    + "\tPrice: " + std::to_string(order.GetPrice()) + "\tVisibleQuantity: " + std::to_string(order.GetVisibleQuantity())
-    + "\tHiddenQuantity: " + std::to_string(order.GetHiddenQuantity()) + "\n";
+  char text[RECORD_TEXT_CAPACITY];
+  TextWriter writer(text, sizeof(text));
+  writer.Append("ExecutionOrder: \n\tProduct: ");
+  writer.Append(order.GetProduct().GetProductId().View());
+  writer.Append("\tOrderId: ");
+  writer.Append(order.GetOrderId().View());
+  writer.Append("\tTrade Market: ");
+  writer.Append(tradeMarket);
+  writer.Append("\n\tPricingSide: ");
+  writer.Append(order.GetSide() == BID ? "Bid" : "Offer");
+  writer.Append("\tOrderType: ");
+  writer.Append(orderTypeName(order.GetOrderType()));
+  writer.Append("\t\tIsChildOrder: ");
+  writer.Append(order.IsChildOrder() ? "True" : "False");
+  writer.Append("\n\tPrice: ");
+  writer.AppendDouble(order.GetPrice());
+  writer.Append("\tVisibleQuantity: ");
+  writer.AppendInteger(order.GetVisibleQuantity());
+  writer.Append("\tHiddenQuantity: ");
+  writer.AppendInteger(order.GetHiddenQuantity());
+  writer.Append("\n\r");
+  std::string dataLine(writer.View());
 
   // publish the data string to socket
   // asynchronous operation ensures server gets all data
-  boost::asio::async_write(socket, boost::asio::buffer(dataLine + "\r"), [](boost::system::error_code /*ec*/, std::size_t /*length*/) {});
+  boost::asio::post(strand, [this, dataLine = std::move(dataLine)]() mutable {
+    writeQueue.push_back(std::move(dataLine));
+    if (!connected) {
+      start_connect();
+    } else if (writeQueue.size() == 1) {
+      start_write();
+    }
+  });
 }
 
 template<typename T>
 void ExecutionOutputConnector<T>::Subscribe()
 {
-  log(LogLevel::NOTE, "Streaming output server listening on " + host + ":" + port);
+  log(LogLevel::NOTE, "Execution output server listening on " + host + ":" + port);
   try {
-  // connect to the socket
-  boost::asio::ip::tcp::resolver resolver(io_service);
-  boost::asio::ip::tcp::resolver::query query(host, port);
-  boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-  boost::asio::ip::tcp::acceptor acceptor(io_service, endpoint);
-  start_accept(&acceptor, &io_service);
-  io_service.run();
+  // bind the acceptor on the shared server context, the worker pool runs the handlers
+  boost::asio::ip::tcp::resolver resolver(strand);
+  boost::asio::ip::tcp::endpoint endpoint = resolver.resolve(host, port)->endpoint();
+  acceptor.open(endpoint.protocol());
+  acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  acceptor.bind(endpoint);
+  acceptor.listen();
+  start_accept();
   }
   catch (std::exception& e){
     // throw error log
     log(LogLevel::ERROR, e.what());
+    acceptor.close();
     return;
   }
 }
@@ -0,0 +1,231 @@
+/**
+ * fixedstring.hpp
+ * Defines the fixed-capacity inline string used for the identifiers of the system.
+ *
+ * The characters live inside the object, zero-padded to the capacity, so copying an identifier is a
+ * copy of a few words, and equality and hashing run over whole 8-byte words without looking at the
+ * length. CUSIPs, order, trade and inquiry identifiers and book names are stored this way in the
+ * domain classes and used as map keys.
+ *
+ * @author Boyu Yang
+ */
+#ifndef FIXED_STRING_HPP
+#define FIXED_STRING_HPP
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <ostream>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+
+/**
+ * Fixed String of at most N characters, N a multiple of 8.
+ * Converts implicitly to string and string_view; building one from a longer text throws.
+ */
+template<size_t N>
+class FixedString
+{
+  static_assert(N % 8 == 0 && N > 0 && N < 256, "the capacity of a fixed string is a multiple of 8 below 256");
+
+private:
+  char data[N]; // characters, zero after the length
+  uint8_t length;
+
+public:
+  // maximum number of characters
+  static const size_t CAPACITY = N;
+
+  // ctors
+  FixedString();
+  explicit FixedString(string_view text);
+
+  // Assign a text
+  FixedString& assign(string_view text);
+
+  // Get the characters (not null-terminated at full capacity)
+  const char* Data() const;
+
+  // Get the number of characters
+  size_t size() const;
+  bool empty() const;
+
+  // Get the text
+  string_view View() const;
+  string str() const;
+  operator string_view() const;
+  operator string() const;
+
+  // Hash of the text, over the zero-padded words
+  size_t Hash() const;
+
+  // comparisons
+  template<size_t M>
+  friend bool operator==(const FixedString<M>& a, const FixedString<M>& b);
+  template<size_t M>
+  friend bool operator<(const FixedString<M>& a, const FixedString<M>& b);
+
+};
+
+template<size_t N>
+FixedString<N>::FixedString()
+: data{}, length(0)
+{
+}
+
+template<size_t N>
+FixedString<N>::FixedString(string_view text)
+: data{}, length(0)
+{
+  assign(text);
+}
+
+template<size_t N>
+FixedString<N>& FixedString<N>::assign(string_view text)
+{
+  if (text.size() > N) {
+    throw std::invalid_argument("Identifier longer than " + to_string(N) + " characters: " + string(text));
+  }
+  memset(data, 0, N);
+  memcpy(data, text.data(), text.size());
+  length = static_cast<uint8_t>(text.size());
+  return *this;
+}
+
+template<size_t N>
+const char* FixedString<N>::Data() const
+{
+  return data;
+}
+
+template<size_t N>
+size_t FixedString<N>::size() const
+{
+  return length;
+}
+
+template<size_t N>
+bool FixedString<N>::empty() const
+{
+  return length == 0;
+}
+
+template<size_t N>
+string_view FixedString<N>::View() const
+{
+  return string_view(data, length);
+}
+
+template<size_t N>
+string FixedString<N>::str() const
+{
+  return string(data, length);
+}
+
+template<size_t N>
+FixedString<N>::operator string_view() const
+{
+  return View();
+}
+
+template<size_t N>
+FixedString<N>::operator string() const
+{
+  return str();
+}
+
+template<size_t N>
+size_t FixedString<N>::Hash() const
+{
+  // multiply-xorshift over the words, the padding is zero so equal texts hash equally
+  uint64_t hash = length * 0x9E3779B97F4A7C15ull;
+  for (size_t i = 0; i < N; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 32;
+  }
+  return static_cast<size_t>(hash);
+}
+
+template<size_t M>
+bool operator==(const FixedString<M>& a, const FixedString<M>& b)
+{
+  return a.length == b.length && memcmp(a.data, b.data, M) == 0;
+}
+
+template<size_t M>
+bool operator!=(const FixedString<M>& a, const FixedString<M>& b)
+{
+  return !(a == b);
+}
+
+template<size_t M>
+bool operator<(const FixedString<M>& a, const FixedString<M>& b)
+{
+  // zero padding sorts shorter texts first, as string does
+  return memcmp(a.data, b.data, M) < 0;
+}
+
+template<size_t M>
+bool operator==(const FixedString<M>& a, string_view b)
+{
+  return a.View() == b;
+}
+
+template<size_t M>
+bool operator==(string_view a, const FixedString<M>& b)
+{
+  return a == b.View();
+}
+
+template<size_t M>
+bool operator!=(const FixedString<M>& a, string_view b)
+{
+  return a.View() != b;
+}
+
+template<size_t M>
+bool operator!=(string_view a, const FixedString<M>& b)
+{
+  return a != b.View();
+}
+
+template<size_t M>
+ostream& operator<<(ostream& os, const FixedString<M>& text)
+{
+  return os.write(text.Data(), text.size());
+}
+
+template<size_t M>
+string operator+(const string& a, const FixedString<M>& b)
+{
+  return a + string(b.View());
+}
+
+template<size_t M>
+string operator+(const FixedString<M>& a, const string& b)
+{
+  return string(a.View()) + b;
+}
+
+namespace std
+{
+  template<size_t N>
+  struct hash<FixedString<N>>
+  {
+    size_t operator()(const FixedString<N>& text) const { return text.Hash(); }
+  };
+}
+
+// Identifiers of the domain classes
+typedef FixedString<16> ProductId; // CUSIP (9) or ISIN (12)
+typedef FixedString<32> OrderId; // order and parent order identifiers (prefix and generated identifier)
+typedef FixedString<32> TradeId; // trade identifiers, algo fills reuse the order identifier
+typedef FixedString<16> InquiryId; // inquiry identifiers
+typedef FixedString<8> BookId; // book names
+
+#endif
@@ -2,15 +2,186 @@
  * guiservice.hpp
  * Defines the data types and Service for GUI output.
  *
+ * The GUI connector writes through sinks that stay open for the life of the service. The file sink
+ * formats each line into a reused buffer behind a timestamp prefix that is only reformatted when the
+ * second changes, and writes a whole throttle tick with one call. The snapshot sink keeps the latest
+ * price of every product in a memory-mapped file, one slot per product guarded by a sequence number,
+ * so a GUI process can map it and read consistent prices without parsing a file.
+ *
  * @author Boyu Yang
  */
 
 #ifndef GUI_SERVICE_HPP
 #define GUI_SERVICE_HPP
 
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
 #include "soa.hpp"  
+#include "arena.hpp"
 #include "utils.hpp"
 #include "pricingservice.hpp"
+#include "messages.hpp"
+#include "timerwheel.hpp"
+#include "asynclogger.hpp"
+
+// Outputs of the GUI, combined as flags
+// GUI_FILE: lines appended to gui.txt
+// GUI_SNAPSHOT: latest price of each product in the memory-mapped file gui.snapshot
+enum GUIOutput { GUI_FILE = 1, GUI_SNAPSHOT = 2 };
+
+// Magic number of a GUI snapshot file
+const char GUI_SNAPSHOT_MAGIC[8] = {'T', 'S', 'G', 'U', 'I', '0', '0', '1'};
+
+// Number of product slots of a GUI snapshot
+const uint32_t GUI_SNAPSHOT_SLOTS = 64;
+
+// header at the start of a GUI snapshot file
+struct GUISnapshotHeader
+{
+  char magic[8];
+  uint32_t slotCount;
+  uint32_t slotSize;
+  atomic<uint32_t> productCount; // slots in use, published with release semantics
+  uint32_t reserved;
+};
+
+// slot of a product in a GUI snapshot
+// the writer makes the sequence odd while it updates the slot, a reader retries on an odd or changed sequence
+struct GUISnapshotSlot
+{
+  atomic<uint64_t> sequence;
+  char productId[16];
+  int64_t timestamp; // milliseconds since the epoch
+  double mid;
+  double bidOfferSpread;
+};
+
+/**
+* GUI Snapshot: latest price of each product in a memory-mapped file shared with GUI processes.
+*/
+class GUISnapshot
+{
+private:
+  char* mapping; // mapping of the file
+  size_t mappingSize; // size of the mapping
+  GUISnapshotHeader* header; // header of the file
+  GUISnapshotSlot* slots; // first slot
+  map<ProductId, uint32_t> slotIndex; // product identifier -> slot (writer only)
+
+public:
+  // ctor: create the file when writable, map an existing file otherwise
+  GUISnapshot(const string& path, bool writable);
+  // dtor
+  ~GUISnapshot();
+
+  // Write the latest price of a product
+  void Write(const ProductId& productId, int64_t timestamp, double mid, double bidOfferSpread);
+
+  // Read a consistent copy of a slot, returns false if the slot is not in use
+  bool Read(uint32_t slot, string& productId, int64_t& timestamp, double& mid, double& bidOfferSpread) const;
+
+  // Get the number of products in the snapshot
+  uint32_t GetProductCount() const;
+
+};
+
+GUISnapshot::GUISnapshot(const string& path, bool writable)
+: mapping(nullptr), mappingSize(sizeof(GUISnapshotHeader) + GUI_SNAPSHOT_SLOTS * sizeof(GUISnapshotSlot)), header(nullptr), slots(nullptr)
+{
+  int fd = writable ? open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+  if (fd < 0 || (writable && ftruncate(fd, mappingSize) != 0)) {
+    if (fd >= 0) close(fd);
+    throw std::runtime_error("Cannot open GUI snapshot " + path);
+  }
+  void* address = mmap(nullptr, mappingSize, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    throw std::runtime_error("Cannot map GUI snapshot " + path);
+  }
+  mapping = static_cast<char*>(address);
+  header = reinterpret_cast<GUISnapshotHeader*>(mapping);
+  slots = reinterpret_cast<GUISnapshotSlot*>(mapping + sizeof(GUISnapshotHeader));
+  if (writable) {
+    // the file is zero-filled, so every slot starts unused with an even sequence
+    header = new (mapping) GUISnapshotHeader;
+    memcpy(header->magic, GUI_SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->slotCount = GUI_SNAPSHOT_SLOTS;
+    header->slotSize = sizeof(GUISnapshotSlot);
+    header->productCount.store(0, memory_order_release);
+  }
+  else if (memcmp(header->magic, GUI_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+    munmap(mapping, mappingSize);
+    throw std::runtime_error("Not a GUI snapshot: " + path);
+  }
+}
+
+GUISnapshot::~GUISnapshot()
+{
+  if (mapping) munmap(mapping, mappingSize);
+}
+
+void GUISnapshot::Write(const ProductId& productId, int64_t timestamp, double mid, double bidOfferSpread)
+{
+  auto it = slotIndex.find(productId);
+  uint32_t slot;
+  if (it != slotIndex.end()) {
+    slot = it->second;
+  }
+  else {
+    slot = slotIndex.size();
+    if (slot >= GUI_SNAPSHOT_SLOTS) {
+      LOG_ASYNC(LogLevel::WARNING, "GUI snapshot is full, dropping product {}", productId);
+      return;
+    }
+    slotIndex[productId] = slot;
+  }
+  GUISnapshotSlot& target = slots[slot];
+  uint64_t sequence = target.sequence.load(memory_order_relaxed);
+  target.sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memset(target.productId, 0, sizeof(target.productId));
+  memcpy(target.productId, productId.Data(), min(productId.size(), sizeof(target.productId) - 1));
+  target.timestamp = timestamp;
+  target.mid = mid;
+  target.bidOfferSpread = bidOfferSpread;
+  target.sequence.store(sequence + 2, memory_order_release);
+  // a new product becomes visible to readers after its first write
+  if (it == slotIndex.end()) {
+    header->productCount.store(slot + 1, memory_order_release);
+  }
+}
+
+bool GUISnapshot::Read(uint32_t slot, string& productId, int64_t& timestamp, double& mid, double& bidOfferSpread) const
+{
+  if (slot >= header->productCount.load(memory_order_acquire)) return false;
+  const GUISnapshotSlot& source = slots[slot];
+  while (true) {
+    uint64_t before = source.sequence.load(memory_order_acquire);
+    if (before & 1) continue;
+    char id[sizeof(source.productId)];
+    memcpy(id, source.productId, sizeof(id));
+    timestamp = source.timestamp;
+    mid = source.mid;
+    bidOfferSpread = source.bidOfferSpread;
+    atomic_thread_fence(memory_order_acquire);
+    if (source.sequence.load(memory_order_relaxed) == before) {
+      id[sizeof(id) - 1] = '\0';
+      productId = id;
+      return true;
+    }
+  }
+}
+
+uint32_t GUISnapshot::GetProductCount() const
+{
+  return header->productCount.load(memory_order_acquire);
+}
 
 // forward declaration of GUIConnector and GUIServiceListener
 template<typename T>
@@ -21,6 +192,10 @@ class GUIServiceListener;
 
 /**
 * Service for outputing GUI with a certain throttle.
+* Prices are conflated per product: the latest price of each product is kept, and on each throttle tick
+* only the products priced since the previous tick are published, so every product shows a fresh value
+* and each product is published at most once per throttle. The latest prices are kept as flat messages
+* indexed by product handle, and a Price is only built back when it is published.
 * Keyed on product identifier.
 * Type T is the product type.
 */
@@ -28,16 +203,26 @@ template<typename T>
 class GUIService : public Service<string,Price<T> >
 {
 private:
-    map<string, Price<T>> priceMap; // store price data keyed by product identifier
+    PooledMap<ProductId, Price<T>> priceMap; // store the last published price keyed by product identifier
+    vector<PriceMessage> latestPrices; // latest price of each product, indexed by product handle
+    vector<ProductHandle> dirtyProducts; // products priced since the last flush, in order of their first price
+    vector<uint8_t> dirtyFlags; // whether a product is in the dirty list, indexed by product handle
     vector<ServiceListener<Price<T>>*> listeners; // list of listeners to this service
     GUIConnector<T>* connector; // connector related to this server
     GUIServiceListener<T>* guiservicelistener; // listener related to this server
     int throttle; // throttle of the service   
-    std::chrono::system_clock::time_point startTime; // start time
+    TimerService* timerService; // shared timer wheel closing the throttle window
+    Strand strand; // strand of the price feed
+    bool ticking; // whether a flush is scheduled
+    long publishCount; // prices published
+    long conflatedCount; // prices replaced by a later price of the same product before a flush
+
+    // publish the dirty products, and keep ticking while prices arrive
+    void Flush();
 
 public:
     // ctor
-    GUIService();
+    GUIService(TimerService* _timerService, const Strand& _strand, int outputs = GUI_FILE);
     // dtor
     ~GUIService()=default;
 
@@ -62,24 +247,33 @@ public:
     // Get the throttle
     int GetThrottle() const;
 
-    // Publish the throttled price through connector
+    // Conflate a price, it is published through the connector on the next throttle tick
     void PublishThrottledPrice(Price<T>& price);
 
+    // Get the number of prices published
+    long GetPublishCount() const;
+
+    // Get the number of prices conflated away
+    long GetConflatedCount() const;
+
 };
 
 template<typename T>
-GUIService<T>::GUIService()
+GUIService<T>::GUIService(TimerService* _timerService, const Strand& _strand, int outputs)
+: timerService(_timerService), strand(_strand)
 {
-    connector = new GUIConnector<T>(this); // connector related to this server
+    connector = new GUIConnector<T>(this, outputs); // connector related to this server
     guiservicelistener = new GUIServiceListener<T>(this); // listener related to this server
     throttle = 300; // default throttle 
-    startTime = std::chrono::system_clock::now(); // start time
+    ticking = false;
+    publishCount = 0;
+    conflatedCount = 0;
 }
 
 template<typename T>
 Price<T>& GUIService<T>::GetData(string key)
 {
-    return priceMap[key];
+    return priceMap[ProductId(key)];
 }
 
 // no need to implement OnMessage
@@ -121,19 +315,67 @@ int GUIService<T>::GetThrottle() const
 template<typename T>
 void GUIService<T>::PublishThrottledPrice(Price<T>& price)
 {
-    // only publish price to GUI if the time interval is larger than throttle
-    auto now = std::chrono::system_clock::now();
-    auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime);
-    if (diff.count() > throttle) {
-        // update the time
-        startTime = now;
-        // publish the price
-        connector->Publish(price);
+    // keep the latest price of the product
+    PriceMessage message = toMessage(price);
+    ProductHandle handle = message.product;
+    if (handle >= latestPrices.size()) {
+        latestPrices.resize(handle + 1);
+        dirtyFlags.resize(handle + 1, 0);
+    }
+    latestPrices[handle] = message;
+
+    if (dirtyFlags[handle]) {
+        conflatedCount++;
+    }
+    else {
+        dirtyFlags[handle] = 1;
+        dirtyProducts.push_back(handle);
+    }
+    // the flush runs on the strand of the price feed, so no lock is needed
+    if (!ticking) {
+        ticking = true;
+        timerService->Schedule(throttle, strand, [this]() { Flush(); });
+    }
+}
+
+template<typename T>
+void GUIService<T>::Flush()
+{
+    if (dirtyProducts.empty()) {
+        // no price since the last tick, stop ticking until the next price
+        ticking = false;
+        return;
     }
+    for (ProductHandle handle : dirtyProducts) {
+        dirtyFlags[handle] = 0;
+        // the price is built back from its message at the edge, when it is shown
+        Price<T> price = fromMessage<T>(latestPrices[handle]);
+        Price<T>& published = priceMap[price.GetProduct().GetProductId()];
+        published = price;
+        connector->Publish(published);
+        publishCount++;
+    }
+    dirtyProducts.clear();
+    // one write per tick
+    connector->Flush();
+    timerService->Schedule(throttle, strand, [this]() { Flush(); });
+}
+
+template<typename T>
+long GUIService<T>::GetPublishCount() const
+{
+    return publishCount;
+}
+
+template<typename T>
+long GUIService<T>::GetConflatedCount() const
+{
+    return conflatedCount;
 }
 
 /**
 * GUI Connector publishing data from GUI Service.
+* The sinks are opened once, lines are buffered until Flush.
 * Type T is the product type.
 */
 template<typename T>
@@ -141,30 +383,74 @@ class GUIConnector : public Connector<Price<T>>
 {
 private:
     GUIService<T>* service;
+    FILE* file; // gui.txt, nullptr without the file output
+    GUISnapshot* snapshot; // gui.snapshot, nullptr without the snapshot output
+    string buffer; // lines of the current tick, reused across ticks
+    TimestampFormatter formatter; // timestamps of the lines
 
 public:
     // ctor
-    GUIConnector(GUIService<T>* _service);
+    GUIConnector(GUIService<T>* _service, int outputs = GUI_FILE);
+    // dtor: flush and close the sinks
+    ~GUIConnector();
     // Publish data to the Connector
     // If subscribe-only, then this does nothing
     void Publish(Price<T> &data) override;
+    // Write the buffered lines to the file
+    void Flush();
 };
 
 template<typename T>
-GUIConnector<T>::GUIConnector(GUIService<T>* _service)
+GUIConnector<T>::GUIConnector(GUIService<T>* _service, int outputs)
+: file(nullptr), snapshot(nullptr)
 {
     service = _service;
+    if (outputs & GUI_FILE) {
+        file = fopen("../res/gui.txt", "a");
+        if (!file) throw std::runtime_error("Cannot open ../res/gui.txt");
+    }
+    if (outputs & GUI_SNAPSHOT) {
+        snapshot = new GUISnapshot("../res/gui.snapshot", true);
+    }
+    buffer.reserve(4096);
 }
 
-// publish to external source gui.txt
+template<typename T>
+GUIConnector<T>::~GUIConnector()
+{
+    Flush();
+    if (file) fclose(file);
+    delete snapshot;
+}
+
+// publish to external source gui.txt and gui.snapshot
 template<typename T>
 void GUIConnector<T>::Publish(Price<T> &data)
 {
-    ofstream outFile;
-    outFile.open("../res/gui.txt", ios::app);
-    // need overloading operator<< for Price<T>
-    outFile << getTime() << "," << data << endl;
-    outFile.close();
+    int64_t nanos = tscClock.Now();
+    const ProductId& productId = data.GetProduct().GetProductId();
+    if (snapshot) {
+        snapshot->Write(productId, nanos / 1000000, data.GetMid(), data.GetBidOfferSpread());
+    }
+    if (!file) return;
+
+    // the date and time are only formatted when the second changes
+    char text[TIMESTAMP_LENGTH + RECORD_TEXT_CAPACITY];
+    size_t length = formatter.Format(nanos, text);
+    TextWriter writer(text + length, sizeof(text) - length);
+    writer.Append(',');
+    formatRecord(writer, data);
+    writer.Append('\n');
+    buffer.append(text, length + writer.Size());
+}
+
+template<typename T>
+void GUIConnector<T>::Flush()
+{
+    if (!file || buffer.empty()) return;
+    fwrite(buffer.data(), 1, buffer.size(), file);
+    fflush(file);
+    buffer.clear();
 }
 
 /**
@@ -9,14 +9,150 @@
 #define HISTORICAL_DATA_SERVICE_HPP
 
 #include "soa.hpp"
+#include "arena.hpp"
 #include "streamingservice.hpp"
 #include "riskservice.hpp"
 #include "executionservice.hpp"
 #include "inquiryservice.hpp"
 #include "positionservice.hpp"
+#include "pnlservice.hpp"
+#include "persistencewriter.hpp"
+#include "historicalrecord.hpp"
+#include "historicalstore.hpp"
+#include "segmentstore.hpp"
 #include "utils.hpp"
 
-enum ServiceType {POSITION, RISK, EXECUTION, STREAMING, INQUIRY};
+enum ServiceType {POSITION, RISK, EXECUTION, STREAMING, INQUIRY, PNL};
+
+// Persistence modes of the historical data service, can be combined (e.g. TEXT | COLUMNAR)
+// TEXT: one CSV line per record in <name>.txt
+// COLUMNAR: binary columnar store <name>.col with its block index <name>.idx
+// SEGMENT: fixed-size records in memory-mapped segment files <name>.<sequence>.seg
+// ARCHIVE: compressed columnar store <name>.archive.col with its block index <name>.archive.idx
+enum PersistenceMode { TEXT = 1, COLUMNAR = 2, SEGMENT = 4, ARCHIVE = 8 };
+
+// Maximum time span of an archive block, longer blocks compress better
+const long ARCHIVE_BLOCK_SPAN_MS = 10000;
+
+// get the path of the result files of a service type, without extension
+string getPersistPath(ServiceType type)
+{
+  switch (type)
+  {
+    case POSITION:
+      return "../res/positions";
+    case RISK:
+      return "../res/risk";
+    case EXECUTION:
+      return "../res/executions";
+    case STREAMING:
+      return "../res/streaming";
+    case INQUIRY:
+      return "../res/allinquiries";
+    case PNL:
+      return "../res/pnl";
+    default:
+      return "../res/historical";
+  }
+}
+
+// the identifiers of the domain classes always fit their symbol columns
+static_assert(ProductId::CAPACITY <= SYMBOL_SIZE, "a product id fits a symbol column");
+static_assert(InquiryId::CAPACITY <= SYMBOL_SIZE, "an inquiry id fits a symbol column");
+static_assert(OrderId::CAPACITY <= ORDER_ID_SIZE, "an order id fits an order id column");
+
+/**
+ * Flat record type persisted in the binary stores for each data type.
+ */
+template<typename V>
+struct HistoricalRecord;
+
+template<typename T>
+struct HistoricalRecord<Position<T>> { typedef PositionRecord type; };
+
+template<typename T>
+struct HistoricalRecord<PV01<T>> { typedef RiskRecord type; };
+
+template<typename T>
+struct HistoricalRecord<ExecutionOrder<T>> { typedef ExecutionRecord type; };
+
+template<typename T>
+struct HistoricalRecord<PriceStream<T>> { typedef StreamRecord type; };
+
+template<typename T>
+struct HistoricalRecord<Inquiry<T>> { typedef InquiryRecord type; };
+
+template<typename T>
+struct HistoricalRecord<PnL<T>> { typedef PnLRecord type; };
+
+// fill the flat records from the data types (the timestamp is set by the connector)
+template<typename T>
+void toRecord(const Position<T>& position, PositionRecord& record)
+{
+  copySymbol(record.product, position.GetProduct().GetProductId());
+  for (size_t i = 0; i < historicalBooks.size(); ++i) {
+    record.positions[i] = position.GetPosition(historicalBooks[i]);
+  }
+  record.aggregate = position.GetAggregatePosition();
+}
+
+template<typename T>
+void toRecord(const PV01<T>& pv01, RiskRecord& record)
+{
+  copySymbol(record.product, pv01.GetProduct().GetProductId());
+  record.pv01 = pv01.GetPV01();
+  record.quantity = pv01.GetQuantity();
+}
+
+template<typename T>
+void toRecord(const ExecutionOrder<T>& order, ExecutionRecord& record)
+{
+  copySymbol(record.product, order.GetProduct().GetProductId());
+  copySymbol(record.orderId, order.GetOrderId(), ORDER_ID_SIZE);
+  record.side = order.GetSide();
+  record.orderType = order.GetOrderType();
+  record.price = order.GetPrice();
+  record.visibleQuantity = order.GetVisibleQuantity();
+  record.hiddenQuantity = order.GetHiddenQuantity();
+  copySymbol(record.parentOrderId, order.GetParentOrderId(), ORDER_ID_SIZE);
+  record.isChildOrder = order.IsChildOrder();
+}
+
+template<typename T>
+void toRecord(const PriceStream<T>& priceStream, StreamRecord& record)
+{
+  copySymbol(record.product, priceStream.GetProduct().GetProductId());
+  const PriceStreamOrder& bid = priceStream.GetBidOrder();
+  const PriceStreamOrder& offer = priceStream.GetOfferOrder();
+  record.bidPrice = bid.GetPrice();
+  record.bidVisibleQuantity = bid.GetVisibleQuantity();
+  record.bidHiddenQuantity = bid.GetHiddenQuantity();
+  record.offerPrice = offer.GetPrice();
+  record.offerVisibleQuantity = offer.GetVisibleQuantity();
+  record.offerHiddenQuantity = offer.GetHiddenQuantity();
+}
+
+template<typename T>
+void toRecord(const Inquiry<T>& inquiry, InquiryRecord& record)
+{
+  copySymbol(record.inquiryId, inquiry.GetInquiryId());
+  copySymbol(record.product, inquiry.GetProduct().GetProductId());
+  record.side = inquiry.GetSide();
+  record.quantity = inquiry.GetQuantity();
+  record.price = inquiry.GetPrice();
+  record.state = inquiry.GetState();
+}
+
+template<typename T>
+void toRecord(const PnL<T>& pnl, PnLRecord& record)
+{
+  copySymbol(record.product, pnl.GetProduct().GetProductId());
+  record.mark = pnl.GetMark();
+  record.position = pnl.GetAggregatePosition();
+  record.realized = pnl.GetRealizedPnL();
+  record.unrealized = pnl.GetUnrealizedPnL();
+  record.total = pnl.GetTotalPnL();
+}
 
 
 // pre declaration
@@ -35,7 +171,7 @@ template<typename T>
 class HistoricalDataService : Service<string,T>
 {
 private:
-  map<string, T> dataMap; // store data keyed by some persistent key
+  PooledMap<string, T> dataMap; // store data keyed by some persistent key
   vector<ServiceListener<T>*> listeners; // list of listeners to this service
   HistoricalDataConnector<T>* connector; // connector related to this server
   ServiceType type; // type of the service
@@ -43,8 +179,8 @@ private:
 
 public:
   // ctor and dtor
-  HistoricalDataService(ServiceType _type);  
-  ~HistoricalDataService()=default;
+  HistoricalDataService(ServiceType _type, PersistenceWriter* _writer, int _modes = TEXT, size_t _segmentSize = DEFAULT_SEGMENT_SIZE);
+  ~HistoricalDataService();
 
   // Get data on our service given a key
   T& GetData(string key) override;
@@ -74,11 +210,19 @@ public:
 };
 
 template<typename T>
-HistoricalDataService<T>::HistoricalDataService(ServiceType _type)
+HistoricalDataService<T>::HistoricalDataService(ServiceType _type, PersistenceWriter* _writer, int _modes, size_t _segmentSize)
 {
   type = _type;
   historicalservicelistener = new HistoricalDataServiceListener<T>(this); // listener related to this server
-  connector = new HistoricalDataConnector<T>(this); // connector related to this server
+  connector = new HistoricalDataConnector<T>(this, _writer, _modes, _segmentSize); // connector related to this server
+}
+
+// the connector flushes its buffered records when it is deleted
+template<typename T>
+HistoricalDataService<T>::~HistoricalDataService()
+{
+  delete connector;
+  delete historicalservicelistener;
 }
 
 template<typename T>
@@ -144,66 +288,100 @@ void HistoricalDataService<T>::PersistData(string persistKey, T& data)
 
 /**
 * Historical Data Connector publishing data from Historical Data Service.
+* The connector keeps a long-lived channel to its result file, lines are written by the asynchronous persistence writer.
+* In COLUMNAR mode records are also appended to the binary columnar store of the service type,
+* in SEGMENT mode they are copied into memory-mapped segments that other processes can tail,
+* and in ARCHIVE mode they are appended to a delta encoded and compressed columnar store.
 * Type T is the data type to persist.
  */
 template<typename T>
-class HistoricalDataConnector : public Connector<T>
+class HistoricalDataConnector final : public Connector<T>
 {
 private:
   HistoricalDataService<T>* service;
+  int modes; // persistence modes
+  PersistenceChannel* channel; // channel to the text result file
+  ColumnarWriter* columnarWriter; // writer of the columnar store
+  SegmentWriter* segmentWriter; // writer of the segment files
+  ColumnarWriter* archiveWriter; // writer of the compressed archive
+  PersistenceWriter* persistenceWriter; // writer thread, syncs the segment files on its fsync interval
+  size_t segmentSyncHook; // sync hook of the segment files
+  TimestampFormatter formatter; // timestamps of the text lines
 
 public:
-  // ctor
-  HistoricalDataConnector(HistoricalDataService<T>* _service);
+  // ctor and dtor
+  HistoricalDataConnector(HistoricalDataService<T>* _service, PersistenceWriter* _writer, int _modes, size_t _segmentSize);
+  ~HistoricalDataConnector();
   // Publish-only connector, publish to external source
   void Publish(T& data);
 };
 
+/**
+ * for data from different services, the string representation of these objects is vended out
+ * into positions.txt, risk.txt, executions.txt, allinquiries.txt, streaming.txt,
+ * and the binary records into the columnar stores with the same names
+ */
 template<typename T>
-HistoricalDataConnector<T>::HistoricalDataConnector(HistoricalDataService<T>* _service)
-: service(_service)
+HistoricalDataConnector<T>::HistoricalDataConnector(HistoricalDataService<T>* _service, PersistenceWriter* _writer, int _modes, size_t _segmentSize)
+: service(_service), modes(_modes), channel(nullptr), columnarWriter(nullptr), segmentWriter(nullptr), archiveWriter(nullptr), persistenceWriter(_writer), segmentSyncHook(0)
 {
+  string path = getPersistPath(service->GetServiceType());
+  if (modes & TEXT) {
+    channel = _writer->OpenChannel(path + ".txt");
+  }
+  if (modes & COLUMNAR) {
+    columnarWriter = new ColumnarWriter(HistoricalRecord<T>::type::GetSchema(), path, _writer);
+  }
+  if (modes & SEGMENT) {
+    segmentWriter = new SegmentWriter(HistoricalRecord<T>::type::GetSchema(), path, _segmentSize);
+    if (persistenceWriter->GetFsyncPolicy() != FSYNC_NEVER) {
+      segmentSyncHook = persistenceWriter->AddSyncHook([this]() { segmentWriter->Sync(); });
+    }
+  }
+  if (modes & ARCHIVE) {
+    archiveWriter = new ColumnarWriter(HistoricalRecord<T>::type::GetSchema(), path + ".archive", _writer, 4096, ARCHIVE_BLOCK_SPAN_MS, DELTA_ZLIB_CODEC);
+  }
+}
+
+template<typename T>
+HistoricalDataConnector<T>::~HistoricalDataConnector()
+{
+  delete columnarWriter;
+  if (segmentWriter && persistenceWriter->GetFsyncPolicy() != FSYNC_NEVER) {
+    persistenceWriter->RemoveSyncHook(segmentSyncHook);
+  }
+  delete segmentWriter;
+  delete archiveWriter;
 }
 
 /**
  * Publish data to the Connector
  * call the connector to persist/publish data to an external store (such as KDB database)
- * for data from different services, obtain the string representation of these objects and vend out 
- * into positions.txt, risk.txt, executions.txt, allinquiries.txt, streaming.txt
+ * the data is only formatted here, the persistence writer thread does the file I/O
  */
 template<typename T>
 void HistoricalDataConnector<T>::Publish(T& data)
 {
-  ServiceType type = service->GetServiceType();
-  ofstream outFile;
-  string fileName;
-  switch (type)
-  {
-    case POSITION:
-      fileName = "../res/positions.txt";
-      break;
-    case RISK:
-      fileName = "../res/risk.txt";
-      break;
-    case EXECUTION:
-      fileName = "../res/executions.txt";
-      break;
-    case STREAMING:
-      fileName = "../res/streaming.txt";
-      break;
-    case INQUIRY:
-      fileName = "../res/allinquiries.txt";
-      break;
-    default:
-      break;
+  // the text line and the records share one timestamp
+  int64_t timestamp = getEpochNanos();
+  if (modes & TEXT) {
+    // timestamp and record formatted in place, formatRecord is defined for every persisted type
+    char text[TIMESTAMP_LENGTH + RECORD_TEXT_CAPACITY];
+    size_t length = formatter.Format(timestamp, text);
+    TextWriter writer(text + length, sizeof(text) - length);
+    writer.Append(',');
+    formatRecord(writer, data);
+    writer.Append('\n');
+    channel->Write(text, length + writer.Size());
   }
-  outFile.open(fileName, ios::app);
-  if (outFile.is_open())
-  {
-    // need overloading operator<< for different data types
-    outFile << getTime() << "," << data << endl;
+  if (modes & (COLUMNAR | SEGMENT | ARCHIVE)) {
+    typename HistoricalRecord<T>::type record;
+    record.timestamp = timestamp;
+    toRecord(data, record);
+    if (columnarWriter) columnarWriter->Append(&record);
+    if (segmentWriter) segmentWriter->Append(&record);
+    if (archiveWriter) archiveWriter->Append(&record);
   }
-  outFile.close();
 }
 
 /**
@@ -211,7 +389,7 @@ void HistoricalDataConnector<T>::Publish(T& data)
 * Type T is the data type to persist.
 */
 template<typename T>
-class HistoricalDataServiceListener : public ServiceListener<T>
+class HistoricalDataServiceListener final : public ServiceListener<T>
 {
 private:
   HistoricalDataService<T>* service;
@@ -225,6 +403,7 @@ public:
   void ProcessAdd(PriceStream<Bond>& data);
   void ProcessAdd(ExecutionOrder<Bond>& data);
   void ProcessAdd(Inquiry<Bond>& data);
+  void ProcessAdd(PnL<Bond>& data);
 
   // Listener callback to process a remove event to the Service
   void ProcessRemove(T& data) override;
@@ -242,7 +421,7 @@ HistoricalDataServiceListener<T>::HistoricalDataServiceListener(HistoricalDataSe
  * Historical data service listener subscribes data from position, risk, execution, streaming and inquiry services.
  * ProcessAdd() thus calls PersistData() method to let connector persist/publish data to external data store (such as a KDB database)
  * different services have different keys
- * if the service type is POISITION, RISK, STREAMING, the key is the product identifier
+ * if the service type is POISITION, RISK, STREAMING, PNL, the key is the product identifier
 */
 template<typename T>
 void HistoricalDataServiceListener<T>::ProcessAdd(Position<Bond>& data)
@@ -279,15 +458,24 @@ void HistoricalDataServiceListener<T>::ProcessAdd(Inquiry<Bond>& data)
     service->PersistData(persistKey, data);
 }
 
+template<typename T>
+void HistoricalDataServiceListener<T>::ProcessAdd(PnL<Bond>& data)
+{
+  string persistKey = data.GetProduct().GetProductId();
+  service->PersistData(persistKey, data);
+}
+
 
 template<typename T>
 void HistoricalDataServiceListener<T>::ProcessRemove(T& data)
 {
 }
 
+// updates (e.g. risk moved by a new yield) are persisted like new data
 template<typename T>
 void HistoricalDataServiceListener<T>::ProcessUpdate(T& data)
 {
+  ProcessAdd(data);
 }
 
 #endif
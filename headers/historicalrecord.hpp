@@ -0,0 +1,252 @@
+/**
+ * historicalrecord.hpp
+ * Defines the flat binary records and column schemas of the historical data store.
+ *
+ * @author Boyu Yang
+ */
+#ifndef HISTORICAL_RECORD_HPP
+#define HISTORICAL_RECORD_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+#include "idgenerator.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+// Column types of the historical data store
+// every column is 8 bytes wide except symbols (16 bytes by default, zero padded)
+enum ColumnType { TIMESTAMP_COLUMN, INT64_COLUMN, DOUBLE_COLUMN, PRICE_COLUMN, SYMBOL_COLUMN, ENUM_COLUMN };
+
+// Width of a symbol column (CUSIPs, inquiry ids, books)
+const size_t SYMBOL_SIZE = 16;
+
+// Width of an order id column: a prefix and a generated identifier
+const size_t ORDER_ID_SIZE = ID_CAPACITY;
+
+/**
+ * A column of a record: name, type, byte offset inside the record, the
+ * '|' separated labels of an enum column (e.g. "BID|OFFER") and the width of a symbol column.
+ */
+struct ColumnSchema
+{
+  string name;
+  ColumnType type;
+  size_t offset;
+  string labels;
+  size_t symbolSize = SYMBOL_SIZE;
+
+  // Get the width of the column in bytes
+  size_t GetSize() const { return type == SYMBOL_COLUMN ? symbolSize : sizeof(int64_t); }
+};
+
+/**
+ * Schema of a record type: the column layout of a flat record.
+ * Records are packed in column order, the first column is always the timestamp.
+ */
+struct RecordSchema
+{
+  string name;
+  size_t rowSize;
+  vector<ColumnSchema> columns;
+
+  // Find a column by name, returns -1 if the record has no such column
+  int FindColumn(const string& columnName) const
+  {
+    for (size_t i = 0; i < columns.size(); ++i) {
+      if (columns[i].name == columnName) return static_cast<int>(i);
+    }
+    return -1;
+  }
+};
+
+// copy a string into a fixed width symbol field, returns false (and logs) if the value does not fit,
+// the field then holds the truncated value
+bool copySymbol(char* symbol, string_view value, size_t size = SYMBOL_SIZE)
+{
+  memset(symbol, 0, size);
+  if (value.size() > size) {
+    log(LogLevel::WARNING, "Symbol truncated to " + to_string(size) + " characters: " + string(value));
+    memcpy(symbol, value.data(), size);
+    return false;
+  }
+  memcpy(symbol, value.data(), value.size());
+  return true;
+}
+
+// read a fixed width symbol field back into a string
+string readSymbol(const char* symbol, size_t size = SYMBOL_SIZE)
+{
+  return string(symbol, strnlen(symbol, size));
+}
+
+// Books that get a column in the position records
+const vector<string> historicalBooks = {"TRSY1", "TRSY2", "TRSY3"};
+
+/**
+ * Position snapshot of a product across the books.
+ */
+struct PositionRecord
+{
+  int64_t timestamp;
+  char product[SYMBOL_SIZE];
+  int64_t positions[3];
+  int64_t aggregate;
+
+  static const RecordSchema& GetSchema()
+  {
+    static const RecordSchema schema = {"positions", sizeof(PositionRecord), {
+      {"timestamp", TIMESTAMP_COLUMN, offsetof(PositionRecord, timestamp), ""},
+      {"product", SYMBOL_COLUMN, offsetof(PositionRecord, product), ""},
+      {historicalBooks[0], INT64_COLUMN, offsetof(PositionRecord, positions) + 0 * sizeof(int64_t), ""},
+      {historicalBooks[1], INT64_COLUMN, offsetof(PositionRecord, positions) + 1 * sizeof(int64_t), ""},
+      {historicalBooks[2], INT64_COLUMN, offsetof(PositionRecord, positions) + 2 * sizeof(int64_t), ""},
+      {"aggregate", INT64_COLUMN, offsetof(PositionRecord, aggregate), ""}}};
+    return schema;
+  }
+};
+
+/**
+ * PV01 risk of a product.
+ */
+struct RiskRecord
+{
+  int64_t timestamp;
+  char product[SYMBOL_SIZE];
+  double pv01;
+  int64_t quantity;
+
+  static const RecordSchema& GetSchema()
+  {
+    static const RecordSchema schema = {"risk", sizeof(RiskRecord), {
+      {"timestamp", TIMESTAMP_COLUMN, offsetof(RiskRecord, timestamp), ""},
+      {"product", SYMBOL_COLUMN, offsetof(RiskRecord, product), ""},
+      {"pv01", DOUBLE_COLUMN, offsetof(RiskRecord, pv01), ""},
+      {"quantity", INT64_COLUMN, offsetof(RiskRecord, quantity), ""}}};
+    return schema;
+  }
+};
+
+/**
+ * An execution order sent to a market.
+ */
+struct ExecutionRecord
+{
+  int64_t timestamp;
+  char product[SYMBOL_SIZE];
+  char orderId[ORDER_ID_SIZE];
+  int64_t side;
+  int64_t orderType;
+  double price;
+  int64_t visibleQuantity;
+  int64_t hiddenQuantity;
+  char parentOrderId[ORDER_ID_SIZE];
+  int64_t isChildOrder;
+
+  static const RecordSchema& GetSchema()
+  {
+    static const RecordSchema schema = {"executions", sizeof(ExecutionRecord), {
+      {"timestamp", TIMESTAMP_COLUMN, offsetof(ExecutionRecord, timestamp), ""},
+      {"product", SYMBOL_COLUMN, offsetof(ExecutionRecord, product), ""},
+      {"orderId", SYMBOL_COLUMN, offsetof(ExecutionRecord, orderId), "", ORDER_ID_SIZE},
+      {"side", ENUM_COLUMN, offsetof(ExecutionRecord, side), "Bid|Ask"},
+      {"orderType", ENUM_COLUMN, offsetof(ExecutionRecord, orderType), "FOK|IOC|MARKET|LIMIT|STOP"},
+      {"price", PRICE_COLUMN, offsetof(ExecutionRecord, price), ""},
+      {"visibleQuantity", INT64_COLUMN, offsetof(ExecutionRecord, visibleQuantity), ""},
+      {"hiddenQuantity", INT64_COLUMN, offsetof(ExecutionRecord, hiddenQuantity), ""},
+      {"parentOrderId", SYMBOL_COLUMN, offsetof(ExecutionRecord, parentOrderId), "", ORDER_ID_SIZE},
+      {"isChildOrder", ENUM_COLUMN, offsetof(ExecutionRecord, isChildOrder), "False|True"}}};
+    return schema;
+  }
+};
+
+/**
+ * A two-way price stream.
+ */
+struct StreamRecord
+{
+  int64_t timestamp;
+  char product[SYMBOL_SIZE];
+  double bidPrice;
+  int64_t bidVisibleQuantity;
+  int64_t bidHiddenQuantity;
+  double offerPrice;
+  int64_t offerVisibleQuantity;
+  int64_t offerHiddenQuantity;
+
+  static const RecordSchema& GetSchema()
+  {
+    static const RecordSchema schema = {"streaming", sizeof(StreamRecord), {
+      {"timestamp", TIMESTAMP_COLUMN, offsetof(StreamRecord, timestamp), ""},
+      {"product", SYMBOL_COLUMN, offsetof(StreamRecord, product), ""},
+      {"bidPrice", PRICE_COLUMN, offsetof(StreamRecord, bidPrice), ""},
+      {"bidVisibleQuantity", INT64_COLUMN, offsetof(StreamRecord, bidVisibleQuantity), ""},
+      {"bidHiddenQuantity", INT64_COLUMN, offsetof(StreamRecord, bidHiddenQuantity), ""},
+      {"offerPrice", PRICE_COLUMN, offsetof(StreamRecord, offerPrice), ""},
+      {"offerVisibleQuantity", INT64_COLUMN, offsetof(StreamRecord, offerVisibleQuantity), ""},
+      {"offerHiddenQuantity", INT64_COLUMN, offsetof(StreamRecord, offerHiddenQuantity), ""}}};
+    return schema;
+  }
+};
+
+/**
+ * A customer inquiry.
+ */
+struct InquiryRecord
+{
+  int64_t timestamp;
+  char inquiryId[SYMBOL_SIZE];
+  char product[SYMBOL_SIZE];
+  int64_t side;
+  int64_t quantity;
+  double price;
+  int64_t state;
+
+  static const RecordSchema& GetSchema()
+  {
+    static const RecordSchema schema = {"allinquiries", sizeof(InquiryRecord), {
+      {"timestamp", TIMESTAMP_COLUMN, offsetof(InquiryRecord, timestamp), ""},
+      {"inquiryId", SYMBOL_COLUMN, offsetof(InquiryRecord, inquiryId), ""},
+      {"product", SYMBOL_COLUMN, offsetof(InquiryRecord, product), ""},
+      {"side", ENUM_COLUMN, offsetof(InquiryRecord, side), "BUY|SELL"},
+      {"quantity", INT64_COLUMN, offsetof(InquiryRecord, quantity), ""},
+      {"price", PRICE_COLUMN, offsetof(InquiryRecord, price), ""},
+      {"state", ENUM_COLUMN, offsetof(InquiryRecord, state), "RECEIVED|QUOTED|DONE|REJECTED|CUSTOMER_REJECTED"}}};
+    return schema;
+  }
+};
+
+
+/**
+ * The profit and loss of a product.
+ */
+struct PnLRecord
+{
+  int64_t timestamp;
+  char product[SYMBOL_SIZE];
+  double mark;
+  int64_t position;
+  double realized;
+  double unrealized;
+  double total;
+
+  static const RecordSchema& GetSchema()
+  {
+    static const RecordSchema schema = {"pnl", sizeof(PnLRecord), {
+      {"timestamp", TIMESTAMP_COLUMN, offsetof(PnLRecord, timestamp), ""},
+      {"product", SYMBOL_COLUMN, offsetof(PnLRecord, product), ""},
+      {"mark", PRICE_COLUMN, offsetof(PnLRecord, mark), ""},
+      {"position", INT64_COLUMN, offsetof(PnLRecord, position), ""},
+      {"realized", DOUBLE_COLUMN, offsetof(PnLRecord, realized), ""},
+      {"unrealized", DOUBLE_COLUMN, offsetof(PnLRecord, unrealized), ""},
+      {"total", DOUBLE_COLUMN, offsetof(PnLRecord, total), ""}}};
+    return schema;
+  }
+};
+
+#endif
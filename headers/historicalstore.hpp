@@ -0,0 +1,502 @@
+/**
+ * historicalstore.hpp
+ * Defines the append-only columnar binary store for historical data, with a timestamp index and a query API.
+ *
+ * File layout of a store <name>.col:
+ *   file header, one column descriptor per column, then blocks of up to blockRows records.
+ *   Each block is a block header followed by the columns of its records, one column after the other.
+ * The index <name>.idx holds one entry (time range, offset, row count) per block, so a time range
+ * query only reads the blocks it overlaps.
+ * Blocks are stored raw, or delta encoded and compressed for the archive (see blockcodec.hpp).
+ *
+ * @author Boyu Yang
+ */
+#ifndef HISTORICAL_STORE_HPP
+#define HISTORICAL_STORE_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <stdexcept>
+#include <filesystem>
+#include <chrono>
+#include <limits>
+#include <iomanip>
+#include <ctime>
+
+#include "historicalrecord.hpp"
+#include "blockcodec.hpp"
+#include "persistencewriter.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+// Magic numbers of the columnar store
+const char COLUMNAR_FILE_MAGIC[8] = {'T', 'S', 'C', 'O', 'L', '0', '0', '1'};
+const uint32_t COLUMNAR_BLOCK_MAGIC = 0x314b4c42; // "BLK1"
+
+// Encodings of a block payload
+// RAW_CODEC: the column arrays as they are
+// DELTA_ZLIB_CODEC: delta encoded columns compressed with zlib
+enum BlockCodec { RAW_CODEC, DELTA_ZLIB_CODEC };
+
+// header at the start of a store file
+struct ColumnarFileHeader
+{
+  char magic[8];
+  uint32_t columnCount;
+  uint32_t rowSize;
+};
+
+// column descriptor following the file header
+struct ColumnDescriptor
+{
+  char name[32];
+  uint32_t type;
+  uint32_t size;
+  char labels[64];
+};
+
+// header of a block of records
+struct BlockHeader
+{
+  uint32_t magic;
+  uint32_t codec;
+  uint32_t rowCount;
+  uint32_t encodedSize; // size of the delta encoded columns before compression
+  int64_t minTimestamp;
+  int64_t maxTimestamp;
+  uint64_t payloadSize;
+};
+
+// index entry of a block
+struct BlockIndexEntry
+{
+  int64_t minTimestamp;
+  int64_t maxTimestamp;
+  uint64_t offset;
+  uint64_t rowCount;
+};
+
+// get the time in nanoseconds since epoch from the TSC clock
+int64_t getEpochNanos()
+{
+  return tscClock.Now();
+}
+
+// change nanoseconds since epoch to the millisecond time format (e.g. 2023-12-23 22:42:44.260)
+string getTime(int64_t epochNanos)
+{
+  return getTime(std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(epochNanos))));
+}
+
+// parse a local time (e.g. 2023-12-23 22:42:44.260, milliseconds optional) or raw nanoseconds since epoch
+int64_t parseTime(const string& time)
+{
+  if (time.find_first_not_of("0123456789-") == string::npos) {
+    return stoll(time);
+  }
+  std::tm tm = {};
+  istringstream ss(time);
+  ss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
+  if (ss.fail()) {
+    throw std::invalid_argument("Invalid time: " + time);
+  }
+  tm.tm_isdst = -1;
+  int64_t millis = 0;
+  if (ss.peek() == '.') {
+    ss.get();
+    string fraction;
+    ss >> fraction;
+    fraction = (fraction + "000").substr(0, 3);
+    millis = stoll(fraction);
+  }
+  return (static_cast<int64_t>(mktime(&tm)) * 1000 + millis) * 1000000;
+}
+
+/**
+ * Columnar Writer appending records of one schema to a store.
+ * Records are buffered row-wise and transposed into columns when a block is flushed.
+ * Both the store and its index are written through persistence channels, so the writer never does file I/O itself.
+ * The index channel is ordered after the data channel, so an index entry reaches its file after its block.
+ */
+class ColumnarWriter
+{
+private:
+  const RecordSchema& schema; // record layout
+  PersistenceChannel* dataChannel; // channel to <name>.col
+  PersistenceChannel* indexChannel; // channel to <name>.idx
+  size_t blockRows; // maximum number of records per block
+  int64_t maxBlockSpan; // maximum time span of a block in nanoseconds
+  vector<char> rows; // buffered records of the current block
+  size_t rowCount; // number of buffered records
+  int64_t minTimestamp; // time range of the current block
+  int64_t maxTimestamp;
+  uint64_t offset; // file offset of the next block
+  BlockCodec codec; // encoding of the blocks
+  ArchiveCodec archiveCodec; // encoder of compressed blocks
+  vector<char> columns; // reusable column buffer of compressed blocks
+  vector<char> block; // reusable block buffer
+
+public:
+  // ctor: open the store and write its header if the store is new
+  ColumnarWriter(const RecordSchema& _schema, const string& basePath, PersistenceWriter* writer, size_t _blockRows = 4096, long blockSpanMs = 1000, BlockCodec _codec = RAW_CODEC);
+  // dtor: flush the current block
+  ~ColumnarWriter();
+
+  // Append a record laid out according to the schema
+  void Append(const void* record);
+
+  // Write the buffered records as a block
+  void Flush();
+
+  // Get the schema
+  const RecordSchema& GetSchema() const;
+
+};
+
+ColumnarWriter::ColumnarWriter(const RecordSchema& _schema, const string& basePath, PersistenceWriter* writer, size_t _blockRows, long blockSpanMs, BlockCodec _codec)
+: schema(_schema), blockRows(_blockRows), maxBlockSpan(blockSpanMs * 1000000LL), rows(_blockRows * _schema.rowSize), rowCount(0), minTimestamp(0), maxTimestamp(0), offset(0), codec(_codec)
+{
+  string dataFile = basePath + ".col";
+  // appending to an existing store continues after its last block
+  if (filesystem::exists(dataFile)) {
+    offset = filesystem::file_size(dataFile);
+  }
+  dataChannel = writer->OpenChannel(dataFile);
+  indexChannel = writer->OpenChannel(basePath + ".idx", dataChannel);
+  if (offset == 0) {
+    ColumnarFileHeader header;
+    memcpy(header.magic, COLUMNAR_FILE_MAGIC, sizeof(header.magic));
+    header.columnCount = schema.columns.size();
+    header.rowSize = schema.rowSize;
+    dataChannel->Write(reinterpret_cast<const char*>(&header), sizeof(header));
+    offset += sizeof(header);
+    for (auto& column : schema.columns) {
+      ColumnDescriptor descriptor;
+      memset(&descriptor, 0, sizeof(descriptor));
+      strncpy(descriptor.name, column.name.c_str(), sizeof(descriptor.name) - 1);
+      descriptor.type = column.type;
+      descriptor.size = column.GetSize();
+      strncpy(descriptor.labels, column.labels.c_str(), sizeof(descriptor.labels) - 1);
+      dataChannel->Write(reinterpret_cast<const char*>(&descriptor), sizeof(descriptor));
+      offset += sizeof(descriptor);
+    }
+  }
+}
+
+ColumnarWriter::~ColumnarWriter()
+{
+  Flush();
+}
+
+void ColumnarWriter::Append(const void* record)
+{
+  int64_t timestamp = *reinterpret_cast<const int64_t*>(record);
+  // blocks also close after a time span, so that readers see data of a quiet feed
+  if (rowCount > 0 && timestamp - minTimestamp >= maxBlockSpan) {
+    Flush();
+  }
+  memcpy(rows.data() + rowCount * schema.rowSize, record, schema.rowSize);
+  if (rowCount == 0) {
+    minTimestamp = timestamp;
+    maxTimestamp = timestamp;
+  }
+  minTimestamp = min(minTimestamp, timestamp);
+  maxTimestamp = max(maxTimestamp, timestamp);
+  if (++rowCount == blockRows) {
+    Flush();
+  }
+}
+
+void ColumnarWriter::Flush()
+{
+  if (rowCount == 0) return;
+
+  // transpose the buffered rows into columns, in place for raw blocks
+  size_t columnSize = rowCount * schema.rowSize;
+  char* out;
+  if (codec == RAW_CODEC) {
+    block.resize(sizeof(BlockHeader) + columnSize);
+    out = block.data() + sizeof(BlockHeader);
+  }
+  else {
+    columns.resize(columnSize);
+    out = columns.data();
+  }
+  for (auto& column : schema.columns) {
+    size_t size = column.GetSize();
+    for (size_t i = 0; i < rowCount; ++i) {
+      memcpy(out, rows.data() + i * schema.rowSize + column.offset, size);
+      out += size;
+    }
+  }
+  size_t encodedSize = 0;
+  if (codec == DELTA_ZLIB_CODEC) {
+    block.resize(sizeof(BlockHeader));
+    encodedSize = archiveCodec.Encode(schema, columns.data(), rowCount, block);
+  }
+  uint64_t payloadSize = block.size() - sizeof(BlockHeader);
+  BlockHeader header = {COLUMNAR_BLOCK_MAGIC, static_cast<uint32_t>(codec), static_cast<uint32_t>(rowCount), static_cast<uint32_t>(encodedSize), minTimestamp, maxTimestamp, payloadSize};
+  memcpy(block.data(), &header, sizeof(header));
+  dataChannel->Write(block.data(), block.size());
+
+  // the writer thread writes the index entry once the block before it is written
+  BlockIndexEntry entry = {minTimestamp, maxTimestamp, offset, rowCount};
+  indexChannel->Write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+
+  offset += block.size();
+  rowCount = 0;
+}
+
+const RecordSchema& ColumnarWriter::GetSchema() const
+{
+  return schema;
+}
+
+/**
+ * Columnar Reader querying a store by product and time range.
+ * The schema is read from the store itself, rows are returned packed in column order,
+ * which is the layout of the record structs in historicalrecord.hpp.
+ */
+class ColumnarReader
+{
+private:
+  string dataFile; // path of <name>.col
+  string indexFile; // path of <name>.idx
+  RecordSchema schema; // schema read from the file header
+  uint64_t dataOffset; // offset of the first block
+  vector<BlockIndexEntry> index; // block index
+  mutable ArchiveCodec archiveCodec; // decoder of compressed blocks
+
+  // decode a block payload into column arrays
+  void DecodeBlock(const BlockHeader& header, const vector<char>& payload, vector<char>& columns) const;
+
+public:
+  // ctor: read the header and the block index of a store (path without extension)
+  ColumnarReader(const string& basePath);
+
+  // Get the schema of the store
+  const RecordSchema& GetSchema() const;
+
+  // Get the block index
+  const vector<BlockIndexEntry>& GetIndex() const;
+
+  // Reload the block index to see blocks appended since the last load
+  void LoadIndex();
+
+  // Query records of a product (empty for all products) with from <= timestamp <= to, returns the number of records
+  size_t Query(const string& productId, int64_t from, int64_t to, const function<void(const char* row)>& callback) const;
+
+  // Query records into typed rows
+  template<typename R>
+  vector<R> Query(const string& productId, int64_t from = numeric_limits<int64_t>::min(), int64_t to = numeric_limits<int64_t>::max()) const;
+
+};
+
+ColumnarReader::ColumnarReader(const string& basePath)
+: dataFile(basePath + ".col"), indexFile(basePath + ".idx"), dataOffset(0)
+{
+  ifstream in(dataFile, ios::binary);
+  if (!in.is_open()) {
+    throw std::invalid_argument("No such historical store: " + dataFile);
+  }
+  ColumnarFileHeader header;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!in || memcmp(header.magic, COLUMNAR_FILE_MAGIC, sizeof(header.magic)) != 0) {
+    throw std::invalid_argument("Not a historical store: " + dataFile);
+  }
+  schema.name = filesystem::path(basePath).filename().string();
+  schema.rowSize = header.rowSize;
+  size_t offset = 0;
+  for (uint32_t i = 0; i < header.columnCount; ++i) {
+    ColumnDescriptor descriptor;
+    in.read(reinterpret_cast<char*>(&descriptor), sizeof(descriptor));
+    ColumnSchema column = {string(descriptor.name, strnlen(descriptor.name, sizeof(descriptor.name))), static_cast<ColumnType>(descriptor.type), offset, string(descriptor.labels, strnlen(descriptor.labels, sizeof(descriptor.labels))), descriptor.size};
+    schema.columns.push_back(column);
+    offset += descriptor.size;
+  }
+  dataOffset = sizeof(header) + header.columnCount * sizeof(ColumnDescriptor);
+  LoadIndex();
+}
+
+const RecordSchema& ColumnarReader::GetSchema() const
+{
+  return schema;
+}
+
+const vector<BlockIndexEntry>& ColumnarReader::GetIndex() const
+{
+  return index;
+}
+
+void ColumnarReader::LoadIndex()
+{
+  index.clear();
+  // entries past the end of the data file belong to blocks that are not written yet (or lost in a crash)
+  error_code ec;
+  uint64_t dataSize = filesystem::file_size(dataFile, ec);
+  if (ec) dataSize = 0;
+  ifstream in(indexFile, ios::binary);
+  BlockIndexEntry entry;
+  while (in.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+    if (entry.offset + sizeof(BlockHeader) > dataSize) break;
+    index.push_back(entry);
+  }
+  if (!index.empty()) return;
+
+  // no index (e.g. deleted), rebuild it by walking the complete blocks
+  ifstream data(dataFile, ios::binary);
+  uint64_t offset = dataOffset;
+  BlockHeader header;
+  data.seekg(offset);
+  while (data.read(reinterpret_cast<char*>(&header), sizeof(header)) && header.magic == COLUMNAR_BLOCK_MAGIC && offset + sizeof(header) + header.payloadSize <= dataSize) {
+    index.push_back({header.minTimestamp, header.maxTimestamp, offset, header.rowCount});
+    offset += sizeof(header) + header.payloadSize;
+    data.seekg(offset);
+  }
+}
+
+void ColumnarReader::DecodeBlock(const BlockHeader& header, const vector<char>& payload, vector<char>& columns) const
+{
+  switch (header.codec)
+  {
+    case RAW_CODEC:
+      columns = payload;
+      break;
+    case DELTA_ZLIB_CODEC:
+      archiveCodec.Decode(schema, payload.data(), payload.size(), header.encodedSize, header.rowCount, columns);
+      break;
+    default:
+      throw std::invalid_argument("Unknown block codec in " + dataFile);
+  }
+}
+
+size_t ColumnarReader::Query(const string& productId, int64_t from, int64_t to, const function<void(const char* row)>& callback) const
+{
+  int productColumn = schema.FindColumn("product");
+  char product[SYMBOL_SIZE];
+  copySymbol(product, productId);
+
+  ifstream in(dataFile, ios::binary);
+  error_code ec;
+  uint64_t dataSize = filesystem::file_size(dataFile, ec);
+  if (ec) dataSize = 0;
+  vector<char> payload, columns, row(schema.rowSize);
+  vector<const char*> columnData(schema.columns.size());
+  size_t count = 0;
+  for (auto& entry : index) {
+    // skip blocks outside the time range without reading them
+    if (entry.maxTimestamp < from || entry.minTimestamp > to) continue;
+    BlockHeader header;
+    in.seekg(entry.offset);
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || header.magic != COLUMNAR_BLOCK_MAGIC) {
+      log(LogLevel::ERROR, "Corrupted block in " + dataFile);
+      break;
+    }
+    // a block still being written is skipped, it is read by the next query
+    if (entry.offset + sizeof(header) + header.payloadSize > dataSize) continue;
+    payload.resize(header.payloadSize);
+    if (!in.read(payload.data(), payload.size())) {
+      in.clear();
+      continue;
+    }
+    DecodeBlock(header, payload, columns);
+
+    // locate the columns of the block
+    const char* p = columns.data();
+    for (size_t c = 0; c < schema.columns.size(); ++c) {
+      columnData[c] = p;
+      p += header.rowCount * schema.columns[c].GetSize();
+    }
+    const int64_t* timestamps = reinterpret_cast<const int64_t*>(columnData[0]);
+    for (size_t i = 0; i < header.rowCount; ++i) {
+      if (timestamps[i] < from || timestamps[i] > to) continue;
+      if (!productId.empty() && productColumn >= 0 && memcmp(columnData[productColumn] + i * SYMBOL_SIZE, product, SYMBOL_SIZE) != 0) continue;
+      // gather the row
+      for (size_t c = 0; c < schema.columns.size(); ++c) {
+        size_t size = schema.columns[c].GetSize();
+        memcpy(row.data() + schema.columns[c].offset, columnData[c] + i * size, size);
+      }
+      callback(row.data());
+      ++count;
+    }
+  }
+  return count;
+}
+
+template<typename R>
+vector<R> ColumnarReader::Query(const string& productId, int64_t from, int64_t to) const
+{
+  if (sizeof(R) != schema.rowSize) {
+    throw std::invalid_argument("Record type does not match the store " + dataFile);
+  }
+  vector<R> records;
+  Query(productId, from, to, [&records](const char* row) {
+    R record;
+    memcpy(&record, row, sizeof(R));
+    records.push_back(record);
+  });
+  return records;
+}
+
+// write the column names of a schema as a CSV header line
+void writeCsvHeader(ostream& os, const RecordSchema& schema)
+{
+  for (size_t c = 0; c < schema.columns.size(); ++c) {
+    os << (c == 0 ? "" : ",") << schema.columns[c].name;
+  }
+  os << "\n";
+}
+
+// write a row as a CSV line, in the same notation as the text outputs
+void writeCsvRow(ostream& os, const RecordSchema& schema, const char* row)
+{
+  for (size_t c = 0; c < schema.columns.size(); ++c) {
+    const ColumnSchema& column = schema.columns[c];
+    const char* field = row + column.offset;
+    int64_t intValue;
+    double doubleValue;
+    memcpy(&intValue, field, sizeof(intValue));
+    memcpy(&doubleValue, field, sizeof(doubleValue));
+    if (c > 0) os << ",";
+    switch (column.type)
+    {
+      case TIMESTAMP_COLUMN:
+        os << getTime(intValue);
+        break;
+      case INT64_COLUMN:
+        os << intValue;
+        break;
+      case DOUBLE_COLUMN:
+        os << to_string(doubleValue);
+        break;
+      case PRICE_COLUMN:
+        os << convertPrice(doubleValue);
+        break;
+      case SYMBOL_COLUMN:
+        os << readSymbol(field, column.GetSize());
+        break;
+      case ENUM_COLUMN:
+      {
+        // pick the label of the enum value
+        stringstream labels(column.labels);
+        string label, name = to_string(intValue);
+        for (int64_t i = 0; getline(labels, label, '|'); ++i) {
+          if (i == intValue) {
+            name = label;
+            break;
+          }
+        }
+        os << name;
+        break;
+      }
+    }
+  }
+  os << "\n";
+}
+
+#endif
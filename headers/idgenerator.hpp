@@ -0,0 +1,154 @@
+/**
+ * idgenerator.hpp
+ * Defines the generator of the order identifiers of the system.
+ *
+ * An identifier is a caller prefix followed by three fixed-width base36 fields:
+ *   session (6 characters): seconds since 2020-01-01 when the process started
+ *   thread (3 characters): slot of the generating thread, taken once per thread, at most 36^3 threads
+ *   sequence (7 characters): counter of the generating thread
+ * so identifiers never repeat within a run or across runs started at different seconds, and the
+ * identifiers of one thread sort in generation order. Generating one touches only state of the calling
+ * thread and writes into an inline buffer, without allocation.
+ *
+ * @author Boyu Yang
+ */
+#ifndef ID_GENERATOR_HPP
+#define ID_GENERATOR_HPP
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <stdexcept>
+
+using namespace std;
+
+// Widths of the base36 fields of an identifier
+const size_t ID_SESSION_WIDTH = 6;
+const size_t ID_THREAD_WIDTH = 3;
+const size_t ID_SEQUENCE_WIDTH = 7;
+const size_t ID_LENGTH = ID_SESSION_WIDTH + ID_THREAD_WIDTH + ID_SEQUENCE_WIDTH;
+
+// Capacity of an identifier with its prefix
+const size_t ID_CAPACITY = 32;
+
+// Start of the session clock (2020-01-01 00:00:00 UTC)
+const int64_t ID_EPOCH_SECONDS = 1577836800;
+
+// Digits of the base36 encoding, in sort order
+const char ID_DIGITS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+// Thread slots of a process, the slot field would wrap after them and repeat identifiers
+const uint32_t ID_THREAD_SLOTS = 36 * 36 * 36;
+
+// write a value in base36 into a fixed width field, most significant digit first
+inline void encodeBase36(uint64_t value, char* field, size_t width)
+{
+  for (size_t i = width; i > 0; --i) {
+    field[i - 1] = ID_DIGITS[value % 36];
+    value /= 36;
+  }
+}
+
+/**
+ * A generated identifier kept in an inline buffer.
+ */
+struct IdText
+{
+  char data[ID_CAPACITY];
+  uint32_t length;
+
+  // Get the text
+  string_view View() const { return string_view(data, length); }
+
+  // Get the text as a string
+  string ToString() const { return string(data, length); }
+};
+
+/**
+ * Identifier Generator: one session prefix per process and one sequence per thread.
+ */
+class IdGenerator
+{
+private:
+  char session[ID_SESSION_WIDTH]; // encoded session
+  atomic<uint32_t> threadCount; // slots given to threads
+
+  // state of the calling thread
+  struct ThreadState
+  {
+    char thread[ID_THREAD_WIDTH]; // encoded slot
+    uint64_t sequence; // identifiers generated by the thread
+  };
+
+  // ctor: the session is the start time of the process
+  IdGenerator();
+
+  // get the state of the calling thread, a slot is taken on the first identifier, throws when the slots run out
+  ThreadState& GetThreadState();
+
+public:
+  // Get the generator of the process
+  static IdGenerator& Instance();
+
+  // Generate the next identifier of the calling thread behind a prefix
+  IdText Next(string_view prefix = "");
+
+};
+
+IdGenerator::IdGenerator()
+: threadCount(0)
+{
+  int64_t seconds = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+  encodeBase36(static_cast<uint64_t>(seconds - ID_EPOCH_SECONDS), session, ID_SESSION_WIDTH);
+}
+
+IdGenerator& IdGenerator::Instance()
+{
+  static IdGenerator generator;
+  return generator;
+}
+
+IdGenerator::ThreadState& IdGenerator::GetThreadState()
+{
+  thread_local ThreadState state = [this]() {
+    ThreadState initial;
+    uint32_t slot = threadCount.fetch_add(1, memory_order_relaxed);
+    if (slot >= ID_THREAD_SLOTS) {
+      throw std::runtime_error("Identifier thread slots exhausted after " + to_string(ID_THREAD_SLOTS) + " threads");
+    }
+    encodeBase36(slot, initial.thread, ID_THREAD_WIDTH);
+    initial.sequence = 0;
+    return initial;
+  }();
+  return state;
+}
+
+IdText IdGenerator::Next(string_view prefix)
+{
+  if (prefix.size() + ID_LENGTH > ID_CAPACITY) {
+    throw std::invalid_argument("Identifier prefix too long: " + string(prefix));
+  }
+  ThreadState& state = GetThreadState();
+  IdText id;
+  char* cursor = id.data;
+  memcpy(cursor, prefix.data(), prefix.size());
+  cursor += prefix.size();
+  memcpy(cursor, session, ID_SESSION_WIDTH);
+  cursor += ID_SESSION_WIDTH;
+  memcpy(cursor, state.thread, ID_THREAD_WIDTH);
+  cursor += ID_THREAD_WIDTH;
+  encodeBase36(++state.sequence, cursor, ID_SEQUENCE_WIDTH);
+  id.length = prefix.size() + ID_LENGTH;
+  return id;
+}
+
+// Generate a unique identifier behind a prefix
+IdText GenerateId(string_view prefix = "")
+{
+  return IdGenerator::Instance().Next(prefix);
+}
+
+#endif
@@ -8,8 +8,12 @@
 #define INQUIRY_SERVICE_HPP
 
 #include "soa.hpp"
+#include "arena.hpp"
+#include "productregistry.hpp"
 #include "utils.hpp"
+#include "servercontext.hpp"
 #include "tradebookingservice.hpp"
+#include "recordformat.hpp"
 
 // Various inqyury states
 enum InquiryState { RECEIVED, QUOTED, DONE, REJECTED, CUSTOMER_REJECTED };
@@ -26,10 +30,10 @@ public:
 
   // ctor for an inquiry
   Inquiry() = default;
-  Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state);
+  Inquiry(string_view _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state);
 
   // Get the inquiry ID
-  const string& GetInquiryId() const;
+  const InquiryId& GetInquiryId() const;
 
   // Get the product
   const T& GetProduct() const;
@@ -57,7 +61,7 @@ public:
   friend ostream& operator<<(ostream& os, const Inquiry<U>& inquiry);
 
 private:
-  string inquiryId;
+  InquiryId inquiryId;
   T product;
   Side side;
   long quantity;
@@ -68,10 +72,9 @@ private:
 
 
 template<typename T>
-Inquiry<T>::Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state) :
-  product(_product)
+Inquiry<T>::Inquiry(string_view _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state) :
+  inquiryId(_inquiryId), product(_product)
 {
-  inquiryId = _inquiryId;
   side = _side;
   quantity = _quantity;
   price = _price;
@@ -79,7 +82,7 @@ Inquiry<T>::Inquiry(string _inquiryId, const T &_product, Side _side, long _quan
 }
 
 template<typename T>
-const string& Inquiry<T>::GetInquiryId() const
+const InquiryId& Inquiry<T>::GetInquiryId() const
 {
   return inquiryId;
 }
@@ -126,55 +129,31 @@ void Inquiry<T>::SetState(InquiryState _state)
   state = _state;
 }
 
-template<typename T>
-ostream& operator<<(ostream& os, const Inquiry<T>& inquiry)
+// name of an inquiry state
+const char* inquiryStateName(InquiryState state)
 {
-  string _inquiryId = inquiry.GetInquiryId();
-  T product = inquiry.GetProduct();
-  string _product = product.GetProductId();
-  Side side = inquiry.GetSide();
-  string _side;
-  switch (side)
-  {
-  case BID:
-    _side = "BID";
-    break;
-  case OFFER:
-    _side = "OFFER";
-    break;
-  }
-  long _quantity = inquiry.GetQuantity();
-  double _price = inquiry.GetPrice();
-  string _state;
-  switch (inquiry.GetState())
-  {
-  case RECEIVED:
-    _state = "RECEIVED";
-    break;
-  case QUOTED:
-    _state = "QUOTED";
-    break;
-  case DONE:
-    _state = "DONE";
-    break;
-  case REJECTED:
-    _state = "REJECTED";
-    break;
-  case CUSTOMER_REJECTED:
-    _state = "CUSTOMER_REJECTED";
-    break;
+  switch (state) {
+    case RECEIVED: return "RECEIVED";
+    case QUOTED: return "QUOTED";
+    case DONE: return "DONE";
+    case REJECTED: return "REJECTED";
+    case CUSTOMER_REJECTED: return "CUSTOMER_REJECTED";
   }
+  return "";
+}
+
+// format the fields of an inquiry
+template<typename T>
+void formatRecord(TextWriter& writer, const Inquiry<T>& inquiry)
+{
+  writeFields(writer, inquiry.GetInquiryId(), inquiry.GetProduct().GetProductId(), inquiry.GetSide() == BUY ? "BID" : "OFFER",
+    inquiry.GetQuantity(), PriceField{inquiry.GetPrice()}, inquiryStateName(inquiry.GetState()));
+}
 
-  vector<string> _strings;
-  _strings.push_back(_inquiryId);
-  _strings.push_back(_product);
-  _strings.push_back(_side);
-  _strings.push_back(to_string(_quantity));
-  _strings.push_back(convertPrice(_price));
-  _strings.push_back(_state);
-  string _str = join(_strings, ",");
-  os << _str;
-  return os;
+template<typename T>
+ostream& operator<<(ostream& os, const Inquiry<T>& inquiry)
+{
+  return writeRecord(os, inquiry);
 }
 
 // forward declaration of InquiryDataConnector
@@ -190,7 +169,7 @@ template<typename T>
 class InquiryService : public Service<string,Inquiry <T> >
 {
 private:
-  map<string, Inquiry<T>> inquiryMap;
+  PooledMap<InquiryId, Inquiry<T>> inquiryMap;
   vector<ServiceListener<Inquiry<T>>*> listeners;
   InquiryDataConnector<T>* connector;
   string host; // host name for inbound connector
@@ -198,7 +177,7 @@ private:
 
 public:
   // ctor and dtor
-  InquiryService(const string& _host, const string& _port);
+  InquiryService(const Strand& _strand, const string& _host, const string& _port);
   ~InquiryService()=default;
 
   // Get data on our service given a key
@@ -225,23 +204,23 @@ public:
 };
 
 template<typename T>
-InquiryService<T>::InquiryService(const string& _host, const string& _port)
+InquiryService<T>::InquiryService(const Strand& _strand, const string& _host, const string& _port)
 : host(_host), port(_port)
 {
-  connector = new InquiryDataConnector<T>(this, host, port);
+  connector = new InquiryDataConnector<T>(this, _strand, host, port);
 }
 
 template<typename T>
 Inquiry<T>& InquiryService<T>::GetData(string key)
 {
-  return inquiryMap[key];
+  return inquiryMap[InquiryId(key)];
 }
 
 template<typename T>
 void InquiryService<T>::OnMessage(Inquiry<T> &data)
 {
   InquiryState state = data.GetState();
-  string inquiryId = data.GetInquiryId();
+  const InquiryId& inquiryId = data.GetInquiryId();
   switch (state){
     case RECEIVED:
       // if inquiry is received, send back a quote to the connector via publish()
@@ -252,7 +231,7 @@ void InquiryService<T>::OnMessage(Inquiry<T> &data)
       data.SetState(DONE);
       // store the inquiry
       if (inquiryMap.find(inquiryId) != inquiryMap.end()) {inquiryMap.erase(inquiryId);}
-      inquiryMap.insert(pair<string, Inquiry<T> > (inquiryId, data));
+      inquiryMap.insert(pair<InquiryId, Inquiry<T> > (inquiryId, data));
       // notify listeners
       for (auto& listener : listeners)
       {
@@ -304,7 +283,7 @@ template<typename T>
 void InquiryService<T>::SendQuote(const string &inquiryId, double price)
 {
   // get the inquiry
-  Inquiry<T>& inquiry = inquiryMap[inquiryId];
+  Inquiry<T>& inquiry = inquiryMap[InquiryId(inquiryId)];
   // update the inquiry
   inquiry.SetPrice(price);
   // notify listeners
@@ -318,7 +297,7 @@ template<typename T>
 void InquiryService<T>::RejectInquiry(const string &inquiryId)
 {
   // get the inquiry
-  Inquiry<T>& inquiry = inquiryMap[inquiryId];
+  Inquiry<T>& inquiry = inquiryMap[InquiryId(inquiryId)];
   // update the inquiry
   inquiry.SetState(REJECTED);
 }
@@ -334,16 +313,16 @@ private:
   InquiryService<T>* service;
   string host; // host name
   string port; // port number
-  boost::asio::io_service io_service; // io service
-  boost::asio::ip::tcp::socket socket; // socket
+  Strand strand; // strand serializing the handlers of this feed
+  boost::asio::ip::tcp::acceptor acceptor; // acceptor listening on host:port
 
   void handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request);
-  void start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service);
+  void start_accept();
 
 public:
   // ctor
-  InquiryDataConnector(InquiryService<T>* _service, const string& _host, const string& _port);
-  // dtor: close the socket
+  InquiryDataConnector(InquiryService<T>* _service, const Strand& _strand, const string& _host, const string& _port);
+  // dtor: close the acceptor
   ~InquiryDataConnector();
 
   // Publish data to the Connector
@@ -358,67 +337,63 @@ public:
 };
 
 template<typename T>
-InquiryDataConnector<T>::InquiryDataConnector(InquiryService<T>* _service, const string& _host, const string& _port)
-: service(_service), host(_host), port(_port), socket(io_service)
+InquiryDataConnector<T>::InquiryDataConnector(InquiryService<T>* _service, const Strand& _strand, const string& _host, const string& _port)
+: service(_service), host(_host), port(_port), strand(_strand), acceptor(_strand)
 {
 }
 
 template<typename T>
 InquiryDataConnector<T>::~InquiryDataConnector()
 {
-    socket.close();
+  acceptor.close();
 }
 
 template<typename T>
-void InquiryDataConnector<T>::start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service) {
-  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(*io_service);
-  acceptor->async_accept(*socket, [this, socket, acceptor, io_service](const boost::system::error_code& ec) {
+void InquiryDataConnector<T>::start_accept() {
+  // sockets live on the feed's strand, so all handlers of a connection run in order
+  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(strand);
+  acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      delete socket; // acceptor closed, stop accepting
+      return;
+    }
     if (!ec) {
       boost::asio::streambuf* request = new boost::asio::streambuf;
       boost::asio::async_read_until(*socket, *request, "\n", std::bind(&InquiryDataConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
+    } else {
+      delete socket;
     }
-    start_accept(acceptor, io_service); // accept the next connection
+    start_accept(); // accept the next connection
   });
 }
 
 template<typename T>
 void InquiryDataConnector<T>::handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request) {
   if (!ec) {
-    std::string data = std::string(boost::asio::buffers_begin(request->data()), boost::asio::buffers_end(request->data()));
-    // find the last newline
-    std::size_t last_newline = data.rfind('\n');
-    if (last_newline != std::string::npos) {
-      // consume only up to the last newline
-      request->consume(last_newline + 1);
-      // only process the data up to the last newline
-      data = data.substr(0, last_newline);
-    } else {
-      // if there's no newline, don't process any data
-      data.clear();
-    }
-
-    // split the data into lines
-    std::stringstream ss(data);
-    std::string line;
-    while (std::getline(ss, line)) {
+    // parse the complete lines in place, the fields view the buffer until it is consumed
+    string_view data(static_cast<const char*>(request->data().data()), request->size());
+    ArenaScope scope(threadArena());
+    ArenaVector<string_view> tokens{ArenaAllocator<string_view>(threadArena())};
+    size_t parsed = forEachLine(data, [&](string_view line) {
       // parse the line
-      vector<string> tokens;
-      stringstream lineStream(line);
-      string token;
-      while(getline(lineStream, token, ','))
-        tokens.push_back(token);
+      splitFields(line, tokens);
+      // identifiers must fit their inline strings, a bad line is logged and skipped
+      if (tokens.size() < 6 || tokens[0].size() > InquiryId::CAPACITY || tokens[1].size() > ProductId::CAPACITY) {
+        LOG_ASYNC(LogLevel::WARNING, "Skipping invalid inquiry line: {}", line);
+        return;
+      }
 
       // create inquiry
-      string inquiryId = tokens[0];
-      string productId = tokens[1];
-      T product = getProductObject<T>(productId);
+      const T& product = lookupProduct<T>(tokens[1]);
       Side side = tokens[2] == "BUY" ? BUY : SELL;
-      long quantity = stol(tokens[3]);
+      long quantity = parseInteger(tokens[3]);
       double price = convertPrice(tokens[4]);
       InquiryState state = tokens[5] == "RECEIVED" ? RECEIVED : tokens[5] == "QUOTED" ? QUOTED : tokens[5] == "DONE" ? DONE : tokens[5] == "REJECTED" ? REJECTED : CUSTOMER_REJECTED;
-      Inquiry<T> inquiry(inquiryId, product, side, quantity, price, state);
+      Inquiry<T> inquiry(tokens[0], product, side, quantity, price, state);
       service->OnMessage(inquiry);
-    }
+    });
+    // only the complete lines are consumed
+    request->consume(parsed);
 
     boost::asio::async_read_until(*socket, *request, "\n", std::bind(&InquiryDataConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
   } else {
@@ -442,17 +417,19 @@ void InquiryDataConnector<T>::Subscribe()
 {
   log(LogLevel::NOTE, "Inquiry data server listening on " + host + ":" + port);
   try {
-  // connect to the socket
-  boost::asio::ip::tcp::resolver resolver(io_service);
-  boost::asio::ip::tcp::resolver::query query(host, port);
-  boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-  boost::asio::ip::tcp::acceptor acceptor(io_service, endpoint);
-  start_accept(&acceptor, &io_service);
-  io_service.run();
+  // bind the acceptor on the shared server context, the worker pool runs the handlers
+  boost::asio::ip::tcp::resolver resolver(strand);
+  boost::asio::ip::tcp::endpoint endpoint = resolver.resolve(host, port)->endpoint();
+  acceptor.open(endpoint.protocol());
+  acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  acceptor.bind(endpoint);
+  acceptor.listen();
+  start_accept();
   }
   catch (std::exception& e){
     // throw error log
     log(LogLevel::ERROR, e.what());
+    acceptor.close();
     return;
   }
 }
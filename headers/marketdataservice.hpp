@@ -17,7 +17,10 @@
 #include <boost/asio.hpp>
 
 #include "soa.hpp"
+#include "arena.hpp"
+#include "productregistry.hpp"
 #include "utils.hpp"
+#include "servercontext.hpp"
 
 using namespace std;
 
@@ -136,9 +139,11 @@ public:
 
   // Get the bid stack
   vector<Order>& GetBidStack();
+  const vector<Order>& GetBidStack() const;
 
   // Get the offer stack
   vector<Order>& GetOfferStack();
+  const vector<Order>& GetOfferStack() const;
 
   // Get the best bid/offer order
   BidOffer GetBestBidOffer() const;
@@ -176,12 +181,24 @@ vector<Order>& OrderBook<T>::GetBidStack()
   return bidStack;
 }
 
+template<typename T>
+const vector<Order>& OrderBook<T>::GetBidStack() const
+{
+  return bidStack;
+}
+
 template<typename T>
 vector<Order>& OrderBook<T>::GetOfferStack()
 {
   return offerStack;
 }
 
+template<typename T>
+const vector<Order>& OrderBook<T>::GetOfferStack() const
+{
+  return offerStack;
+}
+
 template<typename T>
 BidOffer OrderBook<T>::GetBestBidOffer() const
 {
@@ -192,6 +209,24 @@ BidOffer OrderBook<T>::GetBestBidOffer() const
   
 }
 
+// aggregate the orders of a stack at the same price in place, sorted from the best price
+void aggregateStack(vector<Order>& stack, PricingSide side)
+{
+  sort(stack.begin(), stack.end(), [side](const Order& a, const Order& b) {
+    return side == BID ? a.GetPrice() > b.GetPrice() : a.GetPrice() < b.GetPrice();
+  });
+  size_t levels = 0;
+  for (size_t i = 0; i < stack.size(); ++i) {
+    if (levels > 0 && stack[levels - 1].GetPrice() == stack[i].GetPrice()) {
+      stack[levels - 1] = Order(stack[i].GetPrice(), stack[levels - 1].GetQuantity() + stack[i].GetQuantity(), side);
+    }
+    else {
+      stack[levels++] = stack[i];
+    }
+  }
+  stack.resize(levels);
+}
+
 // forward declaration of MarketDataConnector
 template<typename T>
 class MarketDataConnector;
@@ -205,7 +240,7 @@ template<typename T>
 class MarketDataService : public Service<string,OrderBook <T> >
 {
 private:
-  map<string, OrderBook<T>> orderBookMap;
+  PooledMap<ProductId, OrderBook<T>> orderBookMap;
   vector<ServiceListener<OrderBook<T>>*> listeners;
   int bookDepth;
   string host; // host name for inbound connector
@@ -214,7 +249,7 @@ private:
 
 public:
   // ctor and dtor
-  MarketDataService(const string& _host, const string& _port);
+  MarketDataService(const Strand& _strand, const string& _host, const string& _port);
   ~MarketDataService()=default;
 
   // Get data on our service given a key
@@ -236,38 +271,42 @@ public:
   int GetBookDepth() const;
 
   // Get the best bid/offer order
-  const BidOffer& GetBestBidOffer(const string &productId);
+  const BidOffer& GetBestBidOffer(const ProductId& productId);
 
   // Aggregate the order book
-  const OrderBook<T>& AggregateDepth(const string &productId);
+  OrderBook<T>& AggregateDepth(const ProductId& productId);
 
 };
 
 
 template<typename T>
-MarketDataService<T>::MarketDataService(const string& _host, const string& _port)
+MarketDataService<T>::MarketDataService(const Strand& _strand, const string& _host, const string& _port)
 : host(_host), port(_port)
 {
   bookDepth = 5; // default book depth
-  connector = new MarketDataConnector<T>(this, host, port); // connector related to this server
+  connector = new MarketDataConnector<T>(this, _strand, host, port); // connector related to this server
 }
 
 template<typename T>
 OrderBook<T>& MarketDataService<T>::GetData(string key)
 {
   // if the order book does not exist, create a new one
-  if (orderBookMap.find(key) == orderBookMap.end()) {
-    orderBookMap.insert(pair<string, OrderBook<T>>(key, OrderBook<T>(key)));
+  ProductId productId(key);
+  auto it = orderBookMap.find(productId);
+  if (it == orderBookMap.end()) {
+    it = orderBookMap.insert(pair<ProductId, OrderBook<T>>(productId, OrderBook<T>(key))).first;
   }
-  return orderBookMap[key];
+  return it->second;
 }
 
 template<typename T>
 void MarketDataService<T>::OnMessage(OrderBook<T>& data)
 {
-  string key = data.GetProduct().GetProductId();
-  if (orderBookMap.find(key) != orderBookMap.end()) { orderBookMap.erase(key); }
-  orderBookMap.insert(pair<string, OrderBook<T>>(key, data));
+  const ProductId& key = data.GetProduct().GetProductId();
+  // the connector aggregates the stored order book in place, any other book replaces it
+  auto it = orderBookMap.find(key);
+  if (it == orderBookMap.end()) { orderBookMap.insert(pair<ProductId, OrderBook<T>>(key, data)); }
+  else if (&it->second != &data) { it->second = data; }
 
 
   for (auto& listener : listeners)
@@ -301,59 +340,18 @@ int MarketDataService<T>::GetBookDepth() const
 }
 
 template<typename T>
-const BidOffer& MarketDataService<T>::GetBestBidOffer(const string &productId)
+const BidOffer& MarketDataService<T>::GetBestBidOffer(const ProductId& productId)
 {
   return orderBookMap[productId].GetBestBidOffer();
 }
 
 template<typename T>
-const OrderBook<T>& MarketDataService<T>::AggregateDepth(const string &productId)
+OrderBook<T>& MarketDataService<T>::AggregateDepth(const ProductId& productId)
 {
-  // get the order book
+  // aggregate the stacks of the stored order book in place, so they keep their capacity
   OrderBook<T>& orderBook = orderBookMap[productId];
-  // get the bid stack and offer stack
-  vector<Order>& bidStack = orderBook.GetBidStack();
-  vector<Order>& offerStack = orderBook.GetOfferStack();
-  // aggregate the bid stack
-  unordered_map<double, long> aggBidMap;
-  for (auto& order : bidStack){
-    double price = order.GetPrice();
-    long quantity = order.GetQuantity();
-    if (aggBidMap.find(price) != aggBidMap.end()) {
-      aggBidMap[price] += quantity;
-    }
-    else {
-      aggBidMap.insert(pair<double, long>(price, quantity));
-    }
-  }
-  vector<Order> aggBid;
-  for (auto& item : aggBidMap) {
-    aggBid.push_back(Order(item.first, item.second, BID));
-  }
-  // (optional) sort the aggregated bid stack
-  // sort(aggBid.begin(), aggBid.end(), [](const Order& a, const Order& b) {return a.GetPrice() > b.GetPrice(); });
-
-  // aggregate the offer stack
-  unordered_map<double, long> aggOfferMap;
-  for (auto& order : offerStack) {
-    double price = order.GetPrice();
-    long quantity = order.GetQuantity();
-    if (aggOfferMap.find(price) != aggOfferMap.end()) {
-      aggOfferMap[price] += quantity;
-    }
-    else {
-      aggOfferMap.insert(pair<double, long>(price, quantity));
-    }
-  }
-  vector<Order> aggOffer;
-  for (auto& item : aggOfferMap) {
-    aggOffer.push_back(Order(item.first, item.second, OFFER));
-  }
-  // (optional) sort the aggregated offer stack
-  // sort(aggOffer.begin(), aggOffer.end(), [](const Order& a, const Order& b) {return a.GetPrice() < b.GetPrice(); });
-
-  // update the order book
-  orderBook = OrderBook<T>(orderBook.GetProduct(), aggBid, aggOffer);
+  aggregateStack(orderBook.GetBidStack(), BID);
+  aggregateStack(orderBook.GetOfferStack(), OFFER);
   return orderBook;
 }
 
@@ -368,16 +366,16 @@ private:
   MarketDataService<T>* service;
   string host; // host name
   string port; // port number
-  boost::asio::io_service io_service; // io service
-  boost::asio::ip::tcp::socket socket; // socket
+  Strand strand; // strand serializing the handlers of this feed
+  boost::asio::ip::tcp::acceptor acceptor; // acceptor listening on host:port
 
   void handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request);
-  void start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service);
+  void start_accept();
 
 public:
   // ctor
-  MarketDataConnector(MarketDataService<T>* _service, const string& _host, const string& _port);
-  // dtor: close the socket
+  MarketDataConnector(MarketDataService<T>* _service, const Strand& _strand, const string& _host, const string& _port);
+  // dtor: close the acceptor
   ~MarketDataConnector();
 
   // Publish data to the Connector
@@ -389,78 +387,64 @@ public:
 };
 
 template<typename T>
-MarketDataConnector<T>::MarketDataConnector(MarketDataService<T>* _service, const string& _host, const string& _port) 
-: service(_service), host(_host), port(_port), socket(io_service)
+MarketDataConnector<T>::MarketDataConnector(MarketDataService<T>* _service, const Strand& _strand, const string& _host, const string& _port)
+: service(_service), host(_host), port(_port), strand(_strand), acceptor(_strand)
 {
 }
 
 template<typename T>
 MarketDataConnector<T>::~MarketDataConnector()
 {
-  socket.close();
+  acceptor.close();
 }
 
 template<typename T>
-void MarketDataConnector<T>::start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service) {
-  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(*io_service);
-  acceptor->async_accept(*socket, [this, socket, acceptor, io_service](const boost::system::error_code& ec) {
+void MarketDataConnector<T>::start_accept() {
+  // sockets live on the feed's strand, so all handlers of a connection run in order
+  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(strand);
+  acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      delete socket; // acceptor closed, stop accepting
+      return;
+    }
     if (!ec) {
       boost::asio::streambuf* request = new boost::asio::streambuf;
       boost::asio::async_read_until(*socket, *request, "\n", std::bind(&MarketDataConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
+    } else {
+      delete socket;
     }
-    start_accept(acceptor, io_service); // accept the next connection
+    start_accept(); // accept the next connection
   });
 }
 
 template<typename T>
 void MarketDataConnector<T>::handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request) {
   if (!ec) {
-    std::string data = std::string(boost::asio::buffers_begin(request->data()), boost::asio::buffers_end(request->data()));
-    // find the last newline
-    std::size_t last_newline = data.rfind('\n');
-    if (last_newline != std::string::npos) {
-      // consume only up to the last newline
-      request->consume(last_newline + 1);
-      // only process the data up to the last newline
-      data = data.substr(0, last_newline);
-    } else {
-      // if there's no newline, don't process any data
-      data.clear();
-    }
-
-    // split the data into lines
-    std::stringstream ss(data);
-    std::string line;
-    while (std::getline(ss, line)) {
+    // parse the complete lines in place, the fields view the buffer until it is consumed
+    string_view data(static_cast<const char*>(request->data().data()), request->size());
+    ArenaScope scope(threadArena());
+    ArenaVector<string_view> lineData{ArenaAllocator<string_view>(threadArena())};
+    size_t parsed = forEachLine(data, [&](string_view line) {
       // parse the line
-      vector<string> lineData;
-      stringstream lineStream(line); // turn the line into a stream
-      string word;
-      while (getline(lineStream, word, ','))
-      {
-        lineData.push_back(word);
-      }
-      string timestamp = lineData[0];
-      string productId = lineData[1];
-      OrderBook<T>& orderBook = service->GetData(productId);
+      splitFields(line, lineData);
+      const T& product = lookupProduct<T>(lineData[1]);
+      OrderBook<T>& orderBook = service->GetData(product.GetProductId());
+      const ProductId& productId = orderBook.GetProduct().GetProductId();
 
-      string bidPrice, bidQty, askPrice, askQty;
       Order bidOrder, askOrder;
       for (int k = 0; k < service->GetBookDepth(); k++){
-        bidPrice = lineData[4*k+2];
-        bidQty = lineData[4*k+3];
-        askPrice = lineData[4*k+4];
-        askQty = lineData[4*k+5];
-        bidOrder = Order(convertPrice(bidPrice), stol(bidQty), BID);
-        askOrder = Order(convertPrice(askPrice), stol(askQty), OFFER);
+        bidOrder = Order(convertPrice(lineData[4*k+2]), parseInteger(lineData[4*k+3]), BID);
+        askOrder = Order(convertPrice(lineData[4*k+4]), parseInteger(lineData[4*k+5]), OFFER);
         orderBook.GetBidStack().push_back(bidOrder);
         orderBook.GetOfferStack().push_back(askOrder);
       }
-      // aggregate the order book, get a copy
-      OrderBook<T> aggOrderBook = service->AggregateDepth(productId);
+      // aggregate the order book in place
+      OrderBook<T>& aggOrderBook = service->AggregateDepth(productId);
       // publish the order book to the service
       service->OnMessage(aggOrderBook);
-    }
+    });
+    // only the complete lines are consumed
+    request->consume(parsed);
 
     boost::asio::async_read_until(*socket, *request, "\n", std::bind(&MarketDataConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
   } else {
@@ -479,17 +463,19 @@ void MarketDataConnector<T>::Subscribe()
 {
   log(LogLevel::NOTE, "Market data server listening on " + host + ":" + port);
   try {
-  // connect to the socket
-  boost::asio::ip::tcp::resolver resolver(io_service);
-  boost::asio::ip::tcp::resolver::query query(host, port);
-  boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-  boost::asio::ip::tcp::acceptor acceptor(io_service, endpoint);
-  start_accept(&acceptor, &io_service);
-  io_service.run();
+  // bind the acceptor on the shared server context, the worker pool runs the handlers
+  boost::asio::ip::tcp::resolver resolver(strand);
+  boost::asio::ip::tcp::endpoint endpoint = resolver.resolve(host, port)->endpoint();
+  acceptor.open(endpoint.protocol());
+  acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  acceptor.bind(endpoint);
+  acceptor.listen();
+  start_accept();
   }
   catch (std::exception& e){
     // throw error log
     log(LogLevel::ERROR, e.what());
+    acceptor.close();
     return;
   }
 }
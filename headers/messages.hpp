@@ -0,0 +1,256 @@
+/**
+ * messages.hpp
+ * Defines the flat message types of the hot path and their conversions to the domain classes.
+ *
+ * Price<T>, OrderBook<T>, ExecutionOrder<T>, Trade<T> and Inquiry<T> embed a full product (with strings
+ * and a date) and the order book keeps its levels in vectors, so copying one copies heap data. A message
+ * is a fixed-size, trivially copyable struct instead: the product is a 16-bit handle into the product
+ * registry, prices are integer ticks and identifiers are inline fixed strings, so a message can be
+ * copied with memcpy into a queue, a shared memory segment or a binary file. The domain classes are only
+ * built back from a message at the edges of the system (GUI, persistence).
+ *
+ * @author Boyu Yang
+ */
+#ifndef MESSAGES_HPP
+#define MESSAGES_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <stdexcept>
+
+#include "fixedstring.hpp"
+#include "productregistry.hpp"
+#include "pricingservice.hpp"
+#include "marketdataservice.hpp"
+#include "algoexecutionservice.hpp"
+#include "tradebookingservice.hpp"
+#include "inquiryservice.hpp"
+
+using namespace std;
+
+// Ticks per point of price: half of the 1/256 quoting increment, so the mid of two quotes is exact
+const int64_t PRICE_TICKS_PER_POINT = 512;
+
+// Levels per side of an order book message
+const size_t MESSAGE_BOOK_DEPTH = 10;
+
+// convert a price to ticks, rounding to the nearest tick
+inline int64_t toTicks(double price)
+{
+  return llround(price * PRICE_TICKS_PER_POINT);
+}
+
+// convert ticks to a price
+inline double fromTicks(int64_t ticks)
+{
+  return static_cast<double>(ticks) / PRICE_TICKS_PER_POINT;
+}
+
+/**
+ * Price message: mid and bid/offer spread of a product.
+ */
+struct PriceMessage
+{
+  int64_t midTicks;
+  int64_t bidOfferSpreadTicks;
+  ProductHandle product;
+};
+
+/**
+ * A level of an order book message.
+ */
+struct OrderLevel
+{
+  int64_t priceTicks;
+  int64_t quantity;
+};
+
+/**
+ * Order book message: up to MESSAGE_BOOK_DEPTH levels per side, in the order of the stacks.
+ */
+struct OrderBookMessage
+{
+  ProductHandle product;
+  uint16_t bidDepth;
+  uint16_t offerDepth;
+  OrderLevel bids[MESSAGE_BOOK_DEPTH];
+  OrderLevel offers[MESSAGE_BOOK_DEPTH];
+};
+
+/**
+ * Execution order message.
+ */
+struct ExecutionOrderMessage
+{
+  OrderId orderId;
+  OrderId parentOrderId;
+  int64_t priceTicks;
+  int64_t visibleQuantity;
+  int64_t hiddenQuantity;
+  ProductHandle product;
+  PricingSide side;
+  OrderType orderType;
+  bool isChildOrder;
+};
+
+/**
+ * Trade message.
+ */
+struct TradeMessage
+{
+  TradeId tradeId;
+  BookId book;
+  int64_t priceTicks;
+  int64_t quantity;
+  ProductHandle product;
+  Side side;
+};
+
+/**
+ * Inquiry message.
+ */
+struct InquiryMessage
+{
+  InquiryId inquiryId;
+  int64_t priceTicks;
+  int64_t quantity;
+  ProductHandle product;
+  Side side;
+  InquiryState state;
+};
+
+static_assert(is_trivially_copyable_v<PriceMessage>, "a price message is copied with memcpy");
+static_assert(is_trivially_copyable_v<OrderBookMessage>, "an order book message is copied with memcpy");
+static_assert(is_trivially_copyable_v<ExecutionOrderMessage>, "an execution order message is copied with memcpy");
+static_assert(is_trivially_copyable_v<TradeMessage>, "a trade message is copied with memcpy");
+static_assert(is_trivially_copyable_v<InquiryMessage>, "an inquiry message is copied with memcpy");
+
+// convert a price to a message, the product is registered on its first message
+template<typename T>
+PriceMessage toMessage(const Price<T>& price)
+{
+  PriceMessage message;
+  message.midTicks = toTicks(price.GetMid());
+  message.bidOfferSpreadTicks = toTicks(price.GetBidOfferSpread());
+  message.product = productRegistry<T>().Register(price.GetProduct());
+  return message;
+}
+
+// build a price back from a message
+template<typename T>
+Price<T> fromMessage(const PriceMessage& message)
+{
+  return Price<T>(productRegistry<T>().Get(message.product), fromTicks(message.midTicks), fromTicks(message.bidOfferSpreadTicks));
+}
+
+// copy the levels of a stack into a message side, returns the depth
+inline uint16_t toLevels(const vector<Order>& stack, OrderLevel* levels)
+{
+  if (stack.size() > MESSAGE_BOOK_DEPTH) {
+    throw std::invalid_argument("Order book deeper than " + to_string(MESSAGE_BOOK_DEPTH) + " levels");
+  }
+  for (size_t i = 0; i < stack.size(); ++i) {
+    levels[i].priceTicks = toTicks(stack[i].GetPrice());
+    levels[i].quantity = stack[i].GetQuantity();
+  }
+  return static_cast<uint16_t>(stack.size());
+}
+
+// build a stack back from the levels of a message side
+inline vector<Order> fromLevels(const OrderLevel* levels, uint16_t depth, PricingSide side)
+{
+  vector<Order> stack;
+  stack.reserve(depth);
+  for (uint16_t i = 0; i < depth; ++i) {
+    stack.push_back(Order(fromTicks(levels[i].priceTicks), levels[i].quantity, side));
+  }
+  return stack;
+}
+
+// convert an order book to a message
+template<typename T>
+OrderBookMessage toMessage(const OrderBook<T>& orderBook)
+{
+  OrderBookMessage message;
+  message.product = productRegistry<T>().Register(orderBook.GetProduct());
+  message.bidDepth = toLevels(orderBook.GetBidStack(), message.bids);
+  message.offerDepth = toLevels(orderBook.GetOfferStack(), message.offers);
+  return message;
+}
+
+// build an order book back from a message
+template<typename T>
+OrderBook<T> fromMessage(const OrderBookMessage& message)
+{
+  return OrderBook<T>(productRegistry<T>().Get(message.product), fromLevels(message.bids, message.bidDepth, BID), fromLevels(message.offers, message.offerDepth, OFFER));
+}
+
+// convert an execution order to a message
+template<typename T>
+ExecutionOrderMessage toMessage(const ExecutionOrder<T>& order)
+{
+  ExecutionOrderMessage message;
+  message.orderId = order.GetOrderId();
+  message.parentOrderId = order.GetParentOrderId();
+  message.priceTicks = toTicks(order.GetPrice());
+  message.visibleQuantity = order.GetVisibleQuantity();
+  message.hiddenQuantity = order.GetHiddenQuantity();
+  message.product = productRegistry<T>().Register(order.GetProduct());
+  message.side = order.GetSide();
+  message.orderType = order.GetOrderType();
+  message.isChildOrder = order.IsChildOrder();
+  return message;
+}
+
+// build an execution order back from a message
+template<typename T>
+ExecutionOrder<T> fromMessage(const ExecutionOrderMessage& message)
+{
+  return ExecutionOrder<T>(productRegistry<T>().Get(message.product), message.side, message.orderId.View(), message.orderType,
+    fromTicks(message.priceTicks), message.visibleQuantity, message.hiddenQuantity, message.parentOrderId.View(), message.isChildOrder);
+}
+
+// convert a trade to a message
+template<typename T>
+TradeMessage toMessage(const Trade<T>& trade)
+{
+  TradeMessage message;
+  message.tradeId = trade.GetTradeId();
+  message.book = trade.GetBook();
+  message.priceTicks = toTicks(trade.GetPrice());
+  message.quantity = trade.GetQuantity();
+  message.product = productRegistry<T>().Register(trade.GetProduct());
+  message.side = trade.GetSide();
+  return message;
+}
+
+// build a trade back from a message
+template<typename T>
+Trade<T> fromMessage(const TradeMessage& message)
+{
+  return Trade<T>(productRegistry<T>().Get(message.product), message.tradeId.View(), fromTicks(message.priceTicks), message.book.View(), message.quantity, message.side);
+}
+
+// convert an inquiry to a message
+template<typename T>
+InquiryMessage toMessage(const Inquiry<T>& inquiry)
+{
+  InquiryMessage message;
+  message.inquiryId = inquiry.GetInquiryId();
+  message.priceTicks = toTicks(inquiry.GetPrice());
+  message.quantity = inquiry.GetQuantity();
+  message.product = productRegistry<T>().Register(inquiry.GetProduct());
+  message.side = inquiry.GetSide();
+  message.state = inquiry.GetState();
+  return message;
+}
+
+// build an inquiry back from a message
+template<typename T>
+Inquiry<T> fromMessage(const InquiryMessage& message)
+{
+  return Inquiry<T>(message.inquiryId.View(), productRegistry<T>().Get(message.product), message.side, message.quantity, fromTicks(message.priceTicks), message.state);
+}
+
+#endif
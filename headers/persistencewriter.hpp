@@ -0,0 +1,301 @@
+/**
+ * persistencewriter.hpp
+ * Defines the asynchronous writer that persists historical data to files.
+ *
+ * @author Boyu Yang
+ */
+#ifndef PERSISTENCE_WRITER_HPP
+#define PERSISTENCE_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/lockfree/spsc_queue.hpp>
+
+#include "utils.hpp"
+#include "asynclogger.hpp"
+
+using namespace std;
+
+// When the writer thread calls fsync() on the files it writes
+enum FsyncPolicy { FSYNC_NEVER, FSYNC_INTERVAL, FSYNC_ALWAYS };
+
+/**
+ * A long-lived output file fed through a lock-free single-producer/single-consumer byte ring.
+ * The producer is the service that owns the channel (services are serialized by their strand),
+ * the consumer is the writer thread of the PersistenceWriter.
+ */
+class PersistenceChannel
+{
+private:
+  string fileName; // file name
+  int fd; // file descriptor, open for the lifetime of the channel
+  boost::lockfree::spsc_queue<char> ring; // bytes waiting to be written
+  atomic<long> stalls; // number of times the producer found the ring full
+  atomic<long> dropped; // bytes dropped because the writer thread stopped
+  const atomic<bool>* writerRunning; // whether the writer thread still drains the ring
+  PersistenceChannel* after; // channel whose data enqueued first is written first, null if none
+  size_t pending; // bytes the writer may take in the current pass (writer thread only)
+  bool dirty; // written since the last fsync (writer thread only)
+
+  friend class PersistenceWriter;
+
+public:
+  // ctor: open the file in append mode
+  PersistenceChannel(const string& _fileName, size_t _capacity, const atomic<bool>* _writerRunning, PersistenceChannel* _after = nullptr);
+  // dtor: close the file
+  ~PersistenceChannel();
+
+  // Enqueue data for the writer thread (producer side, never takes a lock)
+  // waits while the ring is full, drops the data if the writer thread has stopped
+  void Write(const char* data, size_t size);
+  void Write(const string& data);
+
+  // Get the file name
+  const string& GetFileName() const;
+
+  // Get the number of times the producer had to wait for the writer
+  long GetStalls() const;
+
+  // Get the number of bytes dropped because the writer thread stopped
+  long GetDropped() const;
+
+};
+
+PersistenceChannel::PersistenceChannel(const string& _fileName, size_t _capacity, const atomic<bool>* _writerRunning, PersistenceChannel* _after)
+: fileName(_fileName), ring(_capacity), stalls(0), dropped(0), writerRunning(_writerRunning), after(_after), pending(0), dirty(false)
+{
+  fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    log(LogLevel::ERROR, "Cannot open persistence file: " + fileName);
+  }
+}
+
+PersistenceChannel::~PersistenceChannel()
+{
+  if (fd >= 0) close(fd);
+}
+
+void PersistenceChannel::Write(const char* data, size_t size)
+{
+  size_t pushed = ring.push(data, size);
+  // the ring only fills up if the disk falls behind, wait for the writer instead of dropping data,
+  // unless the writer has stopped and nothing will drain the ring anymore
+  while (pushed < size) {
+    if (!writerRunning->load(memory_order_acquire)) {
+      if (dropped.fetch_add(size - pushed, memory_order_relaxed) == 0) {
+        LOG_ASYNC(LogLevel::ERROR, "Persistence writer stopped, dropping data of {}", fileName);
+      }
+      return;
+    }
+    stalls.fetch_add(1, memory_order_relaxed);
+    this_thread::yield();
+    pushed += ring.push(data + pushed, size - pushed);
+  }
+}
+
+void PersistenceChannel::Write(const string& data)
+{
+  Write(data.data(), data.size());
+}
+
+const string& PersistenceChannel::GetFileName() const
+{
+  return fileName;
+}
+
+long PersistenceChannel::GetStalls() const
+{
+  return stalls.load(memory_order_relaxed);
+}
+
+long PersistenceChannel::GetDropped() const
+{
+  return dropped.load(memory_order_relaxed);
+}
+
+/**
+ * PersistenceWriter: owns the persistence channels and a background thread that drains them.
+ * Data is written with large write() calls from a reusable buffer, and synced according to the fsync policy.
+ * Stores that do not write through a channel (memory-mapped segments) add a sync hook, called with the fsyncs.
+ * A channel opened after another one (e.g. an index after its data) only reaches its file once the data
+ * its producer enqueued before it on the other channel has been written.
+ */
+class PersistenceWriter
+{
+private:
+  vector<PersistenceChannel*> channels; // all open channels
+  vector<pair<size_t, function<void()>>> syncHooks; // hooks called with the fsyncs, by identifier
+  size_t nextSyncHook; // identifier of the next sync hook
+  mutex channelMutex; // guards the channel and hook lists (registration and writer thread only)
+  thread writerThread; // background writer
+  atomic<bool> running; // whether the writer thread should keep running
+  FsyncPolicy fsyncPolicy; // fsync policy
+  std::chrono::milliseconds fsyncInterval; // interval between fsyncs for FSYNC_INTERVAL
+  std::chrono::microseconds idleInterval; // sleep time when there is nothing to write
+  size_t bufferSize; // size of a single write
+  size_t channelCapacity; // ring capacity of new channels
+
+  // drain all channels once, returns the number of bytes written
+  size_t Drain(vector<char>& buffer, bool sync);
+
+  // background thread function
+  void Run();
+
+public:
+  // ctor: start the writer thread
+  PersistenceWriter(FsyncPolicy _fsyncPolicy = FSYNC_INTERVAL, long _fsyncIntervalMs = 1000, size_t _bufferSize = 1 << 20, size_t _channelCapacity = 1 << 22);
+  // dtor: drain, sync and close all channels
+  ~PersistenceWriter();
+
+  // Open a long-lived channel to a file, written after the data enqueued before on the channel after, if any
+  // both channels must have the same producer
+  PersistenceChannel* OpenChannel(const string& fileName, PersistenceChannel* after = nullptr);
+
+  // Add a hook called on the writer thread whenever the channels are synced, returns its identifier
+  size_t AddSyncHook(function<void()> hook);
+
+  // Remove a sync hook, it is not running anymore when this returns
+  void RemoveSyncHook(size_t id);
+
+  // Get the fsync policy
+  FsyncPolicy GetFsyncPolicy() const;
+
+  // Stop the writer thread after everything enqueued so far is written
+  void Stop();
+
+};
+
+PersistenceWriter::PersistenceWriter(FsyncPolicy _fsyncPolicy, long _fsyncIntervalMs, size_t _bufferSize, size_t _channelCapacity)
+: nextSyncHook(0), running(true), fsyncPolicy(_fsyncPolicy), fsyncInterval(_fsyncIntervalMs), idleInterval(500), bufferSize(_bufferSize), channelCapacity(_channelCapacity)
+{
+  writerThread = thread(&PersistenceWriter::Run, this);
+}
+
+PersistenceWriter::~PersistenceWriter()
+{
+  Stop();
+  for (auto& channel : channels) {
+    delete channel;
+  }
+}
+
+PersistenceChannel* PersistenceWriter::OpenChannel(const string& fileName, PersistenceChannel* after)
+{
+  // the channel is drained after the channel it follows, which is already open
+  PersistenceChannel* channel = new PersistenceChannel(fileName, channelCapacity, &running, after);
+  lock_guard<mutex> lock(channelMutex);
+  channels.push_back(channel);
+  return channel;
+}
+
+size_t PersistenceWriter::AddSyncHook(function<void()> hook)
+{
+  lock_guard<mutex> lock(channelMutex);
+  syncHooks.push_back(make_pair(nextSyncHook, std::move(hook)));
+  return nextSyncHook++;
+}
+
+void PersistenceWriter::RemoveSyncHook(size_t id)
+{
+  lock_guard<mutex> lock(channelMutex);
+  for (auto it = syncHooks.begin(); it != syncHooks.end(); ++it) {
+    if (it->first == id) {
+      syncHooks.erase(it);
+      return;
+    }
+  }
+}
+
+FsyncPolicy PersistenceWriter::GetFsyncPolicy() const
+{
+  return fsyncPolicy;
+}
+
+void PersistenceWriter::Stop()
+{
+  if (running.exchange(false)) {
+    join(writerThread);
+  }
+}
+
+size_t PersistenceWriter::Drain(vector<char>& buffer, bool sync)
+{
+  size_t total = 0;
+  lock_guard<mutex> lock(channelMutex);
+  // take what the ordered channels hold before draining anything: the data they follow was enqueued
+  // before, and its channel comes first in the list, so it is written first in this pass
+  for (auto& channel : channels) {
+    channel->pending = channel->after ? channel->ring.read_available() : SIZE_MAX;
+  }
+  for (auto& channel : channels) {
+    size_t count;
+    while (channel->pending > 0 && (count = channel->ring.pop(buffer.data(), min(buffer.size(), channel->pending))) > 0) {
+      if (channel->after) channel->pending -= count;
+      // write the whole batch, write() may return early
+      size_t offset = 0;
+      while (channel->fd >= 0 && offset < count) {
+        ssize_t n = write(channel->fd, buffer.data() + offset, count - offset);
+        if (n < 0) {
+          // interrupted or not ready: try again, anything else loses the rest of the batch
+          if (errno == EINTR || errno == EAGAIN) continue;
+          LOG_ASYNC(LogLevel::ERROR, "Cannot write persistence file: {}", channel->fileName);
+          break;
+        }
+        offset += n;
+      }
+      // only what reached the file counts
+      if (offset == 0) continue;
+      total += offset;
+      channel->dirty = true;
+      if (fsyncPolicy == FSYNC_ALWAYS && channel->fd >= 0) {
+        fsync(channel->fd);
+        channel->dirty = false;
+      }
+    }
+    if (sync && channel->dirty && channel->fd >= 0) {
+      fsync(channel->fd);
+      channel->dirty = false;
+    }
+  }
+  if (sync) {
+    for (auto& hook : syncHooks) {
+      hook.second();
+    }
+  }
+  return total;
+}
+
+void PersistenceWriter::Run()
+{
+  vector<char> buffer(bufferSize);
+  auto lastSync = std::chrono::steady_clock::now();
+  while (running.load(memory_order_acquire)) {
+    // the channels are synced per batch with FSYNC_ALWAYS, the hooks on every pass
+    bool sync = (fsyncPolicy == FSYNC_ALWAYS);
+    if (fsyncPolicy == FSYNC_INTERVAL) {
+      auto now = std::chrono::steady_clock::now();
+      if (now - lastSync >= fsyncInterval) {
+        sync = true;
+        lastSync = now;
+      }
+    }
+    // only sleep when there was nothing to write
+    if (Drain(buffer, sync) == 0) {
+      this_thread::sleep_for(idleInterval);
+    }
+  }
+  // write whatever is left before leaving, ordered channels may need a second pass
+  while (Drain(buffer, fsyncPolicy != FSYNC_NEVER) > 0) {
+  }
+}
+
+#endif
@@ -0,0 +1,453 @@
+/**
+ * pnlservice.hpp
+ * Defines the data types and Service for real-time profit and loss.
+ *
+ * @author Boyu Yang
+ */
+#ifndef PNL_SERVICE_HPP
+#define PNL_SERVICE_HPP
+
+#include <string>
+#include <map>
+#include <array>
+#include <mutex>
+#include <cstdlib>
+
+#include "soa.hpp"
+#include "arena.hpp"
+#include "tradebookingservice.hpp"
+#include "pricingservice.hpp"
+#include "positionservice.hpp"
+#include "utils.hpp"
+#include "recordformat.hpp"
+
+using namespace std;
+
+/**
+ * Profit and loss of a product across its books.
+ * Realized P&L uses the average cost of each book, unrealized P&L marks the open position to the mid price.
+ * Prices are in percentage of par and quantities in face value.
+ * Type T is the product type.
+ */
+template<typename T>
+class PnL
+{
+
+public:
+
+  // ctor for a P&L
+  PnL() = default;
+  PnL(const T &_product);
+
+  // Get the product
+  const T& GetProduct() const;
+
+  // Get the mark (mid) price, 0 before the first price
+  double GetMark() const;
+
+  // Get the position, average cost, realized and unrealized P&L of a book
+  long GetPosition(int bookId) const;
+  double GetAverageCost(int bookId) const;
+  double GetRealizedPnL(int bookId) const;
+  double GetUnrealizedPnL(int bookId) const;
+
+  // Get the totals across books
+  long GetAggregatePosition() const;
+  double GetRealizedPnL() const;
+  double GetUnrealizedPnL() const;
+  double GetTotalPnL() const;
+
+  // Book a trade (quantity positive for buys, negative for sells) at a price
+  void AddTrade(int bookId, long quantity, double price);
+
+  // Mark the open positions to a new price, costs O(books)
+  void Mark(double price);
+
+  // object formatter
+  template<typename U>
+  friend void formatRecord(TextWriter& writer, const PnL<U>& pnl);
+
+private:
+  T product;
+  double mark = 0.0; // last mid price
+  bool marked = false; // whether a price was received
+  unsigned int bookMask = 0; // books that have been traded, bit per book id
+  array<long, MAX_BOOKS> positions = {}; // open position of each book
+  array<double, MAX_BOOKS> averageCosts = {}; // average cost of the open position of each book
+  array<double, MAX_BOOKS> realized = {}; // realized P&L of each book
+  array<double, MAX_BOOKS> unrealized = {}; // unrealized P&L of each book
+  long aggregatePosition = 0; // running totals across books
+  double realizedTotal = 0.0;
+  double unrealizedTotal = 0.0;
+
+  // re-mark one book and keep the unrealized total
+  void MarkBook(int bookId);
+
+};
+
+template<typename T>
+PnL<T>::PnL(const T &_product) :
+  product(_product)
+{
+}
+
+template<typename T>
+const T& PnL<T>::GetProduct() const
+{
+  return product;
+}
+
+template<typename T>
+double PnL<T>::GetMark() const
+{
+  return mark;
+}
+
+template<typename T>
+long PnL<T>::GetPosition(int bookId) const
+{
+  return positions[bookId];
+}
+
+template<typename T>
+double PnL<T>::GetAverageCost(int bookId) const
+{
+  return averageCosts[bookId];
+}
+
+template<typename T>
+double PnL<T>::GetRealizedPnL(int bookId) const
+{
+  return realized[bookId];
+}
+
+template<typename T>
+double PnL<T>::GetUnrealizedPnL(int bookId) const
+{
+  return unrealized[bookId];
+}
+
+template<typename T>
+long PnL<T>::GetAggregatePosition() const
+{
+  return aggregatePosition;
+}
+
+template<typename T>
+double PnL<T>::GetRealizedPnL() const
+{
+  return realizedTotal;
+}
+
+template<typename T>
+double PnL<T>::GetUnrealizedPnL() const
+{
+  return unrealizedTotal;
+}
+
+template<typename T>
+double PnL<T>::GetTotalPnL() const
+{
+  return realizedTotal + unrealizedTotal;
+}
+
+/**
+ * AddTrade() updates the average cost of the book: trades in the direction of the position
+ * are averaged in, trades against it realize (price - average cost) on the closed quantity.
+ */
+template<typename T>
+void PnL<T>::AddTrade(int bookId, long quantity, double price)
+{
+  long position = positions[bookId];
+  if (position == 0 || (position > 0) == (quantity > 0)) {
+    averageCosts[bookId] = (averageCosts[bookId] * labs(position) + price * labs(quantity)) / (labs(position) + labs(quantity));
+  }
+  else {
+    long closed = min(labs(quantity), labs(position));
+    double pnl = (price - averageCosts[bookId]) / 100.0 * (position > 0 ? closed : -closed);
+    realized[bookId] += pnl;
+    realizedTotal += pnl;
+    // a trade larger than the position opens the other side at the trade price
+    if (labs(quantity) > labs(position)) averageCosts[bookId] = price;
+    else if (labs(quantity) == labs(position)) averageCosts[bookId] = 0.0;
+  }
+  positions[bookId] = position + quantity;
+  aggregatePosition += quantity;
+  bookMask |= 1u << bookId;
+  if (marked) MarkBook(bookId);
+}
+
+template<typename T>
+void PnL<T>::Mark(double price)
+{
+  mark = price;
+  marked = true;
+  for (int bookId = 0; bookId < MAX_BOOKS; ++bookId) {
+    if (bookMask & (1u << bookId)) MarkBook(bookId);
+  }
+}
+
+template<typename T>
+void PnL<T>::MarkBook(int bookId)
+{
+  double pnl = (mark - averageCosts[bookId]) / 100.0 * positions[bookId];
+  unrealizedTotal += pnl - unrealized[bookId];
+  unrealized[bookId] = pnl;
+}
+
+// format the fields of a P&L: product, mark, totals, then the realized and unrealized P&L of every traded book
+template<typename T>
+void formatRecord(TextWriter& writer, const PnL<T>& pnl)
+{
+  writeFields(writer, pnl.GetProduct().GetProductId(), PriceField{pnl.GetMark()}, pnl.GetAggregatePosition(),
+    pnl.GetRealizedPnL(), pnl.GetUnrealizedPnL(), pnl.GetTotalPnL());
+  for (int bookId = 0; bookId < MAX_BOOKS; ++bookId)
+  {
+    if (!(pnl.bookMask & (1u << bookId))) continue;
+    writer.Append(',');
+    writeFields(writer, bookRegistry.GetName(bookId), pnl.GetRealizedPnL(bookId), pnl.GetUnrealizedPnL(bookId));
+  }
+}
+
+template<typename T>
+ostream& operator<<(ostream& os, const PnL<T>& pnl)
+{
+  return writeRecord(os, pnl);
+}
+
+// Pre-declaration of the listeners used to subscribe data from trade booking and pricing services
+template<typename T>
+class PnLTradeListener;
+
+template<typename T>
+class PnLPriceListener;
+
+/**
+ * P&L Service keeping the realized and unrealized P&L of every product, per book.
+ * Trades arrive from the trade booking service and prices from the pricing service, on different strands,
+ * so the P&L state and the listener callbacks are guarded by a mutex.
+ * Keyed on product identifier.
+ * Type T is the product type.
+ */
+template<typename T>
+class PnLService : public Service<string,PnL <T> >
+{
+private:
+  PooledMap<ProductId, PnL<T>> pnlMap;
+  map<ProductId,double> marks; // last mid price of products without trades yet
+  vector<ServiceListener<PnL<T>>*> listeners;
+  PnLTradeListener<T>* pnltradelistener;
+  PnLPriceListener<T>* pnlpricelistener;
+  mutex pnlMutex;
+
+public:
+  // ctor and dtor
+  PnLService();
+  ~PnLService()=default;
+
+  // Get data on our service given a key
+  PnL<T>& GetData(string key);
+
+  // The callback that a Connector should invoke for any new or updated data
+  void OnMessage(PnL<T> &data);
+
+  // Add a listener to the Service for callbacks on add, remove, and update events
+  // for data to the Service.
+  void AddListener(ServiceListener<PnL<T>> *listener);
+
+  // Get all listeners on the Service.
+  const vector<ServiceListener<PnL<T>>*>& GetListeners() const;
+
+  // Get the listeners of trades and prices
+  PnLTradeListener<T>* GetPnLTradeListener();
+  PnLPriceListener<T>* GetPnLPriceListener();
+
+  // Book a trade into the P&L
+  void AddTrade(const Trade<T> &trade);
+
+  // Mark the P&L of a product to a new price
+  void AddPrice(const Price<T> &price);
+
+};
+
+template<typename T>
+PnLService<T>::PnLService()
+{
+  pnltradelistener = new PnLTradeListener<T>(this);
+  pnlpricelistener = new PnLPriceListener<T>(this);
+}
+
+template<typename T>
+PnL<T>& PnLService<T>::GetData(string key)
+{
+  return pnlMap[ProductId(key)];
+}
+
+/**
+ * OnMessage() used to be called by an input connector to subscribe data from socket
+ * no need to implement here.
+ */
+template<typename T>
+void PnLService<T>::OnMessage(PnL<T> &data)
+{
+}
+
+template<typename T>
+void PnLService<T>::AddListener(ServiceListener<PnL<T>> *listener)
+{
+  listeners.push_back(listener);
+}
+
+template<typename T>
+const vector<ServiceListener<PnL<T>>*>& PnLService<T>::GetListeners() const
+{
+  return listeners;
+}
+
+template<typename T>
+PnLTradeListener<T>* PnLService<T>::GetPnLTradeListener()
+{
+  return pnltradelistener;
+}
+
+template<typename T>
+PnLPriceListener<T>* PnLService<T>::GetPnLPriceListener()
+{
+  return pnlpricelistener;
+}
+
+template<typename T>
+void PnLService<T>::AddTrade(const Trade<T> &trade)
+{
+  lock_guard<mutex> lock(pnlMutex);
+  const T& product = trade.GetProduct();
+  const ProductId& productId = product.GetProductId();
+  auto it = pnlMap.find(productId);
+  if (it == pnlMap.end())
+  {
+    it = pnlMap.insert(pair<ProductId, PnL<T>>(productId,PnL<T>(product))).first;
+    auto mark = marks.find(productId);
+    if (mark != marks.end()) it->second.Mark(mark->second);
+  }
+  long quantity = (trade.GetSide() == BUY) ? trade.GetQuantity() : -trade.GetQuantity();
+  it->second.AddTrade(bookRegistry.Intern(trade.GetBook()), quantity, trade.GetPrice());
+  for (auto& listener : listeners)
+  {
+    listener->ProcessAdd(it->second);
+  }
+}
+
+template<typename T>
+void PnLService<T>::AddPrice(const Price<T> &price)
+{
+  lock_guard<mutex> lock(pnlMutex);
+  const ProductId& productId = price.GetProduct().GetProductId();
+  auto it = pnlMap.find(productId);
+  if (it == pnlMap.end())
+  {
+    // nothing to mark yet, keep the price for the first trade
+    marks[productId] = price.GetMid();
+    return;
+  }
+  it->second.Mark(price.GetMid());
+  for (auto& listener : listeners)
+  {
+    listener->ProcessUpdate(it->second);
+  }
+}
+
+/**
+ * P&L Trade Listener subscribing trades from Trade Booking Service to P&L Service.
+ * Type T is the product type.
+ */
+template<typename T>
+class PnLTradeListener : public ServiceListener<Trade<T>>
+{
+private:
+  PnLService<T>* pnlservice;
+
+public:
+  // ctor
+  PnLTradeListener(PnLService<T>* _pnlservice);
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(Trade<T> &data) override;
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(Trade<T> &data) override;
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(Trade<T> &data) override;
+
+};
+
+template<typename T>
+PnLTradeListener<T>::PnLTradeListener(PnLService<T>* _pnlservice)
+{
+  pnlservice = _pnlservice;
+}
+
+template<typename T>
+void PnLTradeListener<T>::ProcessAdd(Trade<T> &data)
+{
+  pnlservice->AddTrade(data);
+}
+
+template<typename T>
+void PnLTradeListener<T>::ProcessRemove(Trade<T> &data)
+{
+}
+
+template<typename T>
+void PnLTradeListener<T>::ProcessUpdate(Trade<T> &data)
+{
+}
+
+/**
+ * P&L Price Listener subscribing mid prices from Pricing Service to P&L Service.
+ * Type T is the product type.
+ */
+template<typename T>
+class PnLPriceListener : public ServiceListener<Price<T>>
+{
+private:
+  PnLService<T>* pnlservice;
+
+public:
+  // ctor
+  PnLPriceListener(PnLService<T>* _pnlservice);
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(Price<T> &data) override;
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(Price<T> &data) override;
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(Price<T> &data) override;
+
+};
+
+template<typename T>
+PnLPriceListener<T>::PnLPriceListener(PnLService<T>* _pnlservice)
+{
+  pnlservice = _pnlservice;
+}
+
+template<typename T>
+void PnLPriceListener<T>::ProcessAdd(Price<T> &data)
+{
+  pnlservice->AddPrice(data);
+}
+
+template<typename T>
+void PnLPriceListener<T>::ProcessRemove(Price<T> &data)
+{
+}
+
+template<typename T>
+void PnLPriceListener<T>::ProcessUpdate(Price<T> &data)
+{
+}
+
+#endif
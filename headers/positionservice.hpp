@@ -9,11 +9,87 @@
 
 #include <string>
 #include <map>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
 #include "soa.hpp"
+#include "arena.hpp"
 #include "tradebookingservice.hpp"
+#include "recordformat.hpp"
 
 using namespace std;
 
+// Maximum number of books a position is kept for
+const int MAX_BOOKS = 8;
+
+/**
+ * Books interned to small ids in order of first use, so positions keep their books in a fixed array.
+ * The trading books are interned up front; lookups never lock, new books are added under a mutex.
+ */
+class BookRegistry
+{
+private:
+  array<string, MAX_BOOKS> names; // book name of each id
+  atomic<int> count; // number of interned books
+  mutex registryMutex; // serializes interning
+
+public:
+  // ctor: intern the given books
+  BookRegistry(const vector<string>& books);
+
+  // Get the id of a book, -1 if the book is not interned
+  int Find(const string& book) const;
+
+  // Get the id of a book, interning it on first use
+  int Intern(const string& book);
+
+  // Get the name of a book id
+  const string& GetName(int id) const;
+
+};
+
+BookRegistry::BookRegistry(const vector<string>& books)
+: count(0)
+{
+  for (auto& book : books) {
+    Intern(book);
+  }
+}
+
+int BookRegistry::Find(const string& book) const
+{
+  int size = count.load(memory_order_acquire);
+  for (int id = 0; id < size; ++id) {
+    if (names[id] == book) return id;
+  }
+  return -1;
+}
+
+int BookRegistry::Intern(const string& book)
+{
+  int id = Find(book);
+  if (id >= 0) return id;
+  lock_guard<mutex> lock(registryMutex);
+  id = Find(book);
+  if (id >= 0) return id;
+  int size = count.load(memory_order_relaxed);
+  if (size == MAX_BOOKS) {
+    throw std::invalid_argument("Too many books, cannot add " + book);
+  }
+  names[size] = book;
+  count.store(size + 1, memory_order_release);
+  return size;
+}
+
+const string& BookRegistry::GetName(int id) const
+{
+  return names[id];
+}
+
+// the books of the trading system
+BookRegistry bookRegistry({"TRSY1", "TRSY2", "TRSY3"});
+
 /**
  * Position class in a particular book.
  * Type T is the product type.
@@ -32,21 +108,25 @@ public:
   const T& GetProduct() const;
 
   // Get the position quantity
-  long GetPosition(string &book);
+  long GetPosition(const string &book) const;
+  long GetPosition(int bookId) const;
 
   // Get the aggregate position
-  long GetAggregatePosition();
+  long GetAggregatePosition() const;
 
   //  send position to risk service through listener
   void AddPosition(string &book, long position);
+  void AddPosition(int bookId, long position);
 
-  // object printer
+  // object formatter
   template<typename U>
-  friend ostream& operator<<(ostream& os, const Position<U>& position);
+  friend void formatRecord(TextWriter& writer, const Position<U>& position);
 
 private:
   T product;
-  map<string,long> bookPositionMap;
+  array<long, MAX_BOOKS> bookPositions = {}; // position of each book, indexed by book id
+  unsigned int bookMask = 0; // books that have been traded, bit per book id
+  long aggregatePosition = 0; // running sum of the book positions
 
 };
 
@@ -64,54 +144,55 @@ const T& Position<T>::GetProduct() const
 }
 
 template<typename T>
-long Position<T>::GetPosition(string &book)
+long Position<T>::GetPosition(const string &book) const
 {
-  return bookPositionMap[book];
+  int bookId = bookRegistry.Find(book);
+  return (bookId < 0) ? 0 : bookPositions[bookId];
 }
 
 template<typename T>
-long Position<T>::GetAggregatePosition()
+long Position<T>::GetPosition(int bookId) const
 {
-  long sum = 0;
-  for (auto it = bookPositionMap.begin(); it != bookPositionMap.end(); ++it)
-  {
-    sum += it->second;
-  }
-  return sum;
+  return bookPositions[bookId];
+}
+
+template<typename T>
+long Position<T>::GetAggregatePosition() const
+{
+  return aggregatePosition;
 }
 
 template<typename T>
 void Position<T>::AddPosition(string &book, long position)
 {
-  if (bookPositionMap.find(book) == bookPositionMap.end())
-  {
-    bookPositionMap.insert(pair<string,long>(book,position));
-  }
-  else
+  AddPosition(bookRegistry.Intern(book), position);
+}
+
+template<typename T>
+void Position<T>::AddPosition(int bookId, long position)
+{
+  bookPositions[bookId] += position;
+  bookMask |= 1u << bookId;
+  aggregatePosition += position;
+}
+
+// format the fields of a position: product, then book and position of every traded book
+template<typename T>
+void formatRecord(TextWriter& writer, const Position<T>& position)
+{
+  writeFields(writer, position.GetProduct().GetProductId());
+  for (int bookId = 0; bookId < MAX_BOOKS; ++bookId)
   {
-    bookPositionMap[book] += position;
+    if (!(position.bookMask & (1u << bookId))) continue;
+    writer.Append(',');
+    writeFields(writer, bookRegistry.GetName(bookId), position.bookPositions[bookId]);
   }
 }
 
 template<typename T>
 ostream& operator<<(ostream& os, const Position<T>& position)
 {
-  T product = position.GetProduct();
-  string productId = product.GetProductId();
-	vector<string> _positions;
-	for (auto& p : position.bookPositionMap)
-	{
-		string _book = p.first;
-		string _position = to_string(p.second);
-		_positions.push_back(_book);
-		_positions.push_back(_position);
-	}
-	vector<string> _strings;
-	_strings.push_back(productId);
-	_strings.insert(_strings.end(), _positions.begin(), _positions.end());
-  string _str = join(_strings, ",");
-  os << _str;
-  return os;
+  return writeRecord(os, position);
 }
 
 // Pre-declaration of a listener used to subscribe data from trade booking service
@@ -127,7 +208,7 @@ template<typename T>
 class PositionService : public Service<string,Position <T> >
 {
 private:
-  map<string,Position<T>> positionMap;
+  PooledMap<ProductId, Position<T>> positionMap;
   vector<ServiceListener<Position<T>>*> listeners;
   PositionServiceListener<T>* positionlistener;
 
@@ -166,7 +247,7 @@ PositionService<T>::PositionService()
 template<typename T>
 Position<T>& PositionService<T>::GetData(string key)
 {
-  return positionMap[key];
+  return positionMap[ProductId(key)];
 }
 
 /**
@@ -204,22 +285,18 @@ template<typename T>
 void PositionService<T>::AddTrade(const Trade<T> &trade)
 {
   T product = trade.GetProduct();
-  string productId = product.GetProductId();
-  string book = trade.GetBook();
+  const ProductId& productId = product.GetProductId();
+  int bookId = bookRegistry.Intern(trade.GetBook());
   long quantity = (trade.GetSide() == BUY) ? trade.GetQuantity() : -trade.GetQuantity();
-  if (positionMap.find(productId) == positionMap.end())
-  {
-    Position<T> position(product);
-    position.AddPosition(book,quantity);
-    positionMap.insert(pair<string,Position<T>>(productId,position));
-  }
-  else
+  auto it = positionMap.find(productId);
+  if (it == positionMap.end())
   {
-    positionMap[productId].AddPosition(book,quantity);
+    it = positionMap.insert(pair<ProductId, Position<T>>(productId,Position<T>(product))).first;
   }
+  it->second.AddPosition(bookId,quantity);
   for (auto& listener: listeners)
   {
-    listener->ProcessAdd(positionMap[productId]);
+    listener->ProcessAdd(it->second);
   }
 
 }
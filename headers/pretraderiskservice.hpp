@@ -0,0 +1,657 @@
+/**
+ * pretraderiskservice.hpp
+ * Defines the data types and Service for the pre-trade risk gate between algo execution and execution.
+ *
+ * Every algo order is checked against the limits of its product before it reaches the execution service:
+ * order size, position of each book and of the product, PV01 of the product and of the portfolio,
+ * and an order rate throttle. The live positions and PV01s are pushed by the position and risk services
+ * into per-product atomics, so a check is a fixed number of relaxed loads with no lock and no allocation.
+ *
+ * @author Boyu Yang
+ */
+#ifndef PRETRADE_RISK_SERVICE_HPP
+#define PRETRADE_RISK_SERVICE_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "soa.hpp"
+#include "arena.hpp"
+#include "algoexecutionservice.hpp"
+#include "positionservice.hpp"
+#include "riskservice.hpp"
+#include "persistencewriter.hpp"
+#include "utils.hpp"
+#include "recordformat.hpp"
+
+using namespace std;
+
+// Reasons of a pre-trade reject
+enum RejectReason { ORDER_SIZE, BOOK_POSITION, PRODUCT_POSITION, PRODUCT_PV01, PORTFOLIO_PV01, ORDER_RATE, UNKNOWN_PRODUCT };
+
+const int REJECT_REASONS = 7;
+
+string rejectReasonName(RejectReason reason)
+{
+  switch (reason)
+  {
+    case ORDER_SIZE: return "ORDER_SIZE";
+    case BOOK_POSITION: return "BOOK_POSITION";
+    case PRODUCT_POSITION: return "PRODUCT_POSITION";
+    case PRODUCT_PV01: return "PRODUCT_PV01";
+    case PORTFOLIO_PV01: return "PORTFOLIO_PV01";
+    case ORDER_RATE: return "ORDER_RATE";
+    case UNKNOWN_PRODUCT: return "UNKNOWN_PRODUCT";
+  }
+  return "UNKNOWN";
+}
+
+/**
+ * Pre-trade limits of a product.
+ * Positions are in face value, PV01 limits in the units of PV01 x quantity used by the risk service.
+ * Position and PV01 limits only block orders that increase the exposure, an order reducing it always passes.
+ */
+struct RiskLimits
+{
+  long maxOrderSize; // visible plus hidden quantity of one order
+  long maxBookPosition; // absolute position of any book (the book of an algo order is assigned at booking)
+  long maxProductPosition; // absolute aggregate position of the product
+  double maxProductPV01; // absolute PV01 of the product position
+  double ordersPerSecond; // sustained order rate
+  double orderBurst; // orders that can be sent at once after an idle period
+};
+
+/**
+ * An algo order rejected by the pre-trade risk gate.
+ * Type T is the product type.
+ */
+template<typename T>
+class OrderReject
+{
+
+public:
+
+  // ctor for a reject
+  OrderReject(const ExecutionOrder<T> &_order, RejectReason _reason);
+
+  // Get the rejected order
+  const ExecutionOrder<T>& GetOrder() const;
+
+  // Get the reason of the reject
+  RejectReason GetReason() const;
+
+  // object printer
+  template<typename U>
+  friend ostream& operator<<(ostream& os, const OrderReject<U>& reject);
+
+private:
+  ExecutionOrder<T> order;
+  RejectReason reason;
+
+};
+
+template<typename T>
+OrderReject<T>::OrderReject(const ExecutionOrder<T> &_order, RejectReason _reason) :
+  order(_order), reason(_reason)
+{
+}
+
+template<typename T>
+const ExecutionOrder<T>& OrderReject<T>::GetOrder() const
+{
+  return order;
+}
+
+template<typename T>
+RejectReason OrderReject<T>::GetReason() const
+{
+  return reason;
+}
+
+// format the fields of a reject: reason, then the order
+template<typename T>
+void formatRecord(TextWriter& writer, const OrderReject<T>& reject)
+{
+  writeFields(writer, rejectReasonName(reject.GetReason()));
+  writer.Append(',');
+  formatRecord(writer, reject.GetOrder());
+}
+
+template<typename T>
+ostream& operator<<(ostream& os, const OrderReject<T>& reject)
+{
+  return writeRecord(os, reject);
+}
+
+/**
+ * Live state of a product seen by the gate.
+ * Positions and PV01 are written by the position and risk listeners and read by the gate with relaxed atomics,
+ * a check may thus see a position one update old, as any pre-trade check against an asynchronous booking flow.
+ * The throttle is only touched by the gate.
+ */
+struct ProductRiskState
+{
+  RiskLimits limits;
+  array<atomic<long>, MAX_BOOKS> bookPositions = {}; // position of each book, indexed by book id
+  atomic<long> aggregatePosition{0}; // position of the product
+  atomic<double> pv01{0.0}; // PV01 of one unit
+  atomic<double> risk{0.0}; // PV01 of the position, as last published by the risk service
+  double tokens = 0.0; // orders the throttle can still send
+  int64_t lastRefill = 0; // steady clock nanoseconds of the last refill
+
+  ProductRiskState(const RiskLimits& _limits) : limits(_limits), tokens(_limits.orderBurst) {}
+};
+
+// pre declaration of the listeners
+template<typename T>
+class PreTradeRiskServiceListener;
+
+template<typename T>
+class PreTradePositionListener;
+
+template<typename T>
+class PreTradePV01Listener;
+
+/**
+ * Pre-Trade Risk Service checking algo executions against risk limits and passing the accepted ones on.
+ * Listeners receive the accepted AlgoExecution<T>, reject listeners receive OrderReject<T>.
+ * Keyed on product identifier.
+ * Type T is the product type.
+ */
+template<typename T>
+class PreTradeRiskService : public Service<string, AlgoExecution<T>>
+{
+private:
+  PooledMap<ProductId, AlgoExecution<T>> algoExecutionMap; // last accepted algo execution keyed by product identifier
+  vector<ServiceListener<AlgoExecution<T>>*> listeners;
+  vector<ServiceListener<OrderReject<T>>*> rejectListeners;
+  PreTradeRiskServiceListener<T>* pretradelistener;
+  PreTradePositionListener<T>* positionlistener;
+  PreTradePV01Listener<T>* pv01listener;
+
+  // products and their live state, set up before the feeds start, the lookup is read-only afterwards
+  unordered_map<ProductId, size_t> productIndex;
+  deque<ProductRiskState> states;
+  double maxPortfolioPV01; // absolute PV01 of all positions
+  atomic<double> portfolioRisk{0.0};
+
+  // statistics of the gate, written by the gate only
+  long checks = 0;
+  array<long, REJECT_REASONS> rejects = {};
+  int64_t checkNanos = 0;
+
+  // find the state of a product, nullptr if it has no limits
+  ProductRiskState* FindState(const ProductId& productId);
+
+  // run the checks of an order at a steady clock time in nanoseconds, returns whether it passed and sets the reason otherwise
+  bool Check(const ExecutionOrder<T>& order, int64_t now, RejectReason& reason);
+
+public:
+  // ctor and dtor
+  PreTradeRiskService(double _maxPortfolioPV01);
+  ~PreTradeRiskService()=default;
+
+  // Get data on our service given a key
+  AlgoExecution<T>& GetData(string key);
+
+  // The callback that a Connector should invoke for any new or updated data
+  void OnMessage(AlgoExecution<T> &data);
+
+  // Add a listener to the Service for callbacks on add, remove, and update events
+  // for data to the Service.
+  void AddListener(ServiceListener<AlgoExecution<T>> *listener);
+
+  // Get all listeners on the Service.
+  const vector<ServiceListener<AlgoExecution<T>>*>& GetListeners() const;
+
+  // Add a listener to the rejected orders
+  void AddRejectListener(ServiceListener<OrderReject<T>> *listener);
+
+  // Get the listeners of algo executions, positions and risk
+  PreTradeRiskServiceListener<T>* GetPreTradeRiskServiceListener();
+  PreTradePositionListener<T>* GetPreTradePositionListener();
+  PreTradePV01Listener<T>* GetPreTradePV01Listener();
+
+  // Set the limits of a product, must be called before the feeds start
+  void SetLimits(const string& productId, const RiskLimits& limits);
+
+  // Check an algo execution and pass it on or reject it
+  void CheckOrder(AlgoExecution<T>& algoExecution);
+
+  // Update the live position of a product
+  void UpdatePosition(const Position<T>& position);
+
+  // Update the live PV01 of a product
+  void UpdatePV01(const PV01<T>& pv01);
+
+  // Get the statistics of the gate
+  long GetCheckCount() const;
+  long GetRejectCount(RejectReason reason) const;
+  double GetAverageCheckNanos() const;
+
+};
+
+template<typename T>
+PreTradeRiskService<T>::PreTradeRiskService(double _maxPortfolioPV01)
+: maxPortfolioPV01(_maxPortfolioPV01)
+{
+  pretradelistener = new PreTradeRiskServiceListener<T>(this);
+  positionlistener = new PreTradePositionListener<T>(this);
+  pv01listener = new PreTradePV01Listener<T>(this);
+}
+
+template<typename T>
+AlgoExecution<T>& PreTradeRiskService<T>::GetData(string key)
+{
+  return algoExecutionMap[ProductId(key)];
+}
+
+/**
+ * OnMessage() used to be called by an input connector to subscribe data from socket
+ * no need to implement here.
+ */
+template<typename T>
+void PreTradeRiskService<T>::OnMessage(AlgoExecution<T> &data)
+{
+}
+
+template<typename T>
+void PreTradeRiskService<T>::AddListener(ServiceListener<AlgoExecution<T>> *listener)
+{
+  listeners.push_back(listener);
+}
+
+template<typename T>
+const vector<ServiceListener<AlgoExecution<T>>*>& PreTradeRiskService<T>::GetListeners() const
+{
+  return listeners;
+}
+
+template<typename T>
+void PreTradeRiskService<T>::AddRejectListener(ServiceListener<OrderReject<T>> *listener)
+{
+  rejectListeners.push_back(listener);
+}
+
+template<typename T>
+PreTradeRiskServiceListener<T>* PreTradeRiskService<T>::GetPreTradeRiskServiceListener()
+{
+  return pretradelistener;
+}
+
+template<typename T>
+PreTradePositionListener<T>* PreTradeRiskService<T>::GetPreTradePositionListener()
+{
+  return positionlistener;
+}
+
+template<typename T>
+PreTradePV01Listener<T>* PreTradeRiskService<T>::GetPreTradePV01Listener()
+{
+  return pv01listener;
+}
+
+template<typename T>
+void PreTradeRiskService<T>::SetLimits(const string& productId, const RiskLimits& limits)
+{
+  ProductId key(productId);
+  auto it = productIndex.find(key);
+  if (it != productIndex.end()) {
+    states[it->second].limits = limits;
+    return;
+  }
+  productIndex[key] = states.size();
+  states.emplace_back(limits);
+}
+
+template<typename T>
+ProductRiskState* PreTradeRiskService<T>::FindState(const ProductId& productId)
+{
+  auto it = productIndex.find(productId);
+  return it == productIndex.end() ? nullptr : &states[it->second];
+}
+
+/**
+ * Check() runs the checks from the cheapest to the most expensive, each a constant number of loads:
+ * size, product position, book positions (over the fixed book array), PV01 of the product and the portfolio,
+ * then the throttle, so that orders rejected by a limit do not consume the order rate.
+ */
+template<typename T>
+bool PreTradeRiskService<T>::Check(const ExecutionOrder<T>& order, int64_t now, RejectReason& reason)
+{
+  ProductRiskState* state = FindState(order.GetProduct().GetProductId());
+  if (!state) {
+    reason = UNKNOWN_PRODUCT;
+    return false;
+  }
+  const RiskLimits& limits = state->limits;
+
+  long quantity = order.GetVisibleQuantity() + order.GetHiddenQuantity();
+  if (quantity <= 0 || quantity > limits.maxOrderSize) {
+    reason = ORDER_SIZE;
+    return false;
+  }
+  long signedQuantity = (order.GetSide() == BID) ? quantity : -quantity;
+
+  long aggregate = state->aggregatePosition.load(memory_order_relaxed);
+  long projected = aggregate + signedQuantity;
+  if (labs(projected) > limits.maxProductPosition && labs(projected) > labs(aggregate)) {
+    reason = PRODUCT_POSITION;
+    return false;
+  }
+
+  for (int bookId = 0; bookId < MAX_BOOKS; ++bookId) {
+    long book = state->bookPositions[bookId].load(memory_order_relaxed);
+    long projectedBook = book + signedQuantity;
+    if (labs(projectedBook) > limits.maxBookPosition && labs(projectedBook) > labs(book)) {
+      reason = BOOK_POSITION;
+      return false;
+    }
+  }
+
+  double pv01 = state->pv01.load(memory_order_relaxed);
+  double risk = pv01 * aggregate;
+  double projectedRisk = pv01 * projected;
+  if (fabs(projectedRisk) > limits.maxProductPV01 && fabs(projectedRisk) > fabs(risk)) {
+    reason = PRODUCT_PV01;
+    return false;
+  }
+  double portfolio = portfolioRisk.load(memory_order_relaxed);
+  double projectedPortfolio = portfolio + projectedRisk - risk;
+  if (fabs(projectedPortfolio) > maxPortfolioPV01 && fabs(projectedPortfolio) > fabs(portfolio)) {
+    reason = PORTFOLIO_PV01;
+    return false;
+  }
+
+  // token bucket: refill at the sustained rate up to the burst
+  if (state->lastRefill > 0) {
+    state->tokens = min(limits.orderBurst, state->tokens + (now - state->lastRefill) * 1e-9 * limits.ordersPerSecond);
+  }
+  state->lastRefill = now;
+  if (state->tokens < 1.0) {
+    reason = ORDER_RATE;
+    return false;
+  }
+  state->tokens -= 1.0;
+  return true;
+}
+
+/**
+ * CheckOrder() is called by the listener of the algo execution service.
+ * An accepted order is stored and flows to the listeners, a rejected one flows to the reject listeners only.
+ */
+template<typename T>
+void PreTradeRiskService<T>::CheckOrder(AlgoExecution<T>& algoExecution)
+{
+  const ExecutionOrder<T>& order = algoExecution.GetExecutionOrder();
+  // one clock read serves the throttle and the latency statistics
+  int64_t start = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+  RejectReason reason;
+  bool passed = Check(order, start, reason);
+  checkNanos += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count() - start;
+  checks++;
+
+  if (!passed) {
+    rejects[reason]++;
+    OrderReject<T> reject(order, reason);
+    for (auto& l : rejectListeners) {
+      l->ProcessAdd(reject);
+    }
+    return;
+  }
+
+  const ProductId& key = order.GetProduct().GetProductId();
+  if (algoExecutionMap.find(key) != algoExecutionMap.end()) {algoExecutionMap.erase(key);}
+  algoExecutionMap.insert(pair<ProductId, AlgoExecution<T>> (key, algoExecution));
+  for (auto& l : listeners) {
+    l->ProcessAdd(algoExecution);
+  }
+}
+
+template<typename T>
+void PreTradeRiskService<T>::UpdatePosition(const Position<T>& position)
+{
+  ProductRiskState* state = FindState(position.GetProduct().GetProductId());
+  if (!state) return;
+  for (int bookId = 0; bookId < MAX_BOOKS; ++bookId) {
+    state->bookPositions[bookId].store(position.GetPosition(bookId), memory_order_relaxed);
+  }
+  state->aggregatePosition.store(position.GetAggregatePosition(), memory_order_relaxed);
+}
+
+template<typename T>
+void PreTradeRiskService<T>::UpdatePV01(const PV01<T>& pv01)
+{
+  ProductRiskState* state = FindState(pv01.GetProduct().GetProductId());
+  if (!state) return;
+  double risk = pv01.GetPV01() * pv01.GetQuantity();
+  double change = risk - state->risk.exchange(risk, memory_order_relaxed);
+  state->pv01.store(pv01.GetPV01(), memory_order_relaxed);
+  double portfolio = portfolioRisk.load(memory_order_relaxed);
+  while (!portfolioRisk.compare_exchange_weak(portfolio, portfolio + change, memory_order_relaxed)) {}
+}
+
+template<typename T>
+long PreTradeRiskService<T>::GetCheckCount() const
+{
+  return checks;
+}
+
+template<typename T>
+long PreTradeRiskService<T>::GetRejectCount(RejectReason reason) const
+{
+  return rejects[reason];
+}
+
+template<typename T>
+double PreTradeRiskService<T>::GetAverageCheckNanos() const
+{
+  return checks > 0 ? static_cast<double>(checkNanos) / checks : 0.0;
+}
+
+/**
+ * Pre-Trade Risk Service Listener subscribing data from Algo Execution Service to Pre-Trade Risk Service.
+ * Type T is the product type.
+ */
+template<typename T>
+class PreTradeRiskServiceListener : public ServiceListener<AlgoExecution<T>>
+{
+private:
+  PreTradeRiskService<T>* service;
+
+public:
+  // ctor
+  PreTradeRiskServiceListener(PreTradeRiskService<T>* _service);
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(AlgoExecution<T> &data) override;
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(AlgoExecution<T> &data) override;
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(AlgoExecution<T> &data) override;
+
+};
+
+template<typename T>
+PreTradeRiskServiceListener<T>::PreTradeRiskServiceListener(PreTradeRiskService<T>* _service)
+{
+  service = _service;
+}
+
+template<typename T>
+void PreTradeRiskServiceListener<T>::ProcessAdd(AlgoExecution<T> &data)
+{
+  service->CheckOrder(data);
+}
+
+template<typename T>
+void PreTradeRiskServiceListener<T>::ProcessRemove(AlgoExecution<T> &data)
+{
+}
+
+template<typename T>
+void PreTradeRiskServiceListener<T>::ProcessUpdate(AlgoExecution<T> &data)
+{
+}
+
+/**
+ * Pre-Trade Position Listener subscribing positions from Position Service to Pre-Trade Risk Service.
+ * Type T is the product type.
+ */
+template<typename T>
+class PreTradePositionListener : public ServiceListener<Position<T>>
+{
+private:
+  PreTradeRiskService<T>* service;
+
+public:
+  // ctor
+  PreTradePositionListener(PreTradeRiskService<T>* _service);
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(Position<T> &data) override;
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(Position<T> &data) override;
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(Position<T> &data) override;
+
+};
+
+template<typename T>
+PreTradePositionListener<T>::PreTradePositionListener(PreTradeRiskService<T>* _service)
+{
+  service = _service;
+}
+
+template<typename T>
+void PreTradePositionListener<T>::ProcessAdd(Position<T> &data)
+{
+  service->UpdatePosition(data);
+}
+
+template<typename T>
+void PreTradePositionListener<T>::ProcessRemove(Position<T> &data)
+{
+}
+
+template<typename T>
+void PreTradePositionListener<T>::ProcessUpdate(Position<T> &data)
+{
+  service->UpdatePosition(data);
+}
+
+/**
+ * Pre-Trade PV01 Listener subscribing risk from Risk Service to Pre-Trade Risk Service.
+ * Type T is the product type.
+ */
+template<typename T>
+class PreTradePV01Listener : public ServiceListener<PV01<T>>
+{
+private:
+  PreTradeRiskService<T>* service;
+
+public:
+  // ctor
+  PreTradePV01Listener(PreTradeRiskService<T>* _service);
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(PV01<T> &data) override;
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(PV01<T> &data) override;
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(PV01<T> &data) override;
+
+};
+
+template<typename T>
+PreTradePV01Listener<T>::PreTradePV01Listener(PreTradeRiskService<T>* _service)
+{
+  service = _service;
+}
+
+template<typename T>
+void PreTradePV01Listener<T>::ProcessAdd(PV01<T> &data)
+{
+  service->UpdatePV01(data);
+}
+
+template<typename T>
+void PreTradePV01Listener<T>::ProcessRemove(PV01<T> &data)
+{
+}
+
+template<typename T>
+void PreTradePV01Listener<T>::ProcessUpdate(PV01<T> &data)
+{
+  service->UpdatePV01(data);
+}
+
+/**
+ * Reject Listener writing the rejected orders to a result file through the persistence writer.
+ * Rejects come from the gate only, which is the single producer of the channel.
+ * Type T is the product type.
+ */
+template<typename T>
+class RejectFileListener : public ServiceListener<OrderReject<T>>
+{
+private:
+  PersistenceChannel* channel;
+  TimestampFormatter formatter; // timestamps of the lines
+
+public:
+  // ctor
+  RejectFileListener(PersistenceWriter* writer, const string& fileName);
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(OrderReject<T> &data) override;
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(OrderReject<T> &data) override;
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(OrderReject<T> &data) override;
+
+};
+
+template<typename T>
+RejectFileListener<T>::RejectFileListener(PersistenceWriter* writer, const string& fileName)
+{
+  channel = writer->OpenChannel(fileName);
+}
+
+template<typename T>
+void RejectFileListener<T>::ProcessAdd(OrderReject<T> &data)
+{
+  char text[TIMESTAMP_LENGTH + RECORD_TEXT_CAPACITY];
+  size_t length = formatter.Format(tscClock.Now(), text);
+  TextWriter writer(text + length, sizeof(text) - length);
+  writer.Append(',');
+  formatRecord(writer, data);
+  writer.Append('\n');
+  channel->Write(text, length + writer.Size());
+}
+
+template<typename T>
+void RejectFileListener<T>::ProcessRemove(OrderReject<T> &data)
+{
+}
+
+template<typename T>
+void RejectFileListener<T>::ProcessUpdate(OrderReject<T> &data)
+{
+}
+
+#endif
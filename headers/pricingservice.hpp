@@ -15,7 +15,11 @@
 #include <chrono>
 
 #include "soa.hpp"
+#include "arena.hpp"
+#include "productregistry.hpp"
 #include "utils.hpp"
+#include "servercontext.hpp"
+#include "recordformat.hpp"
 
 /**
  * A price object consisting of mid and bid/offer spread.
@@ -76,24 +80,17 @@ double Price<T>::GetBidOfferSpread() const
   return bidOfferSpread;
 }
 
+// format the fields of a price: product, mid, bid/offer spread
+template<typename T>
+void formatRecord(TextWriter& writer, const Price<T>& price)
+{
+  writeFields(writer, price.GetProduct().GetProductId(), PriceField{price.GetMid()}, PriceField{price.GetBidOfferSpread()});
+}
+
 template<typename T>
 ostream& operator<<(ostream& os, const Price<T>& price)
 {
-  T product = price.GetProduct();
-	string _product = product.GetProductId();
-  double mid = price.GetMid();
-  double bidOfferSpread = price.GetBidOfferSpread();
-	string _mid = convertPrice(mid);
-	string _bidOfferSpread = convertPrice(bidOfferSpread);
-
-	vector<string> _strings;
-	_strings.push_back(_product);
-	_strings.push_back(_mid);
-	_strings.push_back(_bidOfferSpread);
-  string _str = join(_strings, ",");
-  os << _str;
-
-  return os;
+  return writeRecord(os, price);
 }
 
 // forward declaration of PriceDataConnector
@@ -109,7 +106,7 @@ template<typename T>
 class PricingService : public Service<string, Price<T>>
 {
 private:
-  map<string, Price<T>> priceMap; // store price data keyed by product identifier
+  PooledMap<ProductId, Price<T>> priceMap; // store price data keyed by product identifier
   vector<ServiceListener<Price<T>>*> listeners; // list of listeners to this service
   string host; // host name for inbound connector
   string port; // port number for inbound connector
@@ -117,7 +114,7 @@ private:
 
 public:
   // ctor
-  PricingService(const string& _host, const string& _port);
+  PricingService(const Strand& _strand, const string& _host, const string& _port);
   // dtor
   ~PricingService() = default;
 
@@ -141,23 +138,23 @@ public:
 };
 
 template<typename T>
-PricingService<T>::PricingService(const string& _host, const string& _port)
+PricingService<T>::PricingService(const Strand& _strand, const string& _host, const string& _port)
 : host(_host), port(_port)
 {
-  connector = new PriceDataConnector<T>(this, host, port); // connector related to this server
+  connector = new PriceDataConnector<T>(this, _strand, host, port); // connector related to this server
 }
 
 template<typename T>
 Price<T>& PricingService<T>::GetData(string key)
 {
-  return priceMap[key];
+  return priceMap[ProductId(key)];
 }
 
 template<typename T>
 void PricingService<T>::OnMessage(Price<T> &data)
 {
     // flow data
-    string key = data.GetProduct().GetProductId();
+    const ProductId& key = data.GetProduct().GetProductId();
     // update the price map
     if (priceMap.find(key) != priceMap.end()) {priceMap.erase(key);}
     priceMap.insert(pair<string, Price<Bond> > (key, data));
@@ -197,47 +194,54 @@ private:
   PricingService<T>* service; 
   string host; // host name
   string port; // port number
-  boost::asio::io_service io_service; // io service
-  boost::asio::ip::tcp::socket socket; // socket
+  Strand strand; // strand serializing the handlers of this feed
+  boost::asio::ip::tcp::acceptor acceptor; // acceptor listening on host:port
 
   void handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request);
-  void start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service);
+  void start_accept();
 
 public:
   // ctor
-  PriceDataConnector(PricingService<T>* _service, const string& _host, const string& _port);
+  PriceDataConnector(PricingService<T>* _service, const Strand& _strand, const string& _host, const string& _port);
   // dtor
   ~PriceDataConnector();
 
   // Publish data to the Connector
   void Publish(Price<T> &data) override;
 
-  // Subscribe data from socket
+  // Subscribe data from socket, handlers run on the shared server context
   void Subscribe();
 
 };
 
 template<typename T>
-PriceDataConnector<T>::PriceDataConnector(PricingService<T>* _service, const string& _host, const string& _port)
-: service(_service), host(_host), port(_port), socket(io_service)
+PriceDataConnector<T>::PriceDataConnector(PricingService<T>* _service, const Strand& _strand, const string& _host, const string& _port)
+: service(_service), host(_host), port(_port), strand(_strand), acceptor(_strand)
 {
 }
 
 template<typename T>
 PriceDataConnector<T>::~PriceDataConnector()
 {
-    socket.close();
+  acceptor.close();
 }
 
 template<typename T>
-void PriceDataConnector<T>::start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service) {
-  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(*io_service);
-  acceptor->async_accept(*socket, [this, socket, acceptor, io_service](const boost::system::error_code& ec) {
+void PriceDataConnector<T>::start_accept() {
+  // sockets live on the feed's strand, so all handlers of a connection run in order
+  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(strand);
+  acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      delete socket; // acceptor closed, stop accepting
+      return;
+    }
     if (!ec) {
       boost::asio::streambuf* request = new boost::asio::streambuf;
       boost::asio::async_read_until(*socket, *request, "\n", std::bind(&PriceDataConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
+    } else {
+      delete socket;
     }
-    start_accept(acceptor, io_service); // accept the next connection
+    start_accept(); // accept the next connection
   });
 }
 
@@ -245,44 +249,26 @@ template<typename T>
 void PriceDataConnector<T>::handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request) {
   if (!ec) {
     // get the entire data
-    std::string data = std::string(boost::asio::buffers_begin(request->data()), boost::asio::buffers_end(request->data()));
-    // find the last newline
-    std::size_t last_newline = data.rfind('\n');
-    if (last_newline != std::string::npos) {
-      // consume only up to the last newline
-      request->consume(last_newline + 1);
-      // only process the data up to the last newline
-      data = data.substr(0, last_newline);
-    } else {
-      // if there's no newline, don't process any data
-      data.clear();
-    }
-
-    // split the data into lines
-    std::stringstream ss(data);
-    std::string line;
-    while (std::getline(ss, line)) {
+    // parse the complete lines in place, the fields view the buffer until it is consumed
+    string_view data(static_cast<const char*>(request->data().data()), request->size());
+    ArenaScope scope(threadArena());
+    ArenaVector<string_view> lineData{ArenaAllocator<string_view>(threadArena())};
+    size_t parsed = forEachLine(data, [&](string_view line) {
       // process each line
-      vector<string> lineData;
-      stringstream lineStream(line); // turn the line into a stream
-      string word;
-      while (getline(lineStream, word, ','))  
-      {
-        lineData.push_back(word);
-      }
-      string timestamp = lineData[0];
-      string productId = lineData[1];
+      splitFields(line, lineData);
       double bid = convertPrice(lineData[2]);
       double ask = convertPrice(lineData[3]);
-      double spread = stod(lineData[4]);
+      double spread = parseDecimal(lineData[4]);
       double mid = (bid + ask) / 2.0;
-      // create product object based on product id
-      T product = getProductObject<T>(productId);
+      // get the product object of the product id, built once
+      const T& product = lookupProduct<T>(lineData[1]);
       // create price object based on product, mid price and bid/offer spread
       Price<T> price(product, mid, spread);
       // publish data to service
       service->OnMessage(price);
-    }
+    });
+    // only the complete lines are consumed
+    request->consume(parsed);
 
     boost::asio::async_read_until(*socket, *request, "\n", std::bind(&PriceDataConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
   } else {
@@ -301,18 +287,19 @@ void PriceDataConnector<T>::Subscribe()
 {
   log(LogLevel::NOTE, "Price data server listening on " + host + ":" + port);
   try {
-  // connect to the socket
-  boost::asio::ip::tcp::resolver resolver(io_service);
-  boost::asio::ip::tcp::resolver::query query(host, port);
-  boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-  boost::asio::ip::tcp::acceptor acceptor(io_service, endpoint);
-  start_accept(&acceptor, &io_service);
-  io_service.run();
+  // bind the acceptor on the shared server context, the worker pool runs the handlers
+  boost::asio::ip::tcp::resolver resolver(strand);
+  boost::asio::ip::tcp::endpoint endpoint = resolver.resolve(host, port)->endpoint();
+  acceptor.open(endpoint.protocol());
+  acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  acceptor.bind(endpoint);
+  acceptor.listen();
+  start_accept();
   }
   catch (std::exception& e){
     // throw error log
     log(LogLevel::ERROR, e.what());
-    socket.close();
+    acceptor.close();
     return;
   }
 }
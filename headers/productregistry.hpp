@@ -0,0 +1,137 @@
+/**
+ * productregistry.hpp
+ * Defines the registry interning the products of the system behind dense handles.
+ *
+ * @author Boyu Yang
+ */
+#ifndef PRODUCT_REGISTRY_HPP
+#define PRODUCT_REGISTRY_HPP
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+
+#include "fixedstring.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+// Handle of a registered product
+typedef uint16_t ProductHandle;
+
+// Handle of a product missing from the registry
+const ProductHandle INVALID_PRODUCT_HANDLE = 0xFFFF;
+
+// Number of products a registry can hold
+const size_t PRODUCT_REGISTRY_CAPACITY = 256;
+
+/**
+ * Product Registry: interns the products of one type behind dense handles.
+ * Products are registered once and never removed, so a handle stays valid for the life of the process.
+ * Registration takes a lock; Find and Get read the published products without one.
+ * Type T is the product type.
+ */
+template<typename T>
+class ProductRegistry
+{
+private:
+  ProductId ids[PRODUCT_REGISTRY_CAPACITY]; // identifiers of the registered products, scanned by Find
+  T products[PRODUCT_REGISTRY_CAPACITY]; // registered products
+  atomic<uint32_t> count; // products registered, published with release semantics
+  mutex registerMutex; // serializes registrations
+
+public:
+  // ctor
+  ProductRegistry();
+
+  // Register a product, returns the handle of the product if it is already registered
+  ProductHandle Register(const T& product);
+
+  // Find the handle of a product, INVALID_PRODUCT_HANDLE if it is not registered
+  ProductHandle Find(const ProductId& productId) const;
+
+  // Get a registered product
+  const T& Get(ProductHandle handle) const;
+
+  // Get the number of registered products
+  size_t Size() const;
+
+};
+
+template<typename T>
+ProductRegistry<T>::ProductRegistry()
+: count(0)
+{
+}
+
+template<typename T>
+ProductHandle ProductRegistry<T>::Register(const T& product)
+{
+  const ProductId& productId = product.GetProductId();
+  ProductHandle handle = Find(productId);
+  if (handle != INVALID_PRODUCT_HANDLE) return handle;
+
+  lock_guard<mutex> lock(registerMutex);
+  uint32_t size = count.load(memory_order_relaxed);
+  // another thread may have registered the product since the scan
+  for (uint32_t i = 0; i < size; ++i) {
+    if (ids[i] == productId) return static_cast<ProductHandle>(i);
+  }
+  if (size == PRODUCT_REGISTRY_CAPACITY) {
+    throw std::invalid_argument("Product registry is full, cannot register " + productId);
+  }
+  ids[size] = productId;
+  products[size] = product;
+  count.store(size + 1, memory_order_release);
+  return static_cast<ProductHandle>(size);
+}
+
+template<typename T>
+ProductHandle ProductRegistry<T>::Find(const ProductId& productId) const
+{
+  // the universe is a handful of products, a scan over the inline identifiers beats a hash lookup
+  uint32_t size = count.load(memory_order_acquire);
+  for (uint32_t i = 0; i < size; ++i) {
+    if (ids[i] == productId) return static_cast<ProductHandle>(i);
+  }
+  return INVALID_PRODUCT_HANDLE;
+}
+
+template<typename T>
+const T& ProductRegistry<T>::Get(ProductHandle handle) const
+{
+  if (handle >= count.load(memory_order_acquire)) {
+    throw std::invalid_argument("Unknown product handle: " + to_string(handle));
+  }
+  return products[handle];
+}
+
+template<typename T>
+size_t ProductRegistry<T>::Size() const
+{
+  return count.load(memory_order_acquire);
+}
+
+// Get the registry of the products of a type
+template<typename T>
+ProductRegistry<T>& productRegistry()
+{
+  static ProductRegistry<T> registry;
+  return registry;
+}
+
+// Get a product by identifier, built with getProductObject and registered on its first lookup
+template<typename T>
+const T& lookupProduct(string_view productId)
+{
+  ProductRegistry<T>& registry = productRegistry<T>();
+  ProductHandle handle = registry.Find(ProductId(productId));
+  if (handle == INVALID_PRODUCT_HANDLE) {
+    handle = registry.Register(getProductObject<T>(string(productId)));
+  }
+  return registry.Get(handle);
+}
+
+#endif
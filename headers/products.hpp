@@ -12,6 +12,7 @@
 #include <string>
 
 #include "boost/date_time/gregorian/gregorian.hpp"
+#include "fixedstring.hpp"
 
 using namespace std;
 using namespace boost::gregorian;
@@ -30,13 +31,13 @@ public:
   Product(string _productId, ProductType _productType);
 
   // Return the product identifier
-  string GetProductId() const;
+  const ProductId& GetProductId() const;
 
   // Return the Product Type for this Product
   ProductType GetProductType() const;
 
 private:
-  string productId; // product id variable
+  ProductId productId; // product id variable
   ProductType productType; // product type variable
 };
 
@@ -180,11 +181,11 @@ private:
 
 Product::Product(string _productId, ProductType _productType)
 {
-  productId = _productId;
+  productId.assign(_productId);
   productType = _productType;
 }
 
-string Product::GetProductId() const
+const ProductId& Product::GetProductId() const
 {
   return productId;
 }
@@ -202,7 +203,7 @@ Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, float _cou
   maturityDate = _maturityDate;
 }
 
-Bond::Bond() : Product(0, BOND)
+Bond::Bond() : Product("", BOND)
 {
 }
 
@@ -247,7 +248,7 @@ IRSwap::IRSwap(string _productId, DayCountConvention _fixedLegDayCountConvention
   swapLegType = _swapLegType;
 }
 
-IRSwap::IRSwap() : Product(0, IRSWAP)
+IRSwap::IRSwap() : Product("", IRSWAP)
 {
 }
 
@@ -465,7 +466,7 @@ Future::Future(string _productId, FutureType _futuretype, InterestRateFutureType
   futuresContractDate = _futuresContractDate;
 } 
 
-Future::Future() : Product(0, FUTURE)
+Future::Future() : Product("", FUTURE)
 {
 }
 
@@ -0,0 +1,207 @@
+/**
+ * recordformat.hpp
+ * Defines the text writer formatting records into caller buffers without allocation.
+ *
+ * Each record type has a formatRecord(TextWriter&, const Record&) next to its class, which lists its
+ * fields in one writeFields call, so the layout of a record is fixed at compile time and every field
+ * is written straight into the buffer: integers and doubles with to_chars, prices in the fractional
+ * notation of convertPrice, strings with a copy. The operator<< of a record, the historical text
+ * outputs and the GUI output all go through it, and produce the same text as before.
+ *
+ * @author Boyu Yang
+ */
+#ifndef RECORD_FORMAT_HPP
+#define RECORD_FORMAT_HPP
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <ostream>
+#include <type_traits>
+
+using namespace std;
+
+// Buffer size of a formatted record, enough for every record type of the system
+const size_t RECORD_TEXT_CAPACITY = 512;
+
+// Decimals of a double field, the precision of to_string
+const int RECORD_DOUBLE_PRECISION = 6;
+
+/**
+ * Text Writer appending to a fixed caller buffer.
+ * Text beyond the capacity is cut off and the writer is marked as truncated.
+ */
+class TextWriter
+{
+private:
+  char* begin;
+  char* cursor;
+  char* end;
+  bool truncated;
+
+public:
+  // ctor
+  TextWriter(char* buffer, size_t capacity);
+
+  // Append a character
+  void Append(char c);
+
+  // Append a string
+  void Append(string_view text);
+
+  // Append an integer
+  void AppendInteger(long long value);
+
+  // Append a double in fixed notation
+  void AppendDouble(double value, int precision = RECORD_DOUBLE_PRECISION);
+
+  // Append a price in fractional notation (e.g. 99-16+), the output of convertPrice
+  void AppendPrice(double price);
+
+  // Get the text
+  const char* Data() const;
+  size_t Size() const;
+  string_view View() const;
+
+  // Whether text was cut off
+  bool IsTruncated() const;
+
+  // Forget the text, the buffer is reused
+  void Clear();
+
+};
+
+TextWriter::TextWriter(char* buffer, size_t capacity)
+: begin(buffer), cursor(buffer), end(buffer + capacity), truncated(false)
+{
+}
+
+void TextWriter::Append(char c)
+{
+  if (cursor == end) {
+    truncated = true;
+    return;
+  }
+  *cursor++ = c;
+}
+
+void TextWriter::Append(string_view text)
+{
+  size_t size = text.size();
+  if (size > static_cast<size_t>(end - cursor)) {
+    size = end - cursor;
+    truncated = true;
+  }
+  memcpy(cursor, text.data(), size);
+  cursor += size;
+}
+
+void TextWriter::AppendInteger(long long value)
+{
+  auto result = to_chars(cursor, end, value);
+  if (result.ec != errc()) {
+    truncated = true;
+    return;
+  }
+  cursor = result.ptr;
+}
+
+void TextWriter::AppendDouble(double value, int precision)
+{
+  auto result = to_chars(cursor, end, value, chars_format::fixed, precision);
+  if (result.ec != errc()) {
+    truncated = true;
+    return;
+  }
+  cursor = result.ptr;
+}
+
+void TextWriter::AppendPrice(double price)
+{
+  // same rounding as convertPrice: the handle, the 32nds and the eighths of a 32nd (4 is written as +)
+  int intPart = floor(price);
+  double fraction = price - intPart;
+  int xy = floor(fraction * 32);
+  int z = static_cast<int>((fraction * 256)) % 8;
+  AppendInteger(intPart);
+  Append('-');
+  if (xy < 10) Append('0');
+  AppendInteger(xy);
+  if (z == 4) Append('+');
+  else AppendInteger(z);
+}
+
+const char* TextWriter::Data() const
+{
+  return begin;
+}
+
+size_t TextWriter::Size() const
+{
+  return cursor - begin;
+}
+
+string_view TextWriter::View() const
+{
+  return string_view(begin, cursor - begin);
+}
+
+bool TextWriter::IsTruncated() const
+{
+  return truncated;
+}
+
+void TextWriter::Clear()
+{
+  cursor = begin;
+  truncated = false;
+}
+
+// a price field, written in fractional notation
+struct PriceField
+{
+  double value;
+};
+
+// write one field, dispatched on its type at compile time
+template<typename F>
+void writeField(TextWriter& writer, const F& field)
+{
+  if constexpr (is_same_v<F, PriceField>) {
+    writer.AppendPrice(field.value);
+  }
+  else if constexpr (is_same_v<F, char>) {
+    writer.Append(field);
+  }
+  else if constexpr (is_floating_point_v<F>) {
+    writer.AppendDouble(field);
+  }
+  else if constexpr (is_integral_v<F>) {
+    writer.AppendInteger(field);
+  }
+  else {
+    writer.Append(string_view(field));
+  }
+}
+
+// write fields separated by commas
+template<typename F, typename... Fields>
+void writeFields(TextWriter& writer, const F& field, const Fields&... fields)
+{
+  writeField(writer, field);
+  ((writer.Append(','), writeField(writer, fields)), ...);
+}
+
+// print a record through its formatRecord into a stack buffer
+template<typename R>
+ostream& writeRecord(ostream& os, const R& record)
+{
+  char buffer[RECORD_TEXT_CAPACITY];
+  TextWriter writer(buffer, sizeof(buffer));
+  formatRecord(writer, record);
+  return os.write(writer.Data(), writer.Size());
+}
+
+#endif
@@ -0,0 +1,365 @@
+/**
+ * riskanalytics.hpp
+ * Defines the risk analytics engine computing PV01, DV01, duration and convexity of fixed coupon bonds.
+ *
+ * Products are stored as a structure of arrays, and every measure has a closed form:
+ * with per-period yield r = y/f, n periods, coupon c = F*coupon/f and v = 1/(1+r),
+ *   P   = c*(1-v^n)/r + F*v^n
+ *   P'  = c*A'(r) - F*n*v^(n+1)                     (derivatives in r, divided by f and f^2 for y)
+ *   P'' = c*A''(r) + F*n*(n+1)*v^(n+2)
+ * where A(r) = (1-v^n)/r is the annuity factor. A product costs two pow() calls (at y and y+1bp)
+ * instead of two loops over its coupon periods. Yields are assumed to be non-zero.
+ * Yields are implied from prices with Newton's method on the same closed form, warm-started at the
+ * current yield of each product, which is a few ticks away from the solution on a live feed.
+ *
+ * @author Boyu Yang
+ */
+#ifndef RISK_ANALYTICS_HPP
+#define RISK_ANALYTICS_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include <stdexcept>
+#include "fixedstring.hpp"
+
+using namespace std;
+
+// One basis point
+const double BASIS_POINT = 0.0001;
+
+// Convergence threshold and iteration limit of the yield solver
+const double YIELD_TOLERANCE = 1e-12;
+const int MAX_YIELD_ITERATIONS = 50;
+
+/**
+ * Static data and initial yield of a bond on the treasury curve.
+ */
+struct TreasuryCurvePoint
+{
+  string productId;
+  double coupon;
+  double yield;
+  int yearsToMaturity;
+};
+
+// Current yield for 2,3,5,7,10,20,30 year US treasury bonds: 0.0464, 0.0440, 0.0412, 0.043, 0.0428, 0.0461, 0.0443
+const vector<TreasuryCurvePoint> treasuryCurve = {
+  {"9128283H1", 0.01750, 0.0464, 2},
+  {"9128283L2", 0.01875, 0.0440, 3},
+  {"912828M80", 0.02000, 0.0412, 5},
+  {"9128283J7", 0.02125, 0.0430, 7},
+  {"9128283F5", 0.02250, 0.0428, 10},
+  {"912810TW8", 0.02500, 0.0461, 20},
+  {"912810RZ3", 0.02750, 0.0443, 30},
+};
+
+/**
+ * Risk Analytics engine for a universe of fixed coupon bonds.
+ * Inputs and results are kept in parallel arrays indexed by product, so the batch kernel runs
+ * branch-free over contiguous memory. A yield change only recomputes the product it belongs to.
+ * All measures are per face value (1000 by default, the unit of the PV01 values in the system).
+ */
+class RiskAnalytics
+{
+private:
+  double faceValue; // face value of one unit
+  double frequency; // coupon payments per year
+  unordered_map<ProductId, size_t> productIndex; // product identifier -> index
+  vector<string> productIds; // index -> product identifier
+
+  // inputs
+  vector<double> coupons; // annual coupon rates
+  vector<double> periods; // number of coupon periods to maturity
+  vector<double> yields; // annual yields
+
+  // results
+  vector<double> prices; // price per face value
+  vector<double> pv01s; // price change for a one basis point rise in yield
+  vector<double> dv01s; // analytic dollar value of a basis point (-dP/dy * 1bp)
+  vector<double> durations; // modified duration in years
+  vector<double> convexities; // convexity in years^2
+
+  // recompute the products in [begin, end)
+  void Compute(size_t begin, size_t end);
+
+public:
+  // ctor
+  RiskAnalytics(double _faceValue = 1000.0, int _frequency = 2);
+
+  // Add a product to the universe, returns its index
+  size_t AddProduct(const string& productId, double coupon, double yield, int yearsToMaturity);
+
+  // Add all the bonds of a curve
+  void AddCurve(const vector<TreasuryCurvePoint>& curve);
+
+  // Get the index of a product, -1 if the product is unknown
+  int GetProductIndex(string_view productId) const;
+
+  // Get the product identifier of an index
+  const string& GetProductId(size_t index) const;
+
+  // Get the number of products
+  size_t GetSize() const;
+
+  // Set the yield of a product and recompute its risk
+  void SetYield(size_t index, double yield);
+
+  // Set the yields of all products (in index order) and recompute them as a batch
+  void SetYields(const vector<double>& _yields);
+
+  // Recompute the whole universe
+  void Recompute();
+
+  // Get the results of a product
+  double GetYield(size_t index) const;
+  double GetPrice(size_t index) const;
+  double GetPV01(size_t index) const;
+  double GetDV01(size_t index) const;
+  double GetDuration(size_t index) const;
+  double GetConvexity(size_t index) const;
+
+  // Get the PV01 of a product by identifier
+  double GetPV01(const string& productId) const;
+
+  // Price at a yield, in closed form (per face value)
+  double PriceAt(size_t index, double yield) const;
+
+  // Get the face value
+  double GetFaceValue() const;
+
+  // Get the time to maturity of a product in years
+  double GetMaturity(size_t index) const;
+
+  // Solve the yield of a product at a price (per face value), starting from its current yield
+  double SolveYield(size_t index, double price) const;
+
+  // Solve the yields of all products at their prices (in index order) as a batch, starting from their
+  // current yields, the results are not applied
+  void SolveYields(const vector<double>& _prices, vector<double>& _yields) const;
+
+};
+
+// price of a bond per face value, in closed form
+// a zero per-period yield degenerates to the sum of the cash flows
+double annuityPrice(double face, double coupon, double n, double r)
+{
+  double vn = pow(1.0 + r, -n);
+  double annuity = fabs(r) > 1e-12 ? (1.0 - vn) / r : n;
+  return coupon * annuity + face * vn;
+}
+
+// one Newton step of the yield solver: price error over price derivative, in yield units
+double yieldNewtonStep(double face, double coupon, double n, double f, double yield, double price)
+{
+  double r = yield / f;
+  double v = 1.0 / (1.0 + r);
+  double vn = pow(v, n);
+  double g = 1.0 - vn;
+  double g1 = n * vn * v;
+  double p = coupon * g / r + face * vn;
+  double dp = (coupon * (g1 / r - g / (r * r)) - face * g1) / f;
+  return (p - price) / dp;
+}
+
+RiskAnalytics::RiskAnalytics(double _faceValue, int _frequency)
+: faceValue(_faceValue), frequency(_frequency)
+{
+}
+
+size_t RiskAnalytics::AddProduct(const string& productId, double coupon, double yield, int yearsToMaturity)
+{
+  ProductId key(productId);
+  auto it = productIndex.find(key);
+  if (it != productIndex.end()) {
+    throw std::invalid_argument("Product already in the risk universe: " + productId);
+  }
+  size_t index = productIds.size();
+  productIndex[key] = index;
+  productIds.push_back(productId);
+  coupons.push_back(coupon);
+  periods.push_back(yearsToMaturity * frequency);
+  yields.push_back(yield);
+  prices.push_back(0.0);
+  pv01s.push_back(0.0);
+  dv01s.push_back(0.0);
+  durations.push_back(0.0);
+  convexities.push_back(0.0);
+  Compute(index, index + 1);
+  return index;
+}
+
+void RiskAnalytics::AddCurve(const vector<TreasuryCurvePoint>& curve)
+{
+  for (auto& point : curve) {
+    AddProduct(point.productId, point.coupon, point.yield, point.yearsToMaturity);
+  }
+}
+
+int RiskAnalytics::GetProductIndex(string_view productId) const
+{
+  auto it = productIndex.find(ProductId(productId));
+  return it == productIndex.end() ? -1 : static_cast<int>(it->second);
+}
+
+const string& RiskAnalytics::GetProductId(size_t index) const
+{
+  return productIds[index];
+}
+
+size_t RiskAnalytics::GetSize() const
+{
+  return productIds.size();
+}
+
+void RiskAnalytics::SetYield(size_t index, double yield)
+{
+  yields[index] = yield;
+  Compute(index, index + 1);
+}
+
+void RiskAnalytics::SetYields(const vector<double>& _yields)
+{
+  if (_yields.size() != yields.size()) {
+    throw std::invalid_argument("Expected " + to_string(yields.size()) + " yields");
+  }
+  yields = _yields;
+  Compute(0, yields.size());
+}
+
+void RiskAnalytics::Recompute()
+{
+  Compute(0, yields.size());
+}
+
+void RiskAnalytics::Compute(size_t begin, size_t end)
+{
+  const double face = faceValue;
+  const double f = frequency;
+  const double* coupon = coupons.data();
+  const double* n = periods.data();
+  const double* y = yields.data();
+  double* price = prices.data();
+  double* pv01 = pv01s.data();
+  double* dv01 = dv01s.data();
+  double* duration = durations.data();
+  double* convexity = convexities.data();
+
+  for (size_t i = begin; i < end; ++i) {
+    double c = face * coupon[i] / f;
+    double r = y[i] / f;
+    double v = 1.0 / (1.0 + r);
+    double vn = pow(v, n[i]);
+
+    // the annuity factor A(r) = g/r with g = 1 - v^n, and its derivatives
+    double g = 1.0 - vn;
+    double p = c * g / r + face * vn;
+    double g1 = n[i] * vn * v;
+    double g2 = -n[i] * (n[i] + 1.0) * vn * v * v;
+    double a1 = g1 / r - g / (r * r);
+    double a2 = g2 / r - 2.0 * g1 / (r * r) + 2.0 * g / (r * r * r);
+    double dp = (c * a1 - face * g1) / f;
+    double d2p = (c * a2 - face * g2) / (f * f);
+
+    price[i] = p;
+    // PV01 keeps the definition of the system: the price drop for a one basis point rise
+    pv01[i] = p - annuityPrice(face, c, n[i], (y[i] + BASIS_POINT) / f);
+    dv01[i] = -dp * BASIS_POINT;
+    duration[i] = -dp / p;
+    convexity[i] = d2p / p;
+  }
+}
+
+double RiskAnalytics::GetYield(size_t index) const
+{
+  return yields[index];
+}
+
+double RiskAnalytics::GetPrice(size_t index) const
+{
+  return prices[index];
+}
+
+double RiskAnalytics::GetPV01(size_t index) const
+{
+  return pv01s[index];
+}
+
+double RiskAnalytics::GetDV01(size_t index) const
+{
+  return dv01s[index];
+}
+
+double RiskAnalytics::GetDuration(size_t index) const
+{
+  return durations[index];
+}
+
+double RiskAnalytics::GetConvexity(size_t index) const
+{
+  return convexities[index];
+}
+
+double RiskAnalytics::GetPV01(const string& productId) const
+{
+  int index = GetProductIndex(productId);
+  if (index < 0) {
+    throw std::invalid_argument("Unknown CUSIP: " + productId);
+  }
+  return pv01s[index];
+}
+
+double RiskAnalytics::PriceAt(size_t index, double yield) const
+{
+  return annuityPrice(faceValue, faceValue * coupons[index] / frequency, periods[index], yield / frequency);
+}
+
+double RiskAnalytics::GetFaceValue() const
+{
+  return faceValue;
+}
+
+double RiskAnalytics::GetMaturity(size_t index) const
+{
+  return periods[index] / frequency;
+}
+
+double RiskAnalytics::SolveYield(size_t index, double price) const
+{
+  double c = faceValue * coupons[index] / frequency;
+  double yield = yields[index];
+  for (int i = 0; i < MAX_YIELD_ITERATIONS; ++i) {
+    double step = yieldNewtonStep(faceValue, c, periods[index], frequency, yield, price);
+    yield -= step;
+    if (fabs(step) < YIELD_TOLERANCE) break;
+  }
+  return yield;
+}
+
+void RiskAnalytics::SolveYields(const vector<double>& _prices, vector<double>& _yields) const
+{
+  size_t size = yields.size();
+  if (_prices.size() != size) {
+    throw std::invalid_argument("Expected " + to_string(size) + " prices");
+  }
+  _yields = yields;
+  // every iteration steps all products at once, so the inner loop stays branch-free
+  const double face = faceValue;
+  const double f = frequency;
+  const double* coupon = coupons.data();
+  const double* n = periods.data();
+  const double* price = _prices.data();
+  double* y = _yields.data();
+  for (int iteration = 0; iteration < MAX_YIELD_ITERATIONS; ++iteration) {
+    double maxStep = 0.0;
+    for (size_t i = 0; i < size; ++i) {
+      double step = yieldNewtonStep(face, face * coupon[i] / f, n[i], f, y[i], price[i]);
+      y[i] -= step;
+      maxStep = max(maxStep, fabs(step));
+    }
+    if (maxStep < YIELD_TOLERANCE) break;
+  }
+}
+
+#endif
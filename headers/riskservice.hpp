@@ -8,8 +8,18 @@
 #define RISK_SERVICE_HPP
 
 #include "soa.hpp"
+#include "arena.hpp"
+#include <mutex>
+#include <cmath>
+#include <optional>
+
 #include "positionservice.hpp"
+#include "pricingservice.hpp"
+#include "riskanalytics.hpp"
+#include "timerwheel.hpp"
 #include "utils.hpp"
+#include "asynclogger.hpp"
+#include "recordformat.hpp"
 
 /**
  * PV01 risk.
@@ -38,6 +48,9 @@ public:
   // Add quantity associated with this risk value
   void AddQuantity(long _quantity);
 
+  // Set the PV01 value
+  void SetPV01(double _pv01);
+
   // Object printer
   template<typename U>
   friend ostream& operator<<(ostream& os, const PV01<U>& pv01);
@@ -82,22 +95,22 @@ void PV01<T>::AddQuantity(long _quantity)
 }
 
 template<typename T>
-ostream& operator<<(ostream& os, const PV01<T>& pv01)
+void PV01<T>::SetPV01(double _pv01)
 {
-  T product = pv01.GetProduct();
-	string _product = product.GetProductId();
-  double pv01_value = pv01.GetPV01();
-  long quantity = pv01.GetQuantity();
-	string _pv01 = to_string(pv01_value);
-	string _quantity = to_string(quantity);
+  pv01 = _pv01;
+}
 
-	vector<string> _strings;
-	_strings.push_back(_product);
-	_strings.push_back(_pv01);
-	_strings.push_back(_quantity);
-  string _str = join(_strings, ",");
-  os << _str;
-  return os;
+// format the fields of a PV01: product, PV01, quantity
+template<typename T>
+void formatRecord(TextWriter& writer, const PV01<T>& pv01)
+{
+  writeFields(writer, pv01.GetProduct().GetProductId(), pv01.GetPV01(), pv01.GetQuantity());
+}
+
+template<typename T>
+ostream& operator<<(ostream& os, const PV01<T>& pv01)
+{
+  return writeRecord(os, pv01);
 }
 
 /**
@@ -147,10 +160,21 @@ const string& BucketedSector<T>::GetName() const
 template<typename T>
 class RiskServiceListener;
 
+// forward declaration of RiskYieldListener
+template<typename T>
+class RiskYieldListener;
+
+// Interval over which live prices are batched into one yield solve
+const long RISK_REFRESH_MS = 10;
+
 
 /**
  * Risk Service to vend out risk for a particular security and across a risk bucketed sector.
  * Keyed on product identifier.
+ * Positions arrive from the position service and prices from the pricing service, on different strands,
+ * so the risk state and the listener callbacks are guarded by a mutex.
+ * Prices are batched: the latest price of each product is kept, and the yields of all products with a new
+ * price are solved together on the next refresh tick of the timer service (on arrival without one).
  * Type T is the product type.
  */
 template<typename T>
@@ -158,12 +182,40 @@ class RiskService : public Service<string,PV01 <T> >
 {
 private:
   vector<ServiceListener<PV01<T>>*> listeners;
-  map<string, PV01<T>> pv01Map;
+  PooledMap<ProductId, PV01<T>> pv01Map;
   RiskServiceListener<T>* riskservicelistener;
+  RiskAnalytics analytics; // live PV01, DV01, duration and convexity of the products
+  RiskYieldListener<T>* riskyieldlistener;
+  double pv01Tolerance; // relative PV01 move that is published to the listeners
+  mutex riskMutex;
+
+  // batched yield solves
+  TimerService* timerService; // shared timer wheel driving the refreshes, null to solve on arrival
+  optional<Strand> strand; // strand of the refreshes
+  long refreshMs; // interval over which prices are batched
+  bool refreshScheduled; // whether a refresh is pending
+  vector<double> solvePrices; // price per face value by product index, the current price of the clean products
+  vector<double> solvedYields; // yields solved by the last batch
+  vector<char> dirtyProducts; // products with a new price since the last refresh
+
+  // bucketed sectors: aggregates are maintained on every change, so reading them is O(1)
+  vector<ServiceListener<PV01<BucketedSector<T>>>*> sectorListeners;
+  vector<PV01<BucketedSector<T>>> sectorRisks; // total PV01 and quantity of each sector
+  map<string, size_t> sectorIndex; // sector name -> index in sectorRisks
+  vector<vector<size_t>> productSectors; // product index in the analytics -> sectors containing it
+
+  // apply a change of risk and quantity of a product to its sectors and notify the sector listeners
+  void UpdateSectors(size_t productIndex, double riskChange, long quantityChange);
+
+  // solve the yields of the products with a new price as one batch and publish their risk moves, the lock is held
+  void RefreshYields();
+
+  // refresh tick of the timer service
+  void OnRefresh();
 
 public:
-  // ctor and dtor
-  RiskService();
+  // ctor: prices are batched over refreshMs on the timer service and strand, or solved on arrival without them
+  RiskService(TimerService* _timerService = nullptr, const Strand* _strand = nullptr, long _refreshMs = RISK_REFRESH_MS, double _pv01Tolerance = 0.001);
   ~RiskService()=default;
 
   // Get data on our service given a key
@@ -182,24 +234,51 @@ public:
   // Get the special listener for risk service
   RiskServiceListener<T>* GetRiskServiceListener();
 
+  // Get the risk analytics engine
+  RiskAnalytics& GetAnalytics();
+
+  // Get the listener of live prices
+  RiskYieldListener<T>* GetRiskYieldListener();
+
+  // Reprice the risk of a product at a new price (percentage of par), on the next refresh
+  void UpdatePrice(const T& product, double price);
+
+  // Copy the analytics and the aggregate quantities (by product index) for an offline risk run
+  void GetRiskSnapshot(RiskAnalytics& _analytics, vector<long>& quantities);
+
   // Add a position that the service will risk
   void AddPosition(Position<T> &position);
 
-  // Get the bucketed risk for the bucket sector
+  // Register a bucketed sector whose risk is aggregated, sectors may overlap
+  void AddBucketedSector(const BucketedSector<T> &sector);
+
+  // Add a listener to sector risk updates
+  void AddSectorListener(ServiceListener<PV01<BucketedSector<T>>> *listener);
+
+  // Get the bucketed risk for the bucket sector (the sector must be registered)
   const PV01< BucketedSector<T> >& GetBucketedRisk(const BucketedSector<T> &sector) const;
 
 };
 
 template<typename T>
-RiskService<T>::RiskService()
+RiskService<T>::RiskService(TimerService* _timerService, const Strand* _strand, long _refreshMs, double _pv01Tolerance)
+: timerService(_strand ? _timerService : nullptr), refreshMs(_refreshMs), refreshScheduled(false)
 {
   riskservicelistener = new RiskServiceListener<T>(this);
+  riskyieldlistener = new RiskYieldListener<T>(this);
+  pv01Tolerance = _pv01Tolerance;
+  if (_strand) strand = *_strand;
+  analytics.AddCurve(treasuryCurve);
+  productSectors.resize(analytics.GetSize());
+  solvePrices.resize(analytics.GetSize());
+  solvedYields.resize(analytics.GetSize());
+  dirtyProducts.assign(analytics.GetSize(), 0);
 }
 
 template<typename T>
 PV01<T>& RiskService<T>::GetData(string key)
 {
-  return pv01Map[key];
+  return pv01Map[ProductId(key)];
 }
 
 /**
@@ -229,48 +308,190 @@ RiskServiceListener<T>* RiskService<T>::GetRiskServiceListener()
   return riskservicelistener;
 }
 
+template<typename T>
+RiskAnalytics& RiskService<T>::GetAnalytics()
+{
+  return analytics;
+}
+
+template<typename T>
+RiskYieldListener<T>* RiskService<T>::GetRiskYieldListener()
+{
+  return riskyieldlistener;
+}
+
+/**
+ * UpdatePrice() keeps the latest price of the product and marks it for the next refresh,
+ * the first price of a refresh window schedules the refresh.
+ */
+template<typename T>
+void RiskService<T>::UpdatePrice(const T& product, double price)
+{
+  lock_guard<mutex> lock(riskMutex);
+  int index = analytics.GetProductIndex(product.GetProductId());
+  if (index < 0) return;
+  solvePrices[index] = price / 100.0 * analytics.GetFaceValue();
+  dirtyProducts[index] = 1;
+  if (!timerService) {
+    RefreshYields();
+    return;
+  }
+  if (refreshScheduled) return;
+  refreshScheduled = true;
+  timerService->Schedule(refreshMs, *strand, [this]() { OnRefresh(); });
+}
+
+template<typename T>
+void RiskService<T>::OnRefresh()
+{
+  lock_guard<mutex> lock(riskMutex);
+  refreshScheduled = false;
+  RefreshYields();
+}
+
+/**
+ * RefreshYields() solves the yields of the products with a new price in one batch and recomputes their risk.
+ * The other products solve at their current price, back to their current yield, and are left untouched.
+ * The risk is only pushed to the listeners when the unit PV01 moved by more than the tolerance
+ * since it was last published, so small ticks do not flood the downstream services.
+ */
+template<typename T>
+void RiskService<T>::RefreshYields()
+{
+  for (size_t index = 0; index < dirtyProducts.size(); ++index) {
+    if (!dirtyProducts[index]) solvePrices[index] = analytics.GetPrice(index);
+  }
+  analytics.SolveYields(solvePrices, solvedYields);
+
+  for (size_t index = 0; index < dirtyProducts.size(); ++index) {
+    if (!dirtyProducts[index]) continue;
+    dirtyProducts[index] = 0;
+    const string& productId = analytics.GetProductId(index);
+    if (!std::isfinite(solvedYields[index])) {
+      LOG_ASYNC(LogLevel::WARNING, "Cannot solve the yield of {} at price {}", productId, solvePrices[index] * 100.0 / analytics.GetFaceValue());
+      continue;
+    }
+    analytics.SetYield(index, solvedYields[index]);
+
+    auto it = pv01Map.find(ProductId(productId));
+    if (it == pv01Map.end()) continue;
+    double pv01Val = analytics.GetPV01(index);
+    double published = it->second.GetPV01();
+    if (fabs(pv01Val - published) <= pv01Tolerance * fabs(published)) continue;
+    it->second.SetPV01(pv01Val);
+    UpdateSectors(index, (pv01Val - published) * it->second.GetQuantity(), 0);
+
+    // notify listeners
+    for(auto& listener : listeners)
+      listener->ProcessUpdate(it->second);
+  }
+}
+
+template<typename T>
+void RiskService<T>::GetRiskSnapshot(RiskAnalytics& _analytics, vector<long>& quantities)
+{
+  lock_guard<mutex> lock(riskMutex);
+  _analytics = analytics;
+  quantities.assign(analytics.GetSize(), 0);
+  for (auto& entry : pv01Map){
+    int index = analytics.GetProductIndex(entry.first);
+    if (index >= 0) quantities[index] = entry.second.GetQuantity();
+  }
+}
+
 template<typename T>
 void RiskService<T>::AddPosition(Position<T> &position)
 {
+  lock_guard<mutex> lock(riskMutex);
   T product = position.GetProduct();
-  string productId = product.GetProductId();
+  const ProductId& productId = product.GetProductId();
   long quantity = position.GetAggregatePosition();
-  // note: this gives the PV01 value for a single unit
-  double pv01Val = getPV01(productId);
+  int index = analytics.GetProductIndex(productId);
+  if (index < 0) {
+    throw std::invalid_argument("Unknown CUSIP: " + productId);
+  }
+  // note: this gives the live PV01 value for a single unit
+  double pv01Val = analytics.GetPV01(index);
 
   // create a PV01 object and publish it to the service
+  // the position is the aggregate over all books, so it replaces the previous quantity
   PV01<T> pv01(product, pv01Val, quantity);
-  if (pv01Map.find(productId) != pv01Map.end()){
-    pv01Map[productId].AddQuantity(quantity);
+  double previousRisk = 0.0;
+  long previousQuantity = 0;
+  auto it = pv01Map.find(productId);
+  if (it != pv01Map.end()){
+    previousRisk = it->second.GetPV01() * it->second.GetQuantity();
+    previousQuantity = it->second.GetQuantity();
+    it->second = pv01;
   }else{
-    pv01Map.insert(pair<string, PV01<T>>(productId, pv01));
+    pv01Map.insert(pair<ProductId, PV01<T>>(productId, pv01));
   }
+  UpdateSectors(index, pv01Val * quantity - previousRisk, quantity - previousQuantity);
 
   // notify listeners
   for(auto& listener : listeners)
     listener->ProcessAdd(pv01);
 }
 
+/**
+ * AddBucketedSector() registers a sector up front, its aggregate starts from the current positions
+ * and is then updated with every position and risk change of its products.
+ */
 template<typename T>
-const PV01<BucketedSector<T>>& RiskService<T>::GetBucketedRisk(const BucketedSector<T> &sector) const
+void RiskService<T>::AddBucketedSector(const BucketedSector<T> &sector)
 {
-  // create a bucketed sector object and publish it to the service
-  vector<T>& products = sector.GetProducts();
-  string name = sector.GetName();
+  lock_guard<mutex> lock(riskMutex);
+  const string& name = sector.GetName();
+  if (sectorIndex.find(name) != sectorIndex.end()) {
+    throw std::invalid_argument("Bucketed sector already registered: " + name);
+  }
+  size_t index = sectorRisks.size();
   double pv01Val = 0.0;
   long quantity = 0;
-  for (auto& product : products){
-    string productId = product.GetProductId();
-    if (pv01Map.find(productId) != pv01Map.end()){
-      // total pv01 value for the sector is the weighted average
-      pv01Val += pv01Map[productId].GetPV01()*pv01Map[productId].GetQuantity();
-      // total quantity for the sector
-      quantity += pv01Map[productId].GetQuantity();
+  for (auto& product : sector.GetProducts()){
+    const ProductId& productId = product.GetProductId();
+    int productIndex = analytics.GetProductIndex(productId);
+    if (productIndex < 0) {
+      throw std::invalid_argument("Unknown CUSIP in bucketed sector " + name + ": " + productId);
+    }
+    productSectors[productIndex].push_back(index);
+    auto it = pv01Map.find(productId);
+    if (it != pv01Map.end()){
+      pv01Val += it->second.GetPV01() * it->second.GetQuantity();
+      quantity += it->second.GetQuantity();
     }
   }
   // note: for PV01 object of a sector, we store the total PV01 value instead of a single unit
-  PV01<BucketedSector<T>> pv01(sector, pv01Val, quantity);
-  return pv01;
+  sectorRisks.push_back(PV01<BucketedSector<T>>(sector, pv01Val, quantity));
+  sectorIndex[name] = index;
+}
+
+template<typename T>
+void RiskService<T>::AddSectorListener(ServiceListener<PV01<BucketedSector<T>>> *listener)
+{
+  sectorListeners.push_back(listener);
+}
+
+template<typename T>
+void RiskService<T>::UpdateSectors(size_t productIndex, double riskChange, long quantityChange)
+{
+  for (auto& index : productSectors[productIndex]){
+    PV01<BucketedSector<T>>& sectorRisk = sectorRisks[index];
+    sectorRisk.SetPV01(sectorRisk.GetPV01() + riskChange);
+    sectorRisk.AddQuantity(quantityChange);
+    for(auto& listener : sectorListeners)
+      listener->ProcessUpdate(sectorRisk);
+  }
+}
+
+template<typename T>
+const PV01<BucketedSector<T>>& RiskService<T>::GetBucketedRisk(const BucketedSector<T> &sector) const
+{
+  auto it = sectorIndex.find(sector.GetName());
+  if (it == sectorIndex.end()) {
+    throw std::invalid_argument("Bucketed sector not registered: " + sector.GetName());
+  }
+  return sectorRisks[it->second];
 }
 
 
@@ -327,5 +548,55 @@ void RiskServiceListener<T>::ProcessUpdate(Position<T> &data)
 }
 
 
+/**
+* Risk Yield Listener subscribing live prices from Pricing Service to Risk Service.
+* Type T is the product type.
+*/
+template<typename T>
+class RiskYieldListener : public ServiceListener<Price<T>>
+{
+private:
+  RiskService<T>* riskservice;
+
+public:
+  // ctor and dtor
+  RiskYieldListener(RiskService<T>* _riskservice);
+  ~RiskYieldListener()=default;
+
+  // Listener callback to process an add event to the Service
+  void ProcessAdd(Price<T> &data);
+
+  // Listener callback to process a remove event to the Service
+  void ProcessRemove(Price<T> &data);
+
+  // Listener callback to process an update event to the Service
+  void ProcessUpdate(Price<T> &data);
+
+};
+
+template<typename T>
+RiskYieldListener<T>::RiskYieldListener(RiskService<T>* _riskservice)
+{
+  riskservice = _riskservice;
+}
+
+/**
+ * ProcessAdd() method reprices the risk of the product at the new mid price.
+ */
+template<typename T>
+void RiskYieldListener<T>::ProcessAdd(Price<T> &data)
+{
+  riskservice->UpdatePrice(data.GetProduct(), data.GetMid());
+}
+
+template<typename T>
+void RiskYieldListener<T>::ProcessRemove(Price<T> &data)
+{
+}
+
+template<typename T>
+void RiskYieldListener<T>::ProcessUpdate(Price<T> &data)
+{
+}
 
 #endif
@@ -0,0 +1,238 @@
+/**
+ * scenarioengine.hpp
+ * Defines the scenario and stress engine revaluing the current positions under curve shocks.
+ *
+ * A scenario set is stored as one flat matrix of yield shifts (scenario x product), and the results as
+ * a matrix of the same shape, so for a treasury universe a few hundred scenarios stay within the L2 cache.
+ * Scenarios are revalued in full with the closed-form prices of the risk analytics engine, split into
+ * blocks of scenarios and products that run in parallel on a thread pool.
+ *
+ * @author Boyu Yang
+ */
+#ifndef SCENARIO_ENGINE_HPP
+#define SCENARIO_ENGINE_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/post.hpp>
+
+#include "riskanalytics.hpp"
+
+using namespace std;
+
+// Interval between the scenario runs of the server over the live positions
+const long SCENARIO_REFRESH_MS = 1000;
+
+// Curve shocks of a scenario
+// PARALLEL: every yield moves by the size
+// TWIST: yields rotate around the pivot tenor, the longest tenor moves by size/2 and the shortest by -size/2
+// BUTTERFLY: the pivot tenor moves by -size and the wings by +size, linearly in between
+// KEY_RATE: the pivot tenor moves by the size, fading linearly to zero at the neighbouring tenors of the curve
+enum ShockType { PARALLEL, TWIST, BUTTERFLY, KEY_RATE };
+
+/**
+ * A curve scenario: a shock of a type and a size in basis points, around a pivot tenor in years.
+ */
+struct CurveScenario
+{
+  string name;
+  ShockType type;
+  double size;
+  double pivot;
+};
+
+// yield shift of a tenor under a scenario, in basis points
+// tenors are the sorted maturities of the curve (used for the key rate neighbours and the curve ends)
+double scenarioShift(const CurveScenario& scenario, double tenor, const vector<double>& tenors)
+{
+  double shortest = tenors.front();
+  double longest = tenors.back();
+  switch (scenario.type)
+  {
+    case PARALLEL:
+      return scenario.size;
+    case TWIST:
+      return longest > shortest ? scenario.size * ((tenor - shortest) / (longest - shortest) - 0.5) : 0.0;
+    case BUTTERFLY:
+    {
+      double wing = max(scenario.pivot - shortest, longest - scenario.pivot);
+      return wing > 0.0 ? scenario.size * (2.0 * fabs(tenor - scenario.pivot) / wing - 1.0) : -scenario.size;
+    }
+    case KEY_RATE:
+    {
+      auto it = lower_bound(tenors.begin(), tenors.end(), scenario.pivot);
+      double lower = (it == tenors.begin()) ? scenario.pivot : *(it - 1);
+      double upper = (it == tenors.end() || it + 1 == tenors.end()) ? scenario.pivot : *(it + 1);
+      if (tenor == scenario.pivot) return scenario.size;
+      if (tenor < scenario.pivot && tenor > lower) return scenario.size * (tenor - lower) / (scenario.pivot - lower);
+      if (tenor > scenario.pivot && tenor < upper) return scenario.size * (upper - tenor) / (upper - scenario.pivot);
+      return 0.0;
+    }
+  }
+  return 0.0;
+}
+
+// the sorted distinct maturities of the products of an analytics engine
+vector<double> curveTenors(const RiskAnalytics& analytics)
+{
+  vector<double> tenors;
+  for (size_t p = 0; p < analytics.GetSize(); ++p) {
+    tenors.push_back(analytics.GetMaturity(p));
+  }
+  sort(tenors.begin(), tenors.end());
+  tenors.erase(unique(tenors.begin(), tenors.end()), tenors.end());
+  return tenors;
+}
+
+// the standard scenario set of a curve: parallel shifts, twists, butterflies around every tenor and key rates
+vector<CurveScenario> standardScenarios(const RiskAnalytics& analytics)
+{
+  vector<double> tenors = curveTenors(analytics);
+  vector<CurveScenario> scenarios;
+  for (double size : {-200.0, -100.0, -50.0, -25.0, -10.0, -5.0, -1.0, 1.0, 5.0, 10.0, 25.0, 50.0, 100.0, 200.0}) {
+    string bp = to_string(static_cast<int>(size)) + "bp";
+    scenarios.push_back({"parallel " + bp, PARALLEL, size, 0.0});
+    scenarios.push_back({"twist " + bp, TWIST, size, 0.0});
+    for (double tenor : tenors) {
+      string point = to_string(static_cast<int>(tenor)) + "y";
+      scenarios.push_back({"butterfly " + point + " " + bp, BUTTERFLY, size, tenor});
+      scenarios.push_back({"key rate " + point + " " + bp, KEY_RATE, size, tenor});
+    }
+  }
+  return scenarios;
+}
+
+/**
+ * Scenario Engine computing the P&L of the positions of a product universe under a set of curve scenarios.
+ */
+class ScenarioEngine
+{
+private:
+  vector<CurveScenario> scenarios; // scenario definitions
+  size_t productCount; // number of products of the universe
+  vector<double> shifts; // yield shifts, scenario major (scenarios x products)
+  vector<double> productPnL; // P&L of each product under each scenario, same layout as the shifts
+  vector<double> scenarioPnL; // total P&L of each scenario
+  boost::asio::thread_pool pool; // workers of the parallel revaluation
+  size_t numThreads; // number of workers
+
+public:
+  // ctor
+  ScenarioEngine(size_t _numThreads = 4);
+  // dtor: join the workers
+  ~ScenarioEngine();
+
+  // Set the scenarios for the products of an analytics engine, the shift matrix is built once here
+  void SetScenarios(const vector<CurveScenario>& _scenarios, const RiskAnalytics& analytics);
+
+  // Revalue the positions (quantities by product index, in face value) under all scenarios
+  void Run(const RiskAnalytics& analytics, const vector<long>& quantities);
+
+  // Get the scenarios
+  const vector<CurveScenario>& GetScenarios() const;
+
+  // Get the total P&L of each scenario of the last run
+  const vector<double>& GetScenarioPnL() const;
+
+  // Get the P&L of a product under a scenario of the last run
+  double GetProductPnL(size_t scenario, size_t product) const;
+
+};
+
+ScenarioEngine::ScenarioEngine(size_t _numThreads)
+: productCount(0), pool(_numThreads > 0 ? _numThreads : 1), numThreads(_numThreads > 0 ? _numThreads : 1)
+{
+}
+
+ScenarioEngine::~ScenarioEngine()
+{
+  pool.join();
+}
+
+void ScenarioEngine::SetScenarios(const vector<CurveScenario>& _scenarios, const RiskAnalytics& analytics)
+{
+  scenarios = _scenarios;
+  productCount = analytics.GetSize();
+  vector<double> curve = curveTenors(analytics);
+
+  shifts.assign(scenarios.size() * productCount, 0.0);
+  for (size_t s = 0; s < scenarios.size(); ++s) {
+    for (size_t p = 0; p < productCount; ++p) {
+      shifts[s * productCount + p] = scenarioShift(scenarios[s], analytics.GetMaturity(p), curve) * BASIS_POINT;
+    }
+  }
+  productPnL.assign(shifts.size(), 0.0);
+  scenarioPnL.assign(scenarios.size(), 0.0);
+}
+
+void ScenarioEngine::Run(const RiskAnalytics& analytics, const vector<long>& quantities)
+{
+  if (analytics.GetSize() != productCount || quantities.size() != productCount) {
+    throw std::invalid_argument("Scenarios were set for " + to_string(productCount) + " products");
+  }
+  size_t scenarioCount = scenarios.size();
+  if (scenarioCount == 0) return;
+
+  // blocks of scenarios, and of products for large universes, a few per worker to balance the load
+  size_t scenarioBlock = max<size_t>(1, (scenarioCount + numThreads * 4 - 1) / (numThreads * 4));
+  size_t productBlock = max<size_t>(productCount, 1);
+  if (productCount >= 256) productBlock = 64;
+
+  mutex doneMutex;
+  condition_variable done;
+  size_t remaining = ((scenarioCount + scenarioBlock - 1) / scenarioBlock) * ((productCount + productBlock - 1) / productBlock);
+
+  for (size_t s0 = 0; s0 < scenarioCount; s0 += scenarioBlock) {
+    for (size_t p0 = 0; p0 < productCount; p0 += productBlock) {
+      size_t s1 = min(s0 + scenarioBlock, scenarioCount);
+      size_t p1 = min(p0 + productBlock, productCount);
+      boost::asio::post(pool, [&, s0, s1, p0, p1]() {
+        double face = analytics.GetFaceValue();
+        for (size_t s = s0; s < s1; ++s) {
+          const double* shift = shifts.data() + s * productCount;
+          double* pnl = productPnL.data() + s * productCount;
+          for (size_t p = p0; p < p1; ++p) {
+            double shocked = analytics.PriceAt(p, analytics.GetYield(p) + shift[p]);
+            pnl[p] = (shocked - analytics.GetPrice(p)) * quantities[p] / face;
+          }
+        }
+        lock_guard<mutex> lock(doneMutex);
+        if (--remaining == 0) done.notify_one();
+      });
+    }
+  }
+  unique_lock<mutex> lock(doneMutex);
+  done.wait(lock, [&remaining]() { return remaining == 0; });
+
+  for (size_t s = 0; s < scenarioCount; ++s) {
+    const double* pnl = productPnL.data() + s * productCount;
+    double total = 0.0;
+    for (size_t p = 0; p < productCount; ++p) {
+      total += pnl[p];
+    }
+    scenarioPnL[s] = total;
+  }
+}
+
+const vector<CurveScenario>& ScenarioEngine::GetScenarios() const
+{
+  return scenarios;
+}
+
+const vector<double>& ScenarioEngine::GetScenarioPnL() const
+{
+  return scenarioPnL;
+}
+
+double ScenarioEngine::GetProductPnL(size_t scenario, size_t product) const
+{
+  return productPnL[scenario * productCount + product];
+}
+
+#endif
@@ -0,0 +1,359 @@
+/**
+ * segmentstore.hpp
+ * Defines the memory-mapped segment files of the historical data store.
+ *
+ * A store <name> is a sequence of segment files <name>.000000.seg, <name>.000001.seg, ...
+ * Each segment is pre-allocated to a fixed size and mapped into memory. It starts with a header page
+ * (schema, record capacity, committed record count, sealed flag) followed by fixed-size records.
+ * A writer appends a record with a copy into the mapping and a single release store of the committed
+ * count, so readers in other processes can tail the segments concurrently and never see a partial record.
+ * When a segment is full it is sealed and the writer rolls over to the next one.
+ *
+ * @author Boyu Yang
+ */
+#ifndef SEGMENT_STORE_HPP
+#define SEGMENT_STORE_HPP
+
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <functional>
+#include <stdexcept>
+#include <filesystem>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "historicalrecord.hpp"
+#include "historicalstore.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+// Magic number of a segment file
+const char SEGMENT_FILE_MAGIC[8] = {'T', 'S', 'S', 'E', 'G', '0', '0', '1'};
+
+// Size of the segment header page, records start right after it
+const size_t SEGMENT_HEADER_SIZE = 4096;
+
+// Default size of a segment file
+const size_t DEFAULT_SEGMENT_SIZE = 16 << 20;
+
+static_assert(atomic<uint64_t>::is_always_lock_free, "segment commits need lock-free 64-bit atomics");
+
+// header page at the start of a segment file, shared between the writer and the readers
+struct SegmentHeader
+{
+  char magic[8];
+  uint32_t columnCount;
+  uint32_t rowSize;
+  uint64_t capacity; // number of records that fit into the segment
+  atomic<uint64_t> committed; // number of complete records, published with release semantics
+  atomic<uint32_t> sealed; // set once the writer moved on to the next segment
+  uint32_t reserved;
+  // followed by columnCount column descriptors
+};
+
+// path of a segment of a store
+string getSegmentPath(const string& basePath, uint64_t sequence)
+{
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%06llu.seg", static_cast<unsigned long long>(sequence));
+  return basePath + suffix;
+}
+
+// map a whole segment file into memory, returns nullptr on failure
+char* mapSegment(const string& path, size_t& size, bool writable)
+{
+  int fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) return nullptr;
+  off_t length = lseek(fd, 0, SEEK_END);
+  if (length < static_cast<off_t>(SEGMENT_HEADER_SIZE)) {
+    close(fd);
+    return nullptr;
+  }
+  void* address = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd); // the mapping stays valid after closing the descriptor
+  if (address == MAP_FAILED) return nullptr;
+  size = length;
+  return static_cast<char*>(address);
+}
+
+/**
+ * Segment Writer appending records of one schema to memory-mapped segments.
+ * All file system calls happen when a segment is opened or rolled over, never when a record is appended.
+ * The mapped records are written back by Sync(), which the persistence writer thread calls on its fsync interval.
+ */
+class SegmentWriter
+{
+private:
+  const RecordSchema& schema; // record layout
+  string basePath; // path of the store without the segment suffix
+  size_t segmentSize; // size of a segment file
+  uint64_t sequence; // sequence number of the current segment
+  char* mapping; // mapping of the current segment
+  size_t mappingSize; // size of the mapping
+  SegmentHeader* header; // header of the current segment
+  char* records; // first record of the current segment
+  uint64_t count; // committed records of the current segment (writer copy)
+  mutex mappingMutex; // guards the mapping against a concurrent Sync() while it is replaced
+
+  // create and map a new segment
+  void OpenSegment(uint64_t _sequence);
+
+  // seal and unmap the current segment
+  void CloseSegment(bool seal);
+
+public:
+  // ctor: continue the last unsealed segment of the store, or start a new one
+  SegmentWriter(const RecordSchema& _schema, const string& _basePath, size_t _segmentSize = DEFAULT_SEGMENT_SIZE);
+  // dtor: unmap the current segment, it stays open for appending on restart
+  ~SegmentWriter();
+
+  // Append a record laid out according to the schema
+  void Append(const void* record);
+
+  // Write the appended records of the current segment back to disk (synchronous msync), thread-safe
+  void Sync();
+
+  // Get the sequence number of the current segment
+  uint64_t GetSequence() const;
+
+  // Get the number of records that fit into a segment
+  uint64_t GetCapacity() const;
+
+};
+
+SegmentWriter::SegmentWriter(const RecordSchema& _schema, const string& _basePath, size_t _segmentSize)
+: schema(_schema), basePath(_basePath), segmentSize(_segmentSize), sequence(0), mapping(nullptr), mappingSize(0), header(nullptr), records(nullptr), count(0)
+{
+  if (sizeof(SegmentHeader) + schema.columns.size() * sizeof(ColumnDescriptor) > SEGMENT_HEADER_SIZE) {
+    throw std::invalid_argument("Too many columns for a segment header: " + schema.name);
+  }
+  if (segmentSize < SEGMENT_HEADER_SIZE + schema.rowSize) {
+    throw std::invalid_argument("Segment size too small for " + schema.name);
+  }
+  // find the last segment of the store
+  while (filesystem::exists(getSegmentPath(basePath, sequence + 1))) {
+    ++sequence;
+  }
+  string path = getSegmentPath(basePath, sequence);
+  if (filesystem::exists(path)) {
+    mapping = mapSegment(path, mappingSize, true);
+    header = reinterpret_cast<SegmentHeader*>(mapping);
+    if (mapping && memcmp(header->magic, SEGMENT_FILE_MAGIC, sizeof(header->magic)) == 0 && header->rowSize == schema.rowSize) {
+      // a crash leaves the unflushed tail uncommitted, appending continues after the last committed record
+      records = mapping + SEGMENT_HEADER_SIZE;
+      count = header->committed.load(memory_order_acquire);
+      if (header->sealed.load(memory_order_acquire) || count == header->capacity) {
+        CloseSegment(true);
+        OpenSegment(sequence + 1);
+      }
+      return;
+    }
+    log(LogLevel::WARNING, "Cannot reuse segment " + path + ", starting a new one");
+    if (mapping) munmap(mapping, mappingSize);
+    mapping = nullptr;
+    OpenSegment(sequence + 1);
+    return;
+  }
+  OpenSegment(sequence);
+}
+
+SegmentWriter::~SegmentWriter()
+{
+  CloseSegment(false);
+}
+
+void SegmentWriter::OpenSegment(uint64_t _sequence)
+{
+  lock_guard<mutex> lock(mappingMutex);
+  sequence = _sequence;
+  string path = getSegmentPath(basePath, sequence);
+  string tempPath = path + ".tmp";
+  int fd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  // pre-allocate the whole segment so appends never extend the file
+  if (fd < 0 || posix_fallocate(fd, 0, segmentSize) != 0) {
+    if (fd >= 0) close(fd);
+    throw std::runtime_error("Cannot allocate segment " + path);
+  }
+  void* address = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    throw std::runtime_error("Cannot map segment " + path);
+  }
+  mapping = static_cast<char*>(address);
+  mappingSize = segmentSize;
+
+  // write the header before the segment becomes visible under its final name
+  header = new (mapping) SegmentHeader;
+  memcpy(header->magic, SEGMENT_FILE_MAGIC, sizeof(header->magic));
+  header->columnCount = schema.columns.size();
+  header->rowSize = schema.rowSize;
+  header->capacity = (segmentSize - SEGMENT_HEADER_SIZE) / schema.rowSize;
+  header->committed.store(0, memory_order_relaxed);
+  header->sealed.store(0, memory_order_relaxed);
+  header->reserved = 0;
+  ColumnDescriptor* descriptors = reinterpret_cast<ColumnDescriptor*>(mapping + sizeof(SegmentHeader));
+  for (size_t i = 0; i < schema.columns.size(); ++i) {
+    ColumnDescriptor& descriptor = descriptors[i];
+    memset(&descriptor, 0, sizeof(descriptor));
+    strncpy(descriptor.name, schema.columns[i].name.c_str(), sizeof(descriptor.name) - 1);
+    descriptor.type = schema.columns[i].type;
+    descriptor.size = schema.columns[i].GetSize();
+    strncpy(descriptor.labels, schema.columns[i].labels.c_str(), sizeof(descriptor.labels) - 1);
+  }
+  rename(tempPath.c_str(), path.c_str());
+
+  records = mapping + SEGMENT_HEADER_SIZE;
+  count = 0;
+}
+
+void SegmentWriter::CloseSegment(bool seal)
+{
+  lock_guard<mutex> lock(mappingMutex);
+  if (!mapping) return;
+  if (seal) {
+    header->sealed.store(1, memory_order_release);
+  }
+  msync(mapping, mappingSize, MS_ASYNC);
+  munmap(mapping, mappingSize);
+  mapping = nullptr;
+  header = nullptr;
+  records = nullptr;
+}
+
+void SegmentWriter::Append(const void* record)
+{
+  if (count == header->capacity) {
+    CloseSegment(true);
+    OpenSegment(sequence + 1);
+  }
+  memcpy(records + count * schema.rowSize, record, schema.rowSize);
+  // the record becomes visible to readers with this single store
+  header->committed.store(++count, memory_order_release);
+}
+
+void SegmentWriter::Sync()
+{
+  lock_guard<mutex> lock(mappingMutex);
+  if (mapping) msync(mapping, mappingSize, MS_SYNC);
+}
+
+uint64_t SegmentWriter::GetSequence() const
+{
+  return sequence;
+}
+
+uint64_t SegmentWriter::GetCapacity() const
+{
+  return header ? header->capacity : 0;
+}
+
+/**
+ * Segment Reader tailing the segments of a store, in this or in another process.
+ * Poll() returns the records committed since the last call and follows the writer across segments.
+ */
+class SegmentReader
+{
+private:
+  string basePath; // path of the store without the segment suffix
+  RecordSchema schema; // schema read from the first segment
+  uint64_t sequence; // sequence number of the current segment
+  char* mapping; // mapping of the current segment
+  size_t mappingSize; // size of the mapping
+  const SegmentHeader* header; // header of the current segment
+  uint64_t position; // records of the current segment already returned
+
+  // map a segment, returns false if it does not exist yet
+  bool OpenSegment(uint64_t _sequence);
+
+public:
+  // ctor: start reading at the first segment of the store
+  SegmentReader(const string& _basePath, uint64_t _sequence = 0);
+  // dtor: unmap the current segment
+  ~SegmentReader();
+
+  // Get the schema of the store
+  const RecordSchema& GetSchema() const;
+
+  // Call the callback for every record committed since the last poll, returns the number of records
+  size_t Poll(const function<void(const char* row)>& callback);
+
+  // Get the sequence number of the current segment
+  uint64_t GetSequence() const;
+
+};
+
+SegmentReader::SegmentReader(const string& _basePath, uint64_t _sequence)
+: basePath(_basePath), sequence(_sequence), mapping(nullptr), mappingSize(0), header(nullptr), position(0)
+{
+  if (!OpenSegment(sequence)) {
+    throw std::invalid_argument("No such segment: " + getSegmentPath(basePath, sequence));
+  }
+  schema.name = filesystem::path(basePath).filename().string();
+  schema.rowSize = header->rowSize;
+  const ColumnDescriptor* descriptors = reinterpret_cast<const ColumnDescriptor*>(mapping + sizeof(SegmentHeader));
+  size_t offset = 0;
+  for (uint32_t i = 0; i < header->columnCount; ++i) {
+    const ColumnDescriptor& descriptor = descriptors[i];
+    ColumnSchema column = {string(descriptor.name, strnlen(descriptor.name, sizeof(descriptor.name))), static_cast<ColumnType>(descriptor.type), offset, string(descriptor.labels, strnlen(descriptor.labels, sizeof(descriptor.labels))), descriptor.size};
+    schema.columns.push_back(column);
+    offset += descriptor.size;
+  }
+}
+
+SegmentReader::~SegmentReader()
+{
+  if (mapping) munmap(mapping, mappingSize);
+}
+
+bool SegmentReader::OpenSegment(uint64_t _sequence)
+{
+  size_t size;
+  char* address = mapSegment(getSegmentPath(basePath, _sequence), size, false);
+  if (!address) return false;
+  if (memcmp(address, SEGMENT_FILE_MAGIC, sizeof(SEGMENT_FILE_MAGIC)) != 0) {
+    munmap(address, size);
+    throw std::invalid_argument("Not a segment file: " + getSegmentPath(basePath, _sequence));
+  }
+  if (mapping) munmap(mapping, mappingSize);
+  mapping = address;
+  mappingSize = size;
+  header = reinterpret_cast<const SegmentHeader*>(mapping);
+  sequence = _sequence;
+  position = 0;
+  return true;
+}
+
+const RecordSchema& SegmentReader::GetSchema() const
+{
+  return schema;
+}
+
+size_t SegmentReader::Poll(const function<void(const char* row)>& callback)
+{
+  size_t total = 0;
+  while (true) {
+    // read the sealed flag first: once set, the committed count is final
+    bool sealed = header->sealed.load(memory_order_acquire) != 0;
+    uint64_t committed = header->committed.load(memory_order_acquire);
+    const char* records = mapping + SEGMENT_HEADER_SIZE;
+    for (; position < committed; ++position) {
+      callback(records + position * header->rowSize);
+      ++total;
+    }
+    // follow the writer into the next segment
+    if (!sealed || !OpenSegment(sequence + 1)) break;
+  }
+  return total;
+}
+
+uint64_t SegmentReader::GetSequence() const
+{
+  return sequence;
+}
+
+#endif
@@ -0,0 +1,119 @@
+/**
+ * servercontext.hpp
+ * Defines the shared I/O context that all socket connectors of the trading system run on.
+ *
+ * @author Boyu Yang
+ */
+#ifndef SERVER_CONTEXT_HPP
+#define SERVER_CONTEXT_HPP
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <boost/asio.hpp>
+
+#include "utils.hpp"
+
+using namespace std;
+
+// Strand of the shared io_context: handlers posted to the same strand never run concurrently
+typedef boost::asio::strand<boost::asio::io_context::executor_type> Strand;
+
+// Backoff of the reconnects of the output connectors, in milliseconds
+const long RECONNECT_MIN_MS = 100;
+const long RECONNECT_MAX_MS = 5000;
+
+/**
+ * ServerContext: a single io_context driven by a configurable pool of worker threads.
+ * Connectors open their acceptors and sockets on a strand of this context, so the handlers of
+ * one connection stay ordered while idle feeds cost no thread and busy feeds can use spare cores.
+ */
+class ServerContext
+{
+private:
+  boost::asio::io_context io_context; // the only event loop of the server
+  boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work; // keeps run() alive while idle
+  boost::asio::signal_set signals; // SIGINT and SIGTERM stop the server gracefully
+  size_t numThreads; // size of the worker pool
+  vector<thread> workers; // worker threads calling io_context.run()
+
+public:
+  // ctor
+  ServerContext(size_t _numThreads);
+  // dtor: stop the event loop and join the workers
+  ~ServerContext();
+
+  // Get the underlying io_context
+  boost::asio::io_context& GetIOContext();
+
+  // Create a new strand on the shared io_context
+  Strand MakeStrand();
+
+  // Get the number of worker threads
+  size_t GetNumThreads() const;
+
+  // Run the event loop on the worker pool, blocks until Stop() is called or a termination signal arrives
+  void Run();
+
+  // Stop the event loop
+  void Stop();
+
+};
+
+ServerContext::ServerContext(size_t _numThreads)
+: io_context(static_cast<int>(_numThreads > 0 ? _numThreads : 1)), work(boost::asio::make_work_guard(io_context)), signals(io_context, SIGINT, SIGTERM), numThreads(_numThreads > 0 ? _numThreads : 1)
+{
+}
+
+ServerContext::~ServerContext()
+{
+  Stop();
+  for (auto& worker : workers) {
+    join(worker);
+  }
+}
+
+boost::asio::io_context& ServerContext::GetIOContext()
+{
+  return io_context;
+}
+
+Strand ServerContext::MakeStrand()
+{
+  return boost::asio::make_strand(io_context);
+}
+
+size_t ServerContext::GetNumThreads() const
+{
+  return numThreads;
+}
+
+void ServerContext::Run()
+{
+  log(LogLevel::NOTE, "Server context running on " + to_string(numThreads) + " worker threads");
+  // stop on termination so that services and writers shut down and flush their data
+  signals.async_wait([this](const boost::system::error_code& ec, int /*signal*/) {
+    if (!ec) {
+      log(LogLevel::NOTE, "Termination signal received, stopping server");
+      Stop();
+    }
+  });
+  for (size_t i = 1; i < numThreads; ++i) {
+    workers.push_back(thread([this]() { io_context.run(); }));
+  }
+  // the calling thread is the first worker
+  io_context.run();
+  for (auto& worker : workers) {
+    join(worker);
+  }
+  workers.clear();
+}
+
+void ServerContext::Stop()
+{
+  work.reset();
+  io_context.stop();
+}
+
+#endif
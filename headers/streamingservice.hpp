@@ -7,8 +7,13 @@
 #ifndef STREAMING_SERVICE_HPP
 #define STREAMING_SERVICE_HPP
 
+#include <deque>
 #include "soa.hpp"
+#include "arena.hpp"
+#include "servercontext.hpp"
+#include "timerwheel.hpp"
 #include "algostreamingservice.hpp"
+#include "asynclogger.hpp"
 
 /**
  * Forward declaration of StreamOutputConnector and StreamingServiceListener.
@@ -30,7 +35,7 @@ template<typename T>
 class StreamingService : public Service<string,PriceStream <T> >
 {
 private:
-  map<string, PriceStream<T>> priceStreamMap; // store price stream data keyed by product identifier
+  PooledMap<ProductId, PriceStream<T>> priceStreamMap; // store price stream data keyed by product identifier
   vector<ServiceListener<PriceStream<T>>*> listeners; // list of listeners to this service
   string host; // host name for inbound connector
   string port; // port number for inbound connector
@@ -39,7 +44,7 @@ private:
 
 public:
   // ctor and dtor
-  StreamingService(const string& _host, const string& _port);
+  StreamingService(const Strand& _strand, const string& _host, const string& _port, TimerService* _timerService);
   ~StreamingService()=default;
 
   // Get data on our service given a key
@@ -69,18 +74,18 @@ public:
 };
 
 template<typename T>
-StreamingService<T>::StreamingService(const string& _host, const string& _port)
+StreamingService<T>::StreamingService(const Strand& _strand, const string& _host, const string& _port, TimerService* _timerService)
 {
   host = _host;
   port = _port;
-  connector = new StreamOutputConnector<T>(this, host, port); // connector related to this server
+  connector = new StreamOutputConnector<T>(this, _strand, host, port, _timerService); // connector related to this server
   streamingservicelistener = new StreamingServiceListener<T>(this); // listener related to this server
 }
 
 template<typename T>
 PriceStream<T>& StreamingService<T>::GetData(string key)
 {
-  return priceStreamMap[key];
+  return priceStreamMap[ProductId(key)];
 }
 
 /**
@@ -128,10 +133,10 @@ template<typename T>
 void StreamingService<T>::AddPriceStream(const AlgoStream<T>& algoStream)
 {
   PriceStream<T> priceStream = algoStream.GetPriceStream();
-  string key = priceStream.GetProduct().GetProductId();
+  const ProductId& key = priceStream.GetProduct().GetProductId();
   // update the price stream map
   if (priceStreamMap.find(key) != priceStreamMap.end()) {priceStreamMap.erase(key);}
-  priceStreamMap.insert(pair<string, PriceStream<T> > (key, priceStream));
+  priceStreamMap.insert(pair<ProductId, PriceStream<T> > (key, priceStream));
 
   // flow the data to listeners
   for (auto& l : listeners) {
@@ -141,6 +146,8 @@ void StreamingService<T>::AddPriceStream(const AlgoStream<T>& algoStream)
 
 /**
  * StreamOutputConnector: publish data to socket.
+ * The connector keeps one outbound connection open and queues data lines on its strand,
+ * so publishing never blocks the calling service and writes are never interleaved.
  * Type T is the product type.
  */
 template<typename T>
@@ -150,16 +157,25 @@ private:
   StreamingService<T>* service;
   string host; // host name
   string port; // port number
-  boost::asio::io_service io_service; // io service
-  boost::asio::ip::tcp::socket socket; // socket
+  Strand strand; // strand serializing the handlers of this connector
+  boost::asio::ip::tcp::acceptor acceptor; // acceptor listening on host:port
+  boost::asio::ip::tcp::socket socket; // outbound socket the streams are published to
+  deque<string> writeQueue; // data lines waiting to be written, only touched on the strand
+  bool connected; // whether the outbound socket is connected
+  bool connecting; // whether a connect is in flight or waiting for its retry
+  TimerService* timerService; // shared timer wheel scheduling the reconnects
+  long reconnectDelayMs; // backoff of the next reconnect
 
   void handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request);
-  void start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service);
+  void start_accept();
+  void start_connect();
+  void start_write();
+  void schedule_reconnect();
 
 public:
   // ctor
-  StreamOutputConnector(StreamingService<T>* _service, const string& _host, const string& _port);
-  // dtor: close the socket
+  StreamOutputConnector(StreamingService<T>* _service, const Strand& _strand, const string& _host, const string& _port, TimerService* _timerService);
+  // dtor: close the sockets
   ~StreamOutputConnector();
 
   // Publish data to the socket
@@ -171,27 +187,33 @@ public:
 };
 
 template<typename T>
-StreamOutputConnector<T>::StreamOutputConnector(StreamingService<T>* _service, const string& _host, const string& _port)
-: service(_service), host(_host), port(_port), socket(io_service)
+StreamOutputConnector<T>::StreamOutputConnector(StreamingService<T>* _service, const Strand& _strand, const string& _host, const string& _port, TimerService* _timerService)
+: service(_service), host(_host), port(_port), strand(_strand), acceptor(_strand), socket(_strand), connected(false), connecting(false), timerService(_timerService), reconnectDelayMs(RECONNECT_MIN_MS)
 {
-
 }
 
 template<typename T>
 StreamOutputConnector<T>::~StreamOutputConnector()
 {
+  acceptor.close();
   socket.close();
 }
 
 template<typename T>
-void StreamOutputConnector<T>::start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service) {
-  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(*io_service);
-  acceptor->async_accept(*socket, [this, socket, acceptor, io_service](const boost::system::error_code& ec) {
+void StreamOutputConnector<T>::start_accept() {
+  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(strand);
+  acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      delete socket; // acceptor closed, stop accepting
+      return;
+    }
     if (!ec) {
       boost::asio::streambuf* request = new boost::asio::streambuf;
       boost::asio::async_read_until(*socket, *request, "\r", std::bind(&StreamOutputConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
+    } else {
+      delete socket;
     }
-    start_accept(acceptor, io_service); // accept the next connection
+    start_accept(); // accept the next connection
   });
 }
 
@@ -214,40 +236,115 @@ void StreamOutputConnector<T>::handle_read(const boost::system::error_code& ec,
     // server receives and prints data
     cout << data << endl;
 
-    boost::asio::async_read_until(*socket, *request, "\n", std::bind(&StreamOutputConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
+    boost::asio::async_read_until(*socket, *request, "\r", std::bind(&StreamOutputConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
   } else {
     delete request; // delete the streambuf when we're done with it
     delete socket; // delete the socket when we're done with it
   }
 }
 
+// connect the outbound socket, queued data lines are flushed when the connection is up
+// a failed connect is retried with exponential backoff, the queued lines are kept meanwhile
+template<typename T>
+void StreamOutputConnector<T>::start_connect()
+{
+  if (connecting) return;
+  connecting = true;
+  try {
+    boost::asio::ip::tcp::resolver resolver(strand);
+    auto endpoints = resolver.resolve(host, port);
+    boost::asio::async_connect(socket, endpoints, [this](const boost::system::error_code& ec, const boost::asio::ip::tcp::endpoint& /*endpoint*/) {
+      connecting = false;
+      if (ec) {
+        LOG_ASYNC(LogLevel::ERROR, "Streaming output connect failed: {}, retrying in {} ms", ec.message(), reconnectDelayMs);
+        socket.close();
+        schedule_reconnect();
+        return;
+      }
+      connected = true;
+      reconnectDelayMs = RECONNECT_MIN_MS;
+      if (!writeQueue.empty()) start_write();
+    });
+  }
+  catch (std::exception& e){
+    connecting = false;
+    log(LogLevel::ERROR, e.what());
+    schedule_reconnect();
+  }
+}
+
+// retry the connect after the current backoff on the connector's strand, the backoff doubles up to a maximum
+template<typename T>
+void StreamOutputConnector<T>::schedule_reconnect()
+{
+  long delay = reconnectDelayMs;
+  reconnectDelayMs = min(reconnectDelayMs * 2, RECONNECT_MAX_MS);
+  connecting = true;
+  timerService->Schedule(delay, strand, [this]() {
+    connecting = false;
+    start_connect();
+  });
+}
+
+// write the head of the queue, the completion handler chains the next write
+template<typename T>
+void StreamOutputConnector<T>::start_write()
+{
+  boost::asio::async_write(socket, boost::asio::buffer(writeQueue.front()), [this](const boost::system::error_code& ec, std::size_t /*length*/) {
+    if (ec) {
+      LOG_ASYNC(LogLevel::ERROR, "Streaming output write failed: {}, reconnecting", ec.message());
+      connected = false;
+      socket.close();
+      // the line that failed stays at the head of the queue and is written again after the reconnect
+      schedule_reconnect();
+      return;
+    }
+    writeQueue.pop_front();
+    if (!writeQueue.empty()) start_write();
+  });
+}
+
 /**
  * Publish() method is used by the publish-only connector to publish streams.
+ * The data line is handed over to the connector's strand, the calling service does not wait for the socket.
  */
 template<typename T>
 void StreamOutputConnector<T>::Publish(const PriceStream<T>& data)
 {
-  // connect to the socket
-  boost::asio::ip::tcp::resolver resolver(io_service);
-  boost::asio::ip::tcp::resolver::query query(host, port);
-  boost::asio::ip::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
-  boost::asio::connect(socket, endpoint_iterator);
-
-  // print the price stream data
-  T product = data.GetProduct();
-  string productId = product.GetProductId();
-  PriceStreamOrder bid = data.GetBidOrder();
-  PriceStreamOrder offer = data.GetOfferOrder();
-
-  string dataLine = string("Price Stream ") + "(Product " + productId + "): \n"
-    + "\tBid\t" + "Price: " + std::to_string(bid.GetPrice()) + "\tVisibleQuantity: " + std::to_string(bid.GetVisibleQuantity())
-    + "\tHiddenQuantity: " + std::to_string(bid.GetHiddenQuantity()) + "\n"
-    + "\tAsk\t" + "Price: " + std::to_string(offer.GetPrice()) + "\tVisibleQuantity: " + std::to_string(offer.GetVisibleQuantity())
-    + "\tHiddenQuantity: " + std::to_string(offer.GetHiddenQuantity()) + "\n";
+  // print the price stream data into one line
+  const ProductId& productId = data.GetProduct().GetProductId();
+  const PriceStreamOrder& bid = data.GetBidOrder();
+  const PriceStreamOrder& offer = data.GetOfferOrder();
+
+  char text[RECORD_TEXT_CAPACITY];
+  TextWriter writer(text, sizeof(text));
+  writer.Append("Price Stream (Product ");
+  writer.Append(productId.View());
+  writer.Append("): \n\tBid\tPrice: ");
+  writer.AppendDouble(bid.GetPrice());
+  writer.Append("\tVisibleQuantity: ");
+  writer.AppendInteger(bid.GetVisibleQuantity());
+  writer.Append("\tHiddenQuantity: ");
+  writer.AppendInteger(bid.GetHiddenQuantity());
+  writer.Append("\n\tAsk\tPrice: ");
+  writer.AppendDouble(offer.GetPrice());
+  writer.Append("\tVisibleQuantity: ");
+  writer.AppendInteger(offer.GetVisibleQuantity());
+  writer.Append("\tHiddenQuantity: ");
+  writer.AppendInteger(offer.GetHiddenQuantity());
+  writer.Append("\n\r");
+  string dataLine(writer.View());
 
   // publish the data string to socket
   // asynchronous operation ensures server gets all data
-  boost::asio::async_write(socket, boost::asio::buffer(dataLine + "\r"), [](boost::system::error_code /*ec*/, std::size_t /*length*/) {});
+  boost::asio::post(strand, [this, dataLine = std::move(dataLine)]() mutable {
+    writeQueue.push_back(std::move(dataLine));
+    if (!connected) {
+      start_connect();
+    } else if (writeQueue.size() == 1) {
+      start_write();
+    }
+  });
 }
 
 template<typename T>
@@ -255,17 +352,19 @@ void StreamOutputConnector<T>::Subscribe()
 {
   log(LogLevel::NOTE, "Streaming output server listening on " + host + ":" + port);
   try {
-  // connect to the socket
-  boost::asio::ip::tcp::resolver resolver(io_service);
-  boost::asio::ip::tcp::resolver::query query(host, port);
-  boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-  boost::asio::ip::tcp::acceptor acceptor(io_service, endpoint);
-  start_accept(&acceptor, &io_service);
-  io_service.run();
+  // bind the acceptor on the shared server context, the worker pool runs the handlers
+  boost::asio::ip::tcp::resolver resolver(strand);
+  boost::asio::ip::tcp::endpoint endpoint = resolver.resolve(host, port)->endpoint();
+  acceptor.open(endpoint.protocol());
+  acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  acceptor.bind(endpoint);
+  acceptor.listen();
+  start_accept();
   }
   catch (std::exception& e){
     // throw error log
     log(LogLevel::ERROR, e.what());
+    acceptor.close();
     return;
   }
 }
@@ -0,0 +1,319 @@
+/**
+ * timerwheel.hpp
+ * Defines the hierarchical timer wheel and the timer service scheduling delayed callbacks of the services.
+ *
+ * Timers are kept in levels of slots, each slot holding an intrusive doubly-linked list of timer nodes
+ * stored in one pool. Level 0 has one slot per tick, level k one slot per 2^(8k) ticks. A timer is linked
+ * into the level of the highest digit in which its expiry differs from the current tick, and cascades one
+ * level down each time the current tick enters its slot. Scheduling and cancelling are O(1) without
+ * allocation once the pool is warm, and advancing by a tick visits one slot of level 0 (plus a cascade
+ * every 256 ticks), so pending timers that are not due cost nothing.
+ *
+ * @author Boyu Yang
+ */
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <chrono>
+#include <stdexcept>
+#include <boost/asio.hpp>
+
+#include "servercontext.hpp"
+
+using namespace std;
+
+// Identifier of a scheduled timer: pool index in the low 32 bits, generation in the high 32 bits
+// A stale identifier (fired or cancelled timer) never matches a reused node
+typedef uint64_t TimerId;
+
+const TimerId INVALID_TIMER = 0;
+
+// Slots per level (2^TIMER_WHEEL_BITS) and number of levels, the wheel spans 2^32 ticks
+const int TIMER_WHEEL_BITS = 8;
+const int TIMER_WHEEL_LEVELS = 4;
+
+/**
+ * Hierarchical Timer Wheel with a configurable tick length (in the time unit of the caller, e.g. ms).
+ * Not thread-safe: a wheel is scheduled and advanced by one thread or strand, see TimerService.
+ */
+class TimerWheel
+{
+private:
+  struct TimerNode
+  {
+    int64_t expiry; // tick at which the timer fires
+    function<void()> callback;
+    int32_t prev; // neighbours in the slot list, -1 at the ends
+    int32_t next;
+    int32_t slot; // slot of the node over all levels, -1 when the node is free
+    uint32_t generation; // incremented each time the node is released
+  };
+
+  vector<TimerNode> nodes; // node pool
+  vector<int32_t> heads; // first node of each slot, level major, -1 if empty
+  vector<int32_t> freeNodes; // released nodes
+  int64_t tickLength; // time units per tick
+  int64_t current; // last tick processed
+  size_t pending; // scheduled timers
+
+  // link a node into the slot of its expiry relative to the current tick
+  void Link(int32_t index);
+
+  // unlink a node from its slot
+  void Unlink(int32_t index);
+
+  // release a node to the pool
+  void Release(int32_t index);
+
+  // move the timers of a slot of a higher level down to the lower levels
+  void Cascade(int level);
+
+public:
+  // ctor: ticks of tickLength time units each, starting at time start
+  TimerWheel(int64_t _tickLength = 1, int64_t start = 0);
+
+  // Schedule a callback at an absolute time, a time in the past fires on the next tick
+  TimerId Schedule(int64_t time, function<void()> callback);
+
+  // Cancel a timer, returns false if it already fired or was cancelled
+  bool Cancel(TimerId id);
+
+  // Fire the timers due up to an absolute time, tick by tick
+  void Advance(int64_t time);
+
+  // Get the number of scheduled timers
+  size_t GetPendingCount() const;
+
+  // Get the time of the last processed tick
+  int64_t GetTime() const;
+
+};
+
+TimerWheel::TimerWheel(int64_t _tickLength, int64_t start)
+: heads(TIMER_WHEEL_LEVELS << TIMER_WHEEL_BITS, -1), tickLength(_tickLength > 0 ? _tickLength : 1), current(start / (_tickLength > 0 ? _tickLength : 1)), pending(0)
+{
+}
+
+void TimerWheel::Link(int32_t index)
+{
+  TimerNode& node = nodes[index];
+  // the level is the highest digit in which the expiry differs from the current tick
+  uint64_t diff = static_cast<uint64_t>(node.expiry ^ current);
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 && (diff >> (TIMER_WHEEL_BITS * (level + 1))) != 0) {
+    level++;
+  }
+  int64_t digit = (node.expiry >> (TIMER_WHEEL_BITS * level)) & ((1 << TIMER_WHEEL_BITS) - 1);
+  node.slot = static_cast<int32_t>((level << TIMER_WHEEL_BITS) + digit);
+  node.prev = -1;
+  node.next = heads[node.slot];
+  if (node.next >= 0) nodes[node.next].prev = index;
+  heads[node.slot] = index;
+}
+
+void TimerWheel::Unlink(int32_t index)
+{
+  TimerNode& node = nodes[index];
+  if (node.prev >= 0) nodes[node.prev].next = node.next;
+  else heads[node.slot] = node.next;
+  if (node.next >= 0) nodes[node.next].prev = node.prev;
+}
+
+void TimerWheel::Release(int32_t index)
+{
+  TimerNode& node = nodes[index];
+  node.slot = -1;
+  node.generation++;
+  node.callback = nullptr;
+  freeNodes.push_back(index);
+  pending--;
+}
+
+void TimerWheel::Cascade(int level)
+{
+  int32_t slot = static_cast<int32_t>((level << TIMER_WHEEL_BITS) + ((current >> (TIMER_WHEEL_BITS * level)) & ((1 << TIMER_WHEEL_BITS) - 1)));
+  // detach the list first, a timer beyond the span of the wheel may be linked back into the same slot
+  int32_t index = heads[slot];
+  heads[slot] = -1;
+  while (index >= 0) {
+    int32_t next = nodes[index].next;
+    Link(index);
+    index = next;
+  }
+}
+
+TimerId TimerWheel::Schedule(int64_t time, function<void()> callback)
+{
+  int32_t index;
+  if (freeNodes.empty()) {
+    index = static_cast<int32_t>(nodes.size());
+    nodes.push_back(TimerNode{0, nullptr, -1, -1, -1, 1});
+  }
+  else {
+    index = freeNodes.back();
+    freeNodes.pop_back();
+  }
+  TimerNode& node = nodes[index];
+  // a timer is never due before the next tick
+  node.expiry = max(time / tickLength, current + 1);
+  node.callback = std::move(callback);
+  Link(index);
+  pending++;
+  return (static_cast<uint64_t>(node.generation) << 32) | static_cast<uint32_t>(index);
+}
+
+bool TimerWheel::Cancel(TimerId id)
+{
+  int32_t index = static_cast<int32_t>(id & 0xffffffffu);
+  uint32_t generation = static_cast<uint32_t>(id >> 32);
+  if (index < 0 || static_cast<size_t>(index) >= nodes.size()) return false;
+  TimerNode& node = nodes[index];
+  if (node.slot < 0 || node.generation != generation) return false;
+  Unlink(index);
+  Release(index);
+  return true;
+}
+
+void TimerWheel::Advance(int64_t time)
+{
+  int64_t target = time / tickLength;
+  // an empty wheel jumps to the target
+  if (pending == 0 && target > current) current = target;
+  while (current < target) {
+    current++;
+    // entering a new slot of a higher level: cascade it, from the highest level whose lower digits wrapped
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && ((current >> (TIMER_WHEEL_BITS * (level + 1))) << (TIMER_WHEEL_BITS * (level + 1))) == current) {
+      level++;
+    }
+    for (; level > 0; --level) {
+      Cascade(level);
+    }
+    // fire level 0, timers scheduled by the callbacks are due after this tick
+    int32_t slot = static_cast<int32_t>(current & ((1 << TIMER_WHEEL_BITS) - 1));
+    int32_t index;
+    while ((index = heads[slot]) >= 0) {
+      Unlink(index);
+      function<void()> callback = std::move(nodes[index].callback);
+      Release(index);
+      callback();
+    }
+    if (pending == 0) current = target;
+  }
+}
+
+size_t TimerWheel::GetPendingCount() const
+{
+  return pending;
+}
+
+int64_t TimerWheel::GetTime() const
+{
+  return current * tickLength;
+}
+
+/**
+ * Timer Service: one timer wheel shared by the services, driven by a steady timer on the shared event loop.
+ * Timers can be scheduled and cancelled from any strand, each callback is posted to the strand given at
+ * scheduling, so it runs alongside the other handlers of its service. The steady timer only ticks while
+ * timers are pending. A cancel racing with a timer that just fired returns false and the callback still
+ * runs, so callbacks check the state they act on.
+ * Times are in milliseconds of the steady clock.
+ */
+class TimerService
+{
+private:
+  Strand strand; // strand of the ticks
+  boost::asio::steady_timer timer; // drives the wheel
+  TimerWheel wheel;
+  mutex timerMutex; // guards the wheel and the steady timer
+  int64_t tickMs; // tick length
+  bool armed; // whether a tick is scheduled
+
+  // schedule the next tick if timers are pending, the lock is held
+  void Arm();
+
+  // advance the wheel to the current time
+  void OnTick(const boost::system::error_code& ec);
+
+public:
+  // ctor
+  TimerService(ServerContext& context, int64_t _tickMs = 1);
+  // dtor: stop ticking
+  ~TimerService();
+
+  // Get the current time in milliseconds
+  static int64_t NowMs();
+
+  // Schedule a callback on a strand after a delay in milliseconds
+  TimerId Schedule(int64_t delayMs, const Strand& target, function<void()> callback);
+
+  // Cancel a timer, returns false if it already fired or was cancelled
+  bool Cancel(TimerId id);
+
+  // Get the number of pending timers
+  size_t GetPendingCount();
+
+};
+
+TimerService::TimerService(ServerContext& context, int64_t _tickMs)
+: strand(context.MakeStrand()), timer(strand), wheel(1, NowMs()), tickMs(_tickMs > 0 ? _tickMs : 1), armed(false)
+{
+}
+
+TimerService::~TimerService()
+{
+  lock_guard<mutex> lock(timerMutex);
+  timer.cancel();
+}
+
+int64_t TimerService::NowMs()
+{
+  return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TimerService::Arm()
+{
+  if (armed || wheel.GetPendingCount() == 0) return;
+  armed = true;
+  timer.expires_after(chrono::milliseconds(tickMs));
+  timer.async_wait(boost::asio::bind_executor(strand, [this](const boost::system::error_code& ec) { OnTick(ec); }));
+}
+
+void TimerService::OnTick(const boost::system::error_code& ec)
+{
+  if (ec == boost::asio::error::operation_aborted) return;
+  lock_guard<mutex> lock(timerMutex);
+  armed = false;
+  // due callbacks are only posted here, they run on their strands after the lock is released
+  wheel.Advance(NowMs());
+  Arm();
+}
+
+TimerId TimerService::Schedule(int64_t delayMs, const Strand& target, function<void()> callback)
+{
+  lock_guard<mutex> lock(timerMutex);
+  TimerId id = wheel.Schedule(NowMs() + delayMs, [target, callback = std::move(callback)]() {
+    boost::asio::post(target, callback);
+  });
+  Arm();
+  return id;
+}
+
+bool TimerService::Cancel(TimerId id)
+{
+  lock_guard<mutex> lock(timerMutex);
+  return wheel.Cancel(id);
+}
+
+size_t TimerService::GetPendingCount()
+{
+  lock_guard<mutex> lock(timerMutex);
+  return wheel.GetPendingCount();
+}
+
+#endif
@@ -16,7 +16,10 @@
 #include <chrono>
 
 #include "soa.hpp"
+#include "arena.hpp"
+#include "productregistry.hpp"
 #include "utils.hpp"
+#include "servercontext.hpp"
 #include "executionservice.hpp"
 
 // Trade sides
@@ -34,19 +37,19 @@ public:
 
   // ctor for a trade
   Trade() = default;
-  Trade(const T &_product, string _tradeId, double _price, string _book, long _quantity, Side _side);
+  Trade(const T &_product, string_view _tradeId, double _price, string_view _book, long _quantity, Side _side);
 
   // Get the product
   const T& GetProduct() const;
 
   // Get the trade ID
-  const string& GetTradeId() const;
+  const TradeId& GetTradeId() const;
 
   // Get the mid price
   double GetPrice() const;
 
   // Get the book
-  const string& GetBook() const;
+  const BookId& GetBook() const;
 
   // Get the quantity
   long GetQuantity() const;
@@ -56,9 +59,9 @@ public:
 
 private:
   T product;
-  string tradeId;
+  TradeId tradeId;
   double price;
-  string book;
+  BookId book;
   long quantity;
   Side side;
 
@@ -66,12 +69,10 @@ private:
 
 
 template<typename T>
-Trade<T>::Trade(const T &_product, string _tradeId, double _price, string _book, long _quantity, Side _side) :
-  product(_product)
+Trade<T>::Trade(const T &_product, string_view _tradeId, double _price, string_view _book, long _quantity, Side _side) :
+  product(_product), tradeId(_tradeId), book(_book)
 {
-  tradeId = _tradeId;
   price = _price;
-  book = _book;
   quantity = _quantity;
   side = _side;
 }
@@ -83,7 +84,7 @@ const T& Trade<T>::GetProduct() const
 }
 
 template<typename T>
-const string& Trade<T>::GetTradeId() const
+const TradeId& Trade<T>::GetTradeId() const
 {
   return tradeId;
 }
@@ -95,7 +96,7 @@ double Trade<T>::GetPrice() const
 }
 
 template<typename T>
-const string& Trade<T>::GetBook() const
+const BookId& Trade<T>::GetBook() const
 {
   return book;
 }
@@ -127,7 +128,7 @@ template<typename T>
 class TradeBookingService : public Service<string,Trade <T> >
 {
 private:
-  map<string, Trade<T>> tradeMap; // store trade data keyed by trade id
+  PooledMap<TradeId, Trade<T>> tradeMap; // store trade data keyed by trade id
   vector<ServiceListener<Trade<T>>*> listeners; // list of listeners to this service
   TradeBookingServiceListener<T>* tradebookinglistener;
   string host; // host name for inbound connector
@@ -136,7 +137,7 @@ private:
 
 public:
   // ctor and dtor
-  TradeBookingService(const string& _host, const string& _port);
+  TradeBookingService(const Strand& _strand, const string& _host, const string& _port);
   ~TradeBookingService()=default;
 
   // Get data
@@ -163,10 +164,10 @@ public:
 };
 
 template<typename T>
-TradeBookingService<T>::TradeBookingService(const string& _host, const string& _port)
+TradeBookingService<T>::TradeBookingService(const Strand& _strand, const string& _host, const string& _port)
 : host(_host), port(_port)
 {
-  connector = new TradeDataConnector<T>(this, host, port); // connector related to this server
+  connector = new TradeDataConnector<T>(this, _strand, host, port); // connector related to this server
   tradebookinglistener = new TradeBookingServiceListener<T>(this); // listener related to this server
 }
 
@@ -174,17 +175,17 @@ TradeBookingService<T>::TradeBookingService(const string& _host, const string& _
 template<typename T>
 Trade<T>& TradeBookingService<T>::GetData(string key)
 {
-  return tradeMap[key];
+  return tradeMap[TradeId(key)];
 }
 
 template<typename T>
 void TradeBookingService<T>::OnMessage(Trade<T> &data)
 {
-  string key = data.GetTradeId();
+  const TradeId& key = data.GetTradeId();
   if (tradeMap.find(key) != tradeMap.end())
     tradeMap[key] = data;
   else
-    tradeMap.insert(pair<string, Trade<T>>(key, data));
+    tradeMap.insert(pair<TradeId, Trade<T>>(key, data));
 
   for(auto& listener : listeners)
     listener->ProcessAdd(data);
@@ -240,16 +241,16 @@ private:
   TradeBookingService<T>* service;
   string host; // host name
   string port; // port number
-  boost::asio::io_service io_service; // io service
-  boost::asio::ip::tcp::socket socket; // socket
+  Strand strand; // strand serializing the handlers of this feed
+  boost::asio::ip::tcp::acceptor acceptor; // acceptor listening on host:port
 
   void handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request);
-  void start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service);
+  void start_accept();
 
 public:
   // ctor
-  TradeDataConnector(TradeBookingService<T>* _service, const string& _host, const string& _port);
-  // dtor: close the socket
+  TradeDataConnector(TradeBookingService<T>* _service, const Strand& _strand, const string& _host, const string& _port);
+  // dtor: close the acceptor
   ~TradeDataConnector();
 
   // Publish data to the Connector
@@ -261,26 +262,33 @@ public:
 };
 
 template<typename T>
-TradeDataConnector<T>::TradeDataConnector(TradeBookingService<T>* _service, const string& _host, const string& _port)
-: service(_service), host(_host), port(_port), socket(io_service)
+TradeDataConnector<T>::TradeDataConnector(TradeBookingService<T>* _service, const Strand& _strand, const string& _host, const string& _port)
+: service(_service), host(_host), port(_port), strand(_strand), acceptor(_strand)
 {
 }
 
 template<typename T>
 TradeDataConnector<T>::~TradeDataConnector()
 {
-  socket.close();
+  acceptor.close();
 }
 
 template<typename T>
-void TradeDataConnector<T>::start_accept(boost::asio::ip::tcp::acceptor* acceptor, boost::asio::io_service* io_service) {
-  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(*io_service);
-  acceptor->async_accept(*socket, [this, socket, acceptor, io_service](const boost::system::error_code& ec) {
+void TradeDataConnector<T>::start_accept() {
+  // sockets live on the feed's strand, so all handlers of a connection run in order
+  boost::asio::ip::tcp::socket* socket = new boost::asio::ip::tcp::socket(strand);
+  acceptor.async_accept(*socket, [this, socket](const boost::system::error_code& ec) {
+    if (ec == boost::asio::error::operation_aborted) {
+      delete socket; // acceptor closed, stop accepting
+      return;
+    }
     if (!ec) {
       boost::asio::streambuf* request = new boost::asio::streambuf;
       boost::asio::async_read_until(*socket, *request, "\n", std::bind(&TradeDataConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
+    } else {
+      delete socket;
     }
-    start_accept(acceptor, io_service); // accept the next connection
+    start_accept(); // accept the next connection
   });
 }
 
@@ -288,44 +296,32 @@ void TradeDataConnector<T>::start_accept(boost::asio::ip::tcp::acceptor* accepto
 template<typename T>
 void TradeDataConnector<T>::handle_read(const boost::system::error_code& ec, std::size_t length, boost::asio::ip::tcp::socket* socket, boost::asio::streambuf* request) {
   if (!ec) {
-    std::string data = std::string(boost::asio::buffers_begin(request->data()), boost::asio::buffers_end(request->data()));
-    // find the last newline
-    std::size_t last_newline = data.rfind('\n');
-    if (last_newline != std::string::npos) {
-      // consume only up to the last newline
-      request->consume(last_newline + 1);
-      // only process the data up to the last newline
-      data = data.substr(0, last_newline);
-    } else {
-      // if there's no newline, don't process any data
-      data.clear();
-    }
-
-    // split the data into lines
-    std::stringstream ss(data);
-    std::string line;
-    while (std::getline(ss, line)) {
+    // parse the complete lines in place, the fields view the buffer until it is consumed
+    string_view data(static_cast<const char*>(request->data().data()), request->size());
+    ArenaScope scope(threadArena());
+    ArenaVector<string_view> tokens{ArenaAllocator<string_view>(threadArena())};
+    size_t parsed = forEachLine(data, [&](string_view line) {
       // parse the line
-      vector<string> tokens;
-      stringstream lineStream(line);
-      string token;
-      while(getline(lineStream, token, ','))
-        tokens.push_back(token);
+      splitFields(line, tokens);
+      // identifiers must fit their inline strings, a bad line is logged and skipped
+      if (tokens.size() < 6 || tokens[0].size() > ProductId::CAPACITY || tokens[1].size() > TradeId::CAPACITY || tokens[3].size() > BookId::CAPACITY) {
+        LOG_ASYNC(LogLevel::WARNING, "Skipping invalid trade line: {}", line);
+        return;
+      }
 
       // create a trade object
-      string productId = tokens[0];
-      // create product object based on product id
-      T product = getProductObject<T>(productId);
-      string tradeId = tokens[1];
+      // get the product object of the product id, built once
+      const T& product = lookupProduct<T>(tokens[0]);
       double price = convertPrice(tokens[2]);
-      string book = tokens[3];
-      long quantity = stol(tokens[4]);
+      long quantity = parseInteger(tokens[4]);
       Side side = tokens[5] == "BUY" ? BUY : SELL;
-      Trade<T> trade(product, tradeId, price, book, quantity, side);
+      Trade<T> trade(product, tokens[1], price, tokens[3], quantity, side);
 
       // flows data to trade booking service
       service->OnMessage(trade);
-    }
+    });
+    // only the complete lines are consumed
+    request->consume(parsed);
 
     boost::asio::async_read_until(*socket, *request, "\n", std::bind(&TradeDataConnector<T>::handle_read, this, std::placeholders::_1, std::placeholders::_2, socket, request));
   } else {
@@ -344,17 +340,19 @@ void TradeDataConnector<T>::Subscribe()
 {
   log(LogLevel::NOTE, "Trade data server listening on " + host + ":" + port);
   try {
-  // connect to the socket
-  boost::asio::ip::tcp::resolver resolver(io_service);
-  boost::asio::ip::tcp::resolver::query query(host, port);
-  boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(query);
-  boost::asio::ip::tcp::acceptor acceptor(io_service, endpoint);
-  start_accept(&acceptor, &io_service);
-  io_service.run();
+  // bind the acceptor on the shared server context, the worker pool runs the handlers
+  boost::asio::ip::tcp::resolver resolver(strand);
+  boost::asio::ip::tcp::endpoint endpoint = resolver.resolve(host, port)->endpoint();
+  acceptor.open(endpoint.protocol());
+  acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  acceptor.bind(endpoint);
+  acceptor.listen();
+  start_accept();
   }
   catch (std::exception& e){
     // throw error log
     log(LogLevel::ERROR, e.what());
+    acceptor.close();
     return;
   }
 }
@@ -404,8 +402,8 @@ TradeBookingServiceListener<T>::TradeBookingServiceListener(TradeBookingService<
 template<typename T>
 void TradeBookingServiceListener<T>::ProcessAdd(ExecutionOrder<T> &data)
 {
-  T product = data.GetProduct();
-  string orderId = data.GetOrderId();
+  const T& product = data.GetProduct();
+  const OrderId& orderId = data.GetOrderId();
   double price = data.GetPrice();
   PricingSide pside = data.GetSide();  
   long vQty = data.GetVisibleQuantity();
@@ -420,7 +418,7 @@ void TradeBookingServiceListener<T>::ProcessAdd(ExecutionOrder<T> &data)
       side = SELL;
       break;
   }
-  string book;
+  const char* book = "";
   // switch book based on count
   count++;
   switch (count%3)
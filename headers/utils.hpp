@@ -9,6 +9,10 @@
 #define UTILS_HPP
 
 #include <string>
+#include <string_view>
+#include <charconv>
+#include <system_error>
+#include <stdexcept>
 #include <vector>
 #include <iomanip>
 #include <iostream>
@@ -18,6 +22,7 @@
 #include <thread>
 
 #include "products.hpp"
+#include "clock.hpp"
 
 using namespace std;
 
@@ -43,32 +48,15 @@ string join(const vector<string>& v, const string& delimiter) {
 
 // get the system time and return in milliseconds format (e.g. 2023-12-23 22:42:44.260)
 string getTime() {
-    auto now = std::chrono::system_clock::now();
-    std::time_t now_c = std::chrono::system_clock::to_time_t(now);
-
-    // change the system time to local time
-    std::tm now_tm = *std::localtime(&now_c);
-
-    // use stringstream to format the time
-    stringstream ss;
-    ss << std::put_time(&now_tm, "%Y-%m-%d %H:%M:%S");
-
-    // get the milliseconds separately
-    auto milli = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-    ss << '.' << std::setfill('0') << std::setw(3) << milli.count();
-
-    return ss.str();
+    // the date and time of the current second are cached by the formatter of each thread
+    thread_local TimestampFormatter formatter;
+    return formatter.Format(getWallNanos());
 }
 
 // change time point format to string 
 string getTime(std::chrono::system_clock::time_point now) {
-    std::time_t now_c = std::chrono::system_clock::to_time_t(now);
-    std::tm now_tm = *std::localtime(&now_c);
-    stringstream ss;
-    ss << std::put_time(&now_tm, "%Y-%m-%d %H:%M:%S");
-    auto milli = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-    ss << '.' << std::setfill('0') << std::setw(3) << milli.count();
-    return ss.str();
+    thread_local TimestampFormatter formatter;
+    return formatter.Format(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
 }
 
 
@@ -174,24 +162,42 @@ double getPV01(const string& cusip) {
     return it->second;
 }
 
+// parse a decimal number at the start of a text, without allocation
+double parseDecimal(string_view text) {
+    double value = 0;
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    if (result.ec != errc()) {
+        throw std::invalid_argument("Not a number: " + string(text));
+    }
+    return value;
+}
+
+// parse an integer at the start of a text, without allocation
+long parseInteger(string_view text) {
+    long value = 0;
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    if (result.ec != errc()) {
+        throw std::invalid_argument("Not an integer: " + string(text));
+    }
+    return value;
+}
+
 // change US treasury prices from fractional notation to decimal notation
-double convertPrice(const string& priceStr) {
+double convertPrice(string_view priceStr) {
     // if the price is in decimal notation, return it directly
-    if (priceStr.find_first_of('-') == string::npos) {
-        return stod(priceStr);
+    size_t pos = priceStr.find('-');
+    if (pos == string_view::npos) {
+        return parseDecimal(priceStr);
     }
 
     // if the price is in fractional notation, convert it to decimal notation
-    // first, split the string into two parts
-    size_t pos = priceStr.find_first_of('-');
-    string str1 = priceStr.substr(0, pos);
-    string str2 = priceStr.substr(pos+1, 2);
-    string str3 = priceStr.substr(pos+3, 1);
-    if (str3 == "+") {
-        str3 = "4";
-    }
+    // the handle, the 32nds (2 digits) and the eighths of a 32nd (+ for 4)
+    double handle = parseDecimal(priceStr.substr(0, pos));
+    double xy = parseDecimal(priceStr.substr(pos+1, 2));
+    string_view zStr = priceStr.substr(pos+3, 1);
+    double z = (zStr == "+") ? 4 : parseDecimal(zStr);
 
-    double res = stod(str1) + stod(str2)*1.0 / 32.0 + stod(str3)*1.0 / 256.0;
+    double res = handle + xy*1.0 / 32.0 + z*1.0 / 256.0;
     return res;
 }
 
@@ -206,6 +212,37 @@ string convertPrice(double price) {
 
 }
 
+// split a line into its fields, the fields view the line
+template<typename Container>
+void splitFields(string_view line, Container& fields, char separator = ',') {
+    fields.clear();
+    size_t start = 0;
+    while (true) {
+        size_t end = line.find(separator, start);
+        if (end == string_view::npos) {
+            fields.push_back(line.substr(start));
+            return;
+        }
+        fields.push_back(line.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+// call a function on each complete non-empty line of a buffer
+// returns the number of bytes up to the last newline, which the caller can consume
+template<typename F>
+size_t forEachLine(string_view data, F&& process) {
+    size_t lastNewline = data.rfind('\n');
+    if (lastNewline == string_view::npos) return 0;
+    size_t start = 0;
+    while (start <= lastNewline) {
+        size_t end = data.find('\n', start);
+        if (end > start) process(data.substr(start, end - start));
+        start = end + 1;
+    }
+    return lastNewline + 1;
+}
+
 // generate oscillating spread between 1/64 and 1/128
 double genRandomSpread(std::mt19937& gen) {
     std::uniform_real_distribution<double> dist(1.0/128.0, 1.0/64.0);
@@ -213,16 +250,16 @@ double genRandomSpread(std::mt19937& gen) {
 }
 
 // Generate random ID with numbers and letters
+// used for the generated data files, unique identifiers of the system come from GenerateId in idgenerator.hpp
 string GenerateRandomId(long length)
 {
-    string id = "";
-    for (int j = 0; j < length; ++j) {
-        int random = rand() % 36;
-        if (random < 10) {
-            id += to_string(random);
-        } else {
-            id += static_cast<char>('A' + random - 10);
-        }
+    // one engine per thread instead of the global state of rand(), default-seeded so the data files are reproducible
+    thread_local std::mt19937 gen;
+    std::uniform_int_distribution<int> dist(0, 35);
+    string id(length, '0');
+    for (long j = 0; j < length; ++j) {
+        int random = dist(gen);
+        id[j] = random < 10 ? static_cast<char>('0' + random) : static_cast<char>('A' + random - 10);
     }
     return id;
 }
@@ -5,9 +5,10 @@
  * External data flows in the system through:
  * 	1. price data -> pricing service -> algo streaming service -> streaming service -> historical data service
 	   (another data flow: pricing service -> GUI service -> GUI data output)
- * 	2. orderbook data -> market data service -> algo execution service -> execution service -> historical data service
+ * 	2. orderbook data -> market data service -> algo execution service -> pre-trade risk service -> execution service -> historical data service
  * 	   (another data flow: execution service -> trade booking service -> position service -> risk service -> historical data service)
  * 	3. trade data -> trade booking service -> position service -> risk service -> historical data service
+ * 	   (another data flow: trade booking service and pricing service -> pnl service -> historical data service)
  * 	4. inquiry data -> inquiry service -> historical data service
  * 	
  * @author Boyu Yang
@@ -18,16 +19,24 @@
 #include <iomanip>
 #include <filesystem>
 #include <thread>
+#include <fstream>
+#include <sstream>
+#include <charconv>
+#include <string_view>
 
 #include "headers/soa.hpp"
+#include "headers/servercontext.hpp"
 #include "headers/products.hpp"
 #include "headers/marketdataservice.hpp"
 #include "headers/pricingservice.hpp"
 #include "headers/riskservice.hpp"
+#include "headers/scenarioengine.hpp"
 #include "headers/executionservice.hpp"
 #include "headers/positionservice.hpp"
 #include "headers/inquiryservice.hpp"
 #include "headers/historicaldataservice.hpp"
+#include "headers/pretraderiskservice.hpp"
+#include "headers/persistencewriter.hpp"
 #include "headers/streamingservice.hpp"
 #include "headers/algostreamingservice.hpp"
 #include "headers/tradebookingservice.hpp"
@@ -38,9 +47,9 @@
 using namespace std;
 
 /**
- * server thread function
+ * server start function
  * The whole system is designed so that subscribe() method
- * opens a separate process and listens to the data on the socket
+ * binds the server to its socket, the shared server context then runs all servers
  */
 template<typename T>
 void Server(T& service)
@@ -48,7 +57,21 @@ void Server(T& service)
 	service.GetConnector()->Subscribe();
 }
 
-int main(int, char**){
+int main(int argc, char** argv){
+
+	// 0. the worker pool size can be passed as the first argument, up to four workers per core
+	unsigned int cores = max(1u, thread::hardware_concurrency());
+	size_t numThreads = cores;
+	if (argc > 1) {
+		string_view argument = argv[1];
+		long value = 0;
+		auto result = from_chars(argument.data(), argument.data() + argument.size(), value);
+		if (result.ec != errc() || result.ptr != argument.data() + argument.size() || value <= 0 || value > 4L * cores) {
+			cerr << "Usage: " << argv[0] << " [threads], with 1 to " << 4 * cores << " worker threads" << endl;
+			return 1;
+		}
+		numThreads = static_cast<size_t>(value);
+	}
 
 	// 1. define data path and generate data
 	// 1.1 create folders that store data and results
@@ -83,62 +106,166 @@ int main(int, char**){
 
     // 2. start trading service
     log(LogLevel::INFO, "Starting trading system...");
-    // 2.1 create four servers with host adn different ports
+    // 2.1 create one server context shared by all servers
+	ServerContext serverContext(numThreads);
+	// historical data is written by one asynchronous writer thread, files are synced once a second
+	PersistenceWriter persistenceWriter(FSYNC_INTERVAL, 1000);
+	// market data and trades both book into the trade booking, position and risk services, so the two feeds share one strand
+	Strand bookingStrand = serverContext.MakeStrand();
+	// prices, streams and the gui share one strand
+	Strand priceStrand = serverContext.MakeStrand();
+	// one timer wheel drives the gui throttle, the algo slices, the risk and scenario refreshes, the reconnects and the quote expiry
+	TimerService timerService(serverContext);
+	// the TSC clock stamping the logs, the gui and the historical data follows the wall clock, recalibrated once a second
+	Strand clockStrand = serverContext.MakeStrand();
+	function<void()> recalibrateClock = [&]() {
+		tscClock.Recalibrate();
+		timerService.Schedule(TSC_RECALIBRATION_MS, clockStrand, recalibrateClock);
+	};
+	timerService.Schedule(TSC_RECALIBRATION_MS, clockStrand, recalibrateClock);
+
+    // 2.2 create six servers with host and different ports
     log(LogLevel::INFO, "Initializing service components...");
-	PricingService<Bond> pricingService("localhost", "3000");
-	MarketDataService<Bond> marketDataService("localhost", "3001");
-	TradeBookingService<Bond> tradeBookingService("localhost", "3002");
-	InquiryService<Bond> inquiryService("localhost", "3003");
-	StreamingService<Bond> streamingService("localhost", "3004");
-	ExecutionService<Bond> executionService("localhost", "3005");
-
-	AlgoStreamingService<Bond> algoStreamingService;
-	AlgoExecutionService<Bond> algoExecutionService;
+	PricingService<Bond> pricingService(priceStrand, "localhost", "3000");
+	MarketDataService<Bond> marketDataService(bookingStrand, "localhost", "3001");
+	TradeBookingService<Bond> tradeBookingService(bookingStrand, "localhost", "3002");
+	InquiryService<Bond> inquiryService(serverContext.MakeStrand(), "localhost", "3003");
+	StreamingService<Bond> streamingService(serverContext.MakeStrand(), "localhost", "3004", &timerService);
+	ExecutionService<Bond> executionService(serverContext.MakeStrand(), "localhost", "3005", &timerService);
+
+	AlgoStreamingService<Bond> algoStreamingService(&timerService, priceStrand);
+	AlgoExecutionService<Bond> algoExecutionService(&timerService, bookingStrand);
 	PositionService<Bond> positionService;
-	RiskService<Bond> riskService;
-	GUIService<Bond> guiService;
-
-	HistoricalDataService<Position<Bond>> historicalPositionService(POSITION);
-	HistoricalDataService<PV01<Bond>> historicalRiskService(RISK);
-	HistoricalDataService<ExecutionOrder<Bond>> historicalExecutionService(EXECUTION);
-	HistoricalDataService<PriceStream<Bond>> historicalStreamingService(STREAMING);
-	HistoricalDataService<Inquiry<Bond>> historicalInquiryService(INQUIRY);
+	// the yields of the live prices are solved in batches on the price strand
+	RiskService<Bond> riskService(&timerService, &priceStrand);
+	PnLService<Bond> pnlService;
+	PreTradeRiskService<Bond> preTradeRiskService(4.0e9);
+	RejectFileListener<Bond> rejectFileListener(&persistenceWriter, "../res/rejects.txt");
+	AlgoFillListener<Bond> algoFillListener(&algoExecutionService);
+	AlgoRejectListener<Bond> algoRejectListener(&algoExecutionService);
+	GUIService<Bond> guiService(&timerService, priceStrand, GUI_FILE | GUI_SNAPSHOT);
+
+	HistoricalDataService<Position<Bond>> historicalPositionService(POSITION, &persistenceWriter, TEXT | SEGMENT | ARCHIVE);
+	HistoricalDataService<PV01<Bond>> historicalRiskService(RISK, &persistenceWriter, TEXT | SEGMENT | ARCHIVE);
+	HistoricalDataService<ExecutionOrder<Bond>> historicalExecutionService(EXECUTION, &persistenceWriter, TEXT | SEGMENT | ARCHIVE);
+	HistoricalDataService<PriceStream<Bond>> historicalStreamingService(STREAMING, &persistenceWriter, TEXT | SEGMENT | ARCHIVE);
+	HistoricalDataService<Inquiry<Bond>> historicalInquiryService(INQUIRY, &persistenceWriter, TEXT | SEGMENT | ARCHIVE);
+	HistoricalDataService<PnL<Bond>> historicalPnLService(PNL, &persistenceWriter, TEXT | SEGMENT | ARCHIVE);
 	log(LogLevel::INFO, "Trading service initialized.");
 
-	// 2.2 create listeners
+	// 2.3 create listeners
 	log(LogLevel::INFO, "Linking service listeners...");
 	pricingService.AddListener(algoStreamingService.GetAlgoStreamingListener());
 	pricingService.AddListener(guiService.GetGUIServiceListener());
 	algoStreamingService.AddListener(streamingService.GetStreamingServiceListener());
 	marketDataService.AddListener(algoExecutionService.GetAlgoExecutionServiceListener());
-	algoExecutionService.AddListener(executionService.GetExecutionServiceListener());
+	algoExecutionService.AddListener(preTradeRiskService.GetPreTradeRiskServiceListener());
+	preTradeRiskService.AddListener(executionService.GetExecutionServiceListener());
+	preTradeRiskService.AddRejectListener(&rejectFileListener);
+	preTradeRiskService.AddRejectListener(&algoRejectListener);
+	tradeBookingService.AddListener(&algoFillListener);
+	positionService.AddListener(preTradeRiskService.GetPreTradePositionListener());
+	riskService.AddListener(preTradeRiskService.GetPreTradePV01Listener());
 	executionService.AddListener(tradeBookingService.GetTradeBookingServiceListener());
 	tradeBookingService.AddListener(positionService.GetPositionListener());
 	positionService.AddListener(riskService.GetRiskServiceListener());
+	pricingService.AddListener(riskService.GetRiskYieldListener());
+	tradeBookingService.AddListener(pnlService.GetPnLTradeListener());
+	pricingService.AddListener(pnlService.GetPnLPriceListener());
 
 	positionService.AddListener(historicalPositionService.GetHistoricalDataServiceListener());
 	executionService.AddListener(historicalExecutionService.GetHistoricalDataServiceListener());
 	streamingService.AddListener(historicalStreamingService.GetHistoricalDataServiceListener());
 	riskService.AddListener(historicalRiskService.GetHistoricalDataServiceListener());
 	inquiryService.AddListener(historicalInquiryService.GetHistoricalDataServiceListener());
+	pnlService.AddListener(historicalPnLService.GetHistoricalDataServiceListener());
 	log(LogLevel::INFO, "Service listeners linked.");
 
-	// 3. start six system servers in different threads
+	// 2.4 register the bucketed sectors of the risk dashboards, sectors may overlap
+	vector<pair<string, vector<string>>> sectors = {
+		{"FrontEnd", {"9128283H1", "9128283L2"}},
+		{"Belly", {"912828M80", "9128283J7", "9128283F5"}},
+		{"LongEnd", {"912810TW8", "912810RZ3"}},
+		{"2s5s10s", {"9128283H1", "912828M80", "9128283F5"}},
+		{"Curve", bonds},
+	};
+	for (auto& sector : sectors) {
+		vector<Bond> products;
+		for (auto& cusip : sector.second) {
+			products.push_back(getProductObject<Bond>(cusip));
+		}
+		riskService.AddBucketedSector(BucketedSector<Bond>(products, sector.first));
+	}
+
+	// 2.5 work the algo orders as parent orders, rotating through TWAP, VWAP and iceberg slicing
+	algoExecutionService.SetSliceParameters({
+		{TWAP, 2000, 200, 0.0, 0},
+		{VWAP, 2000, 200, 0.1, 0},
+		{ICEBERG, 2000, 100, 0.0, 1000000},
+	});
+
+	// 2.6 set the pre-trade limits of every product: order size, book and product positions, PV01 and order rate
+	RiskLimits limits = {10000000, 300000000, 750000000, 1.0e9, 1000.0, 100.0};
+	for (auto& cusip : bonds) {
+		preTradeRiskService.SetLimits(cusip, limits);
+	}
+
+	// 2.7 stress the live positions under the standard scenario set on every refresh, each run is appended to ../res/scenariohistory.txt
+	RiskAnalytics riskSnapshot;
+	vector<long> quantities;
+	riskService.GetRiskSnapshot(riskSnapshot, quantities);
+	ScenarioEngine scenarioEngine(numThreads);
+	scenarioEngine.SetScenarios(standardScenarios(riskSnapshot), riskSnapshot);
+	PersistenceChannel* scenarioChannel = persistenceWriter.OpenChannel("../res/scenariohistory.txt");
+	Strand scenarioStrand = serverContext.MakeStrand();
+	ostringstream scenarioLines;
+	scenarioLines << fixed << setprecision(2);
+	long scenarioRuns = 0;
+	function<void()> refreshScenarios = [&]() {
+		riskService.GetRiskSnapshot(riskSnapshot, quantities);
+		scenarioEngine.Run(riskSnapshot, quantities);
+		scenarioRuns++;
+		string timestamp = getTime();
+		scenarioLines.str("");
+		for (size_t i = 0; i < scenarioEngine.GetScenarios().size(); ++i) {
+			scenarioLines << timestamp << "," << scenarioEngine.GetScenarios()[i].name << "," << scenarioEngine.GetScenarioPnL()[i] << "\n";
+		}
+		scenarioChannel->Write(scenarioLines.str());
+		timerService.Schedule(SCENARIO_REFRESH_MS, scenarioStrand, refreshScenarios);
+	};
+	timerService.Schedule(SCENARIO_REFRESH_MS, scenarioStrand, refreshScenarios);
+
+	// 3. start six system servers on the shared server context
 	cout << fixed << setprecision(6);
-	vector<thread> threads;
 
 	// four input servers: pricing, market data, trade booking, inquiry
-	threads.push_back(thread(Server<PricingService<Bond>>, ref(pricingService))); 
-	threads.push_back(thread(Server<MarketDataService<Bond>>, ref(marketDataService))); 
-	threads.push_back(thread(Server<TradeBookingService<Bond>>, ref(tradeBookingService))); 
-	threads.push_back(thread(Server<InquiryService<Bond>>, ref(inquiryService))); 
+	Server<PricingService<Bond>>(pricingService);
+	Server<MarketDataService<Bond>>(marketDataService);
+	Server<TradeBookingService<Bond>>(tradeBookingService);
+	Server<InquiryService<Bond>>(inquiryService);
 
 	// two output servers: streaming, execution
-	threads.push_back(thread(Server<StreamingService<Bond>>, ref(streamingService)));
-	threads.push_back(thread(Server<ExecutionService<Bond>>, ref(executionService))); 
+	Server<StreamingService<Bond>>(streamingService);
+	Server<ExecutionService<Bond>>(executionService);
+
+	// run the event loop on the worker pool
+	serverContext.Run();
 
-	for (auto& thread : threads) {
-		join(thread);
+	// 4. stress the final positions under the standard scenario set, as a last pass after the live runs
+	riskService.GetRiskSnapshot(riskSnapshot, quantities);
+	scenarioEngine.Run(riskSnapshot, quantities);
+	ofstream scenarioFile("../res/scenarios.txt");
+	scenarioFile << fixed << setprecision(2);
+	for (size_t i = 0; i < scenarioEngine.GetScenarios().size(); ++i) {
+		scenarioFile << scenarioEngine.GetScenarios()[i].name << "," << scenarioEngine.GetScenarioPnL()[i] << "\n";
+	}
+	log(LogLevel::INFO, "Algo parent orders: " + to_string(algoExecutionService.GetSubmittedCount()) + " submitted, " + to_string(algoExecutionService.GetParentCount(COMPLETED)) + " completed, " + to_string(algoExecutionService.GetParentCount(EXPIRED)) + " expired, " + to_string(algoExecutionService.GetParentCount(WORKING)) + " working, " + to_string(algoExecutionService.GetChildCount()) + " child orders");
+	log(LogLevel::INFO, "Pre-trade risk checked " + to_string(preTradeRiskService.GetCheckCount()) + " orders in " + to_string(preTradeRiskService.GetAverageCheckNanos()) + " ns on average");
+	for (int reason = 0; reason < REJECT_REASONS; ++reason) {
+		long count = preTradeRiskService.GetRejectCount(static_cast<RejectReason>(reason));
+		if (count > 0) log(LogLevel::INFO, "Pre-trade rejects " + rejectReasonName(static_cast<RejectReason>(reason)) + ": " + to_string(count));
 	}
+	log(LogLevel::INFO, "GUI published " + to_string(guiService.GetPublishCount()) + " prices, " + to_string(guiService.GetConflatedCount()) + " conflated");
+	log(LogLevel::INFO, "Scenario P&L of " + to_string(scenarioEngine.GetScenarios().size()) + " scenarios run " + to_string(scenarioRuns) + " times live, final run written to ../res/scenarios.txt");
 
 }